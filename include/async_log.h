@@ -0,0 +1,75 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+/**
+    Asynchronous backend for the program_IO macros.
+
+    Normally cprint(), warning() and friends do a blocking, flushed write
+    to std::cout from whatever thread calls them, RT threads included.
+    Once async_log::start() has been called they copy their text into a
+    ring owned by the calling thread instead, and a writer thread drains
+    all the rings and does the write()s.  Nobody's call sites change.
+
+    What the caller pays is the snprintf() it always paid, a copy into its
+    ring and a fence: no lock, no syscall (unless the writer is asleep and
+    needs a kick), and no waiting on a slow terminal.  Each thread's ring
+    is single producer, single consumer (spsc_ring), so threads don't
+    contend with each other either.
+
+    If a thread's ring is full the record is dropped and counted rather
+    than making the caller wait, and the writer prints how many were lost.
+    Records from one thread come out in order; records from different
+    threads are interleaved a batch at a time, not strictly by time.
+
+    The writer can be pinned to a housekeeping CPU with run_on_cpu(), so
+    the formatting and write()s stay off the CPUs doing real work.
+
+    stop() drains everything and goes back to synchronous output.  It's
+    also registered with atexit(), so a normal exit doesn't lose anything.
+    error() and runtime() go through the rings too, but their text is in
+    the exception they throw anyway.
+*/
+
+#include <string>
+
+namespace async_log_constants
+{
+    const std::string DEFAULT_NAME("async log writer");
+
+    enum
+    {
+        NO_CPU = -1,                // don't pin the writer
+        DEFAULT_RING_CHUNKS = 1024, // per thread, 128 bytes each
+        CHUNK_TEXT = 124            // text bytes per chunk
+    };
+}
+
+namespace ALC = async_log_constants;
+
+namespace async_log
+{
+    void start(int cpu = ALC::NO_CPU,
+               unsigned int ring_chunks = ALC::DEFAULT_RING_CHUNKS);
+    void stop(void);
+    bool running(void);
+
+    // Wait until everything logged before the call has been written.
+    void flush(void);
+
+    // Records thrown away because their thread's ring was full.
+    unsigned long dropped(void);
+
+    // Used by program_output().  True if the record has been dealt with
+    // (queued, or dropped and counted); false if the backend isn't
+    // running and the caller should write it out itself.
+    bool submit(int kind, const char *text, unsigned int length);
+
+    // For binary_log.h: the bytes are framed and written to the binary
+    // file descriptor instead of stdout.  True only if the record made
+    // it into the ring: false if the backend isn't running, or the ring
+    // was full (which gets counted as a drop).
+    bool submit_binary(int kind, const void *data, unsigned int length);
+    void set_binary_fd(int fd);
+}
+
+#endif  // ASYNC_LOG_H
@@ -0,0 +1,77 @@
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+/**
+    Deferred formatting for the *_CPRINT / DP family.
+
+    Even with async_log running, the snprintf() on the calling thread is
+    most of what a log statement costs.  While binary logging is on, those
+    macros skip it and call binary_record() instead, which stores
+
+        - the format string's address (it's a literal, so it's fixed)
+        - a get_time() timestamp
+        - the raw arguments, pulled off the va_list according to the
+          conversions in the format (%s strings get copied, up to
+          BLC::MAX_STRING bytes)
+
+    and hands that to async_log's rings, which write it out to a file
+    instead of stdout.  The first time a format shows up its text goes
+    into the file too, so decode() (and the log_decode tool built on it)
+    can put the text back together offline.
+
+    How a format's arguments are laid out is worked out once and cached
+    in a lock-free table keyed by the format's address, so each call is a
+    table lookup, a pass over the arguments and a copy.
+
+    Everything else (warnings, errors and so on) still goes out as text.
+    get_time() is only meaningful after init_timer(), so call that first
+    if you want real timestamps.
+
+    File layout, all little-endian:
+
+        "SYSBLOG" and a version byte
+        frames of: kind (1 byte), payload length (2 bytes), payload
+
+    A FORMAT_RECORD payload is the format's address (8 bytes) and then its
+    text.  Any other kind is a log_kind_t, with a payload of the format's
+    address (8 bytes), the timestamp (a double, 8 bytes), then each
+    argument: int as 4 bytes; longs, pointers, size_t and friends as 8;
+    doubles (long doubles too) as 8; strings as a 2 byte length
+    (0xFFFF for a null pointer) and the bytes.
+*/
+
+#include <iosfwd>
+#include <string>
+
+#include "async_log.h"
+
+namespace binary_log_constants
+{
+    enum
+    {
+        FORMAT_RECORD = 0x80,       // frame kind of a format's text
+        FORMAT_TABLE_SIZE = 4096,   // distinct formats (power of 2)
+        MAX_STRING = 256,           // bytes kept of each %s
+        FILE_VERSION = 1
+    };
+
+    const char MAGIC[] = "SYSBLOG";     // plus the version byte
+}
+
+namespace BLC = binary_log_constants;
+
+namespace binary_log
+{
+    // Starts async_log as well if it isn't already going.
+    void start(const std::string &path,
+               int cpu = ALC::NO_CPU,
+               unsigned int ring_chunks = ALC::DEFAULT_RING_CHUNKS);
+    void stop(void);
+    bool running(void);
+
+    // Turn a binary log back into text, one line per record, each starting
+    // with its timestamp.  Throws if 'in' isn't a binary log.
+    void decode(std::istream &in, std::ostream &out);
+}
+
+#endif  // BINARY_LOG_H
@@ -0,0 +1,93 @@
+#ifndef CPU_POWER_CONTROL_H
+#define CPU_POWER_CONTROL_H
+
+/**
+    Keeping the CPUs of an RT cpuset awake and at speed.
+
+    A CPU in a deep C-state takes 50-200 us to come back when its thread's
+    timer or interrupt fires, and one that's clocked down takes a while to
+    clock back up.  busy_delay() spinning hides some of that, but only while
+    it's spinning.  So for the CPUs of a cpuset (or a list of them):
+
+        hold_dma_latency()      opens /dev/cpu_dma_latency and writes the
+                                latency we can stand.  The PM QoS request
+                                holds as long as the file is open, and it's
+                                system wide: it applies to every CPU.
+        set_governor()          cpufreq scaling_governor: "performance".
+        set_min_frequency()     cpufreq scaling_min_freq, in kHz; 0 means
+                                as high as scaling_max_freq allows, which
+                                pins the clock there.
+        disable_idle_states()   cpuidle: every state with a wake-up latency
+                                over the limit gets disabled on those CPUs.
+                                Finer grained than the DMA latency request,
+                                and only on the CPUs that need it.
+
+    Every file written is read first, and restore() (or the destructor)
+    writes the old values back, last changed first.  Failures throw, but
+    whatever was already changed is still restored.
+
+    Virtual machines often have no cpufreq or cpuidle at all: set_governor()
+    and set_min_frequency() throw there, disable_idle_states() just
+    returns 0.
+*/
+
+#include <string>
+#include <vector>
+#include <utility>                  // pair
+
+#include "cpuset.h"                 // cpu_vector_t
+
+namespace power_control_constants
+{
+    const std::string DMA_LATENCY_DEVICE("/dev/cpu_dma_latency");
+    const std::string CPU_SYSFS("/sys/devices/system/cpu/cpu");
+
+    const std::string PERFORMANCE("performance");
+
+    enum
+    {
+        MAX_IDLE_STATES = 16,
+        DEFAULT_IDLE_LATENCY_US = 10    // C1 and the like stay usable
+    };
+}
+
+namespace PCC = power_control_constants;
+
+class cpu_power_control
+{
+    typedef std::pair<std::string, std::string> setting_t;  // path, value
+
+    cpu_vector_t CPUs_;
+    std::vector<setting_t> saved_;      // in the order changed
+    int dma_latency_fd_;
+
+private:    // not possible
+    cpu_power_control(const cpu_power_control &);
+    cpu_power_control &operator=(const cpu_power_control &);
+
+private:    // internal
+    void change(const std::string &path, const std::string &value);
+    std::string cpu_path(cpuid_t cpu, const char *file) const;
+
+public:
+    explicit cpu_power_control(const cpuset &set);
+    explicit cpu_power_control(const cpu_vector_t &cpus);
+    ~cpu_power_control(void);
+
+    void hold_dma_latency(unsigned int latency_us = 0);
+    void release_dma_latency(void);
+
+    void set_governor(const std::string &governor = PCC::PERFORMANCE);
+    void set_min_frequency(unsigned int kHz = 0);
+
+    // Returns how many states were disabled, over all the CPUs.
+    unsigned int
+    disable_idle_states(unsigned int max_latency_us
+                            = PCC::DEFAULT_IDLE_LATENCY_US);
+
+    void restore(void);
+
+    const cpu_vector_t &CPUs(void) const { return CPUs_; }
+};
+
+#endif  // CPU_POWER_CONTROL_H
@@ -23,6 +23,8 @@
 
 #include <sys/types.h>
 
+#include "status.h"
+
 class cpuset;
 
 typedef unsigned int cpuid_t;
@@ -44,6 +46,7 @@ private:
 
     std::string *name_;
     std::string *path_;
+    std::string tasks_path_;    // worked out up front for try_add_task()
     cpu_vector_t *CPUs_;
     pid_vector_t *pids_;
 
@@ -95,8 +98,20 @@ public:
 
     const cpu_vector_t &CPUs(void) const { return *CPUs_; }
     const pid_vector_t &pids(void) const { return *pids_; }
+    const cpuset_vector_t &children(void) const { return children_; }
 
     void add_task(pid_t process);
+
+    // No output, no exceptions (status.h).  Nothing's allocated unless
+    // the set has more tasks than pids() has room for.
+    status_t try_add_task(pid_t process);
+
+    // Lots at once, through one open of the tasks file.  Returns how many
+    // went in.  Ones that had exited are dropped; ones the kernel refused
+    // are appended to 'refused', if given.
+    unsigned int add_tasks(const pid_vector_t &processes,
+                           pid_vector_t *refused = 0);
+
     std::string print(void) const;
 
 //  static void set_cpu_count(unsigned int count) { number_cpus_ = count; }
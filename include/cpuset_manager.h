@@ -39,6 +39,25 @@
 
     You cannot have two "kitty"s in my scheme (the map will clash).  I don't
     consider this a serious limitation, or I would've used a multimap.
+
+    A set can also be given a memory budget (see memory_budget.h): a cgroup
+    v2 group of the same name with memory.max / memory.high, which tasks
+    join when they're added to the set.  It goes away with the set,
+    or with any set above it that gets removed.
+
+    steer_irqs_away_from() keeps interrupts off a set's CPUs (see
+    irq_steering.h); the original IRQ affinities come back when the manager
+    is destroyed.
+
+    Making an exclusive set doesn't move anything already running on its
+    CPUs: everything starts out in the root set, which has every CPU.
+    evacuate_to() moves it all into a housekeeping set instead, so the
+    exclusive sets really are empty right away.  Kernel threads bound to
+    one CPU (ksoftirqd/N, kworker/N:M, ...) can't be moved and are left
+    alone.  return_to_root() puts what was moved back (the destructor calls
+    it), so the housekeeping set can be removed.  Tasks started in the
+    housekeeping set since weren't moved by us and stay there: move them
+    yourself before removing it, or its rmdir() will fail.
 */
 
 #include <string>
@@ -46,11 +65,27 @@
 #include <vector>
 #include <iosfwd>
 
+#include <sys/types.h>            // pid_t
 
-class cpuset;
+#include "cpuset.h"               // pid_vector_t
+#include "irq_steering.h"
+#include "memory_budget.h"
+#include "status.h"
 
 // mapped by cpuset's name
 typedef std::map<std::string, cpuset *> cpuset_map_t;
+typedef std::map<std::string, memory_budget *> budget_map_t;
+// what evacuate_to() moved, by housekeeping set
+typedef std::map<std::string, pid_vector_t> evacuation_map_t;
+
+struct evacuation_report_t
+{
+    unsigned int moved;
+    unsigned int pinned_kernel_threads;     //* per-CPU: left where they are
+    unsigned int exited;                    //* gone before we got to them
+    unsigned int passes;                    //* reads of root's task list
+    pid_vector_t refused;                   //* kernel said no
+};
 
 class cpuset_manager
 {
@@ -61,6 +96,9 @@ private:
 
     cpuset *root_;          //* the base cpuset
     cpuset_map_t set_map_;  //* keeps track of all child cpusets
+    budget_map_t budget_map_;   //* sets that have memory budgets
+    irq_steering *irqs_;    //* made the first time it's needed
+    evacuation_map_t evacuated_;    //* for return_to_root()
 
 private:    // unimplemented
 
@@ -69,6 +107,8 @@ private:    // unimplemented
 
 private:    // internal
 
+    void forget_set(const cpuset &set);
+
 public:
 
     cpuset_manager(void);
@@ -83,9 +123,27 @@ public:
                  bool notify_on_release = false);
 
     void add_task_to_set(const std::string &name, pid_t process);
+    status_t try_add_task_to_set(const std::string &name, pid_t process);
 
     void remove_set(const std::string &cpuset_name);
 
+    // Creates the budget the first time, adjusts it after that.  Tasks
+    // already in the set aren't moved into it.
+    void set_memory_budget(const std::string &cpuset_name,
+                           uint64_t max_bytes,
+                           uint64_t high_bytes = MBC::UNLIMITED);
+    const memory_budget &get_memory_budget(const std::string &cpuset_name) const;
+
+    // Protects the set's CPUs and steers every IRQ again, so the report
+    // covers all of them.  allow_irq() applies on the next steer.
+    irq_steering_types::irq_report_t
+    steer_irqs_away_from(const std::string &cpuset_name);
+    void allow_irq(irq_steering_types::irq_t irq, const std::string &cpus);
+
+    evacuation_report_t evacuate_to(const std::string &housekeeping_set);
+    // Returns how many tasks went back.
+    unsigned int return_to_root(void);
+
     const cpuset &get_set(const std::string &cpuset_name) const;
     cpuset &gimme_the_damn_set(const std::string &cpuset_name);
 
@@ -95,6 +153,7 @@ public:
 };
 
 std::ostream &operator <<(std::ostream &o, const cpuset_manager &s);
+std::ostream &operator <<(std::ostream &o, const evacuation_report_t &r);
 
 #endif  // CPUSET_MANAGER_H
 
@@ -0,0 +1,113 @@
+#ifndef EVENT_GROUP_H
+#define EVENT_GROUP_H
+
+/**
+    Companions to pthread_nap for when a whole cohort of threads needs to
+    go at once.  pthread_nap wakes exactly one sleeper, so releasing 16
+    workers means 16 lock/signal/unlock trips in a row, and the last worker
+    starts well after the first.
+
+    event_group: everybody waiting on the group is released by a single
+    broadcast().  The group keeps a generation counter that broadcast()
+    bumps, and waiters sleep on that counter with a futex, so one syscall
+    wakes them all.  Waiters spin for a little while first, since on
+    pinned CPUs the release usually comes quickly and a spinner gets going
+    in well under a microsecond.
+
+    The usual pattern is to grab the generation *before* doing the thing
+    that lets the broadcaster proceed, and then wait on that value:
+
+        int g = group.generation();
+        ...tell the boss we're ready...
+        group.wait(g);
+
+    so that a broadcast that sneaks in between can't be missed.
+
+    signal() is broadcast() for one: the generation still moves on, so
+    spinners and anyone about to sleep see it, but only one thread already
+    asleep in the kernel is woken.  For handing out a single piece of work
+    without stampeding everybody at it.
+
+    phase_barrier: a reusable barrier for a fixed number of participants.
+    Everybody calls arrive_and_wait(); the last one in flips the phase and
+    releases the rest with one futex wake.  Can be used over and over, for
+    instance once per frame.
+*/
+
+#include <string>
+
+namespace event_group_constants
+{
+    const std::string DEFAULT_NAME("event group default name");
+    const std::string DEFAULT_BARRIER_NAME("phase barrier default name");
+
+    enum
+    {
+        DEFAULT_SPINS = 2000    // pause loops before going to sleep
+    };
+}
+
+namespace EGC = event_group_constants;
+
+class event_group
+{
+
+private:
+
+    std::string name_;
+    unsigned int spins_;
+
+    volatile int generation_;
+    volatile int waiters_;
+
+private:    // not possible
+
+    event_group(const event_group &e);
+    event_group &operator =(const event_group &e);
+
+public:
+
+    event_group(const std::string &name = EGC::DEFAULT_NAME,
+                unsigned int spins = EGC::DEFAULT_SPINS);
+    ~event_group(void);
+
+    int generation(void) const { return generation_; }
+
+    void wait(int seen_generation);
+    void block(void);
+    void broadcast(void);
+    void signal(void);
+};
+
+class phase_barrier
+{
+
+private:
+
+    std::string name_;
+    unsigned int parties_;
+    unsigned int spins_;
+
+    volatile int phase_;
+    volatile int arrived_;
+    volatile int waiters_;
+
+private:    // not possible
+
+    phase_barrier(const phase_barrier &b);
+    phase_barrier &operator =(const phase_barrier &b);
+
+public:
+
+    phase_barrier(unsigned int parties,
+                  const std::string &name = EGC::DEFAULT_BARRIER_NAME,
+                  unsigned int spins = EGC::DEFAULT_SPINS);
+    ~phase_barrier(void);
+
+    unsigned int parties(void) const { return parties_; }
+    int phase(void) const { return phase_; }
+
+    bool arrive_and_wait(void);
+};
+
+#endif  // EVENT_GROUP_H
@@ -0,0 +1,48 @@
+#ifndef EVENTFD_NAP_H
+#define EVENTFD_NAP_H
+
+/**
+    A pthread_nap built on an eventfd, so the wakeup is a file descriptor.
+    That means an I/O thread can stick fd() into its epoll/poll/select set
+    alongside its sockets and find out about wakeups without some other
+    thread having to sit in block() and pass the news along.
+
+    block() and wake_up() behave like pthread_nap.  From an event loop,
+    when fd() polls readable call consume() to clear it.
+*/
+
+#include <string>
+
+namespace eventfd_nap_constants
+{
+    const std::string DEFAULT_NAME("eventfd nap default name");
+}
+
+namespace ENC = eventfd_nap_constants;
+
+class eventfd_nap
+{
+
+private:
+
+    std::string name_;
+    int fd_;
+
+private:    // not possible
+
+    eventfd_nap(const eventfd_nap &n);
+    eventfd_nap &operator =(const eventfd_nap &n);
+
+public:
+
+    eventfd_nap(const std::string &name = ENC::DEFAULT_NAME);
+    ~eventfd_nap(void);
+
+    int fd(void) const { return fd_; }
+
+    void block(void);
+    bool consume(void);
+    void wake_up(void);
+};
+
+#endif  // EVENTFD_NAP_H
@@ -0,0 +1,102 @@
+#ifndef IRQ_STEERING_H
+#define IRQ_STEERING_H
+
+/**
+    Keeping hardware interrupts off the CPUs of RT cpusets.
+
+    An exclusive cpuset keeps tasks off its CPUs, but interrupts go
+    wherever /proc/irq/<n>/smp_affinity_list says, and a NIC landing on a
+    pinned thread's CPU is tens of microseconds of jitter.  So:
+
+        protect()   marks CPUs (a cpuset's, or a list) as off limits.
+        allow()     the exception: IRQ n goes on these CPUs, protected or
+                    not.  For the device an RT thread actually services,
+                    whose interrupt should land right next to it.
+        apply()     reads /proc/interrupts and rewrites every numbered
+                    IRQ's affinity: allowed ones as asked, everything else
+                    with the protected CPUs taken out (or onto all the
+                    unprotected CPUs, if that leaves nothing).  Also sets
+                    /proc/irq/default_smp_affinity, for IRQs that show up
+                    later.  Call it again after protecting more.
+        restore()   puts every affinity we changed back the way we found
+                    it.  The destructor does it too.
+
+    Some IRQs can't be moved (per-CPU timers, kernel-managed queue
+    interrupts): the write gets EIO and the IRQ lands in the report's
+    'unmovable' list, rather than stopping everything.
+
+    irqbalance will happily undo all this: stop it, or ban the RT CPUs in
+    its configuration (IRQBALANCE_BANNED_CPULIST).
+*/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iosfwd>
+
+class cpuset;
+
+namespace irq_steering_constants
+{
+    const std::string PROC_INTERRUPTS("/proc/interrupts");
+    const std::string PROC_IRQ("/proc/irq/");
+}
+
+namespace ISC = irq_steering_constants;
+
+namespace irq_steering_types
+{
+    typedef unsigned int irq_t;
+    typedef std::vector<irq_t> irq_vector_t;
+    typedef std::vector<bool> cpu_flags_t;      // indexed by CPU
+
+    struct irq_report_t
+    {
+        unsigned int moved;         //* rewritten to avoid protected CPUs
+        unsigned int allowed;       //* placed by allow()
+        unsigned int untouched;     //* already clear of protected CPUs
+        irq_vector_t unmovable;     //* kernel said no
+    };
+
+    std::ostream &operator <<(std::ostream &o, const irq_report_t &r);
+}
+
+class irq_steering
+{
+    typedef irq_steering_types::irq_t irq_t;
+    typedef irq_steering_types::cpu_flags_t cpu_flags_t;
+
+    typedef std::map<irq_t, std::string> affinity_map_t;   // cpu lists
+
+    unsigned int cpu_count_;
+    cpu_flags_t protected_;
+    affinity_map_t allowed_;
+    affinity_map_t saved_;          // as found, for restore()
+    std::string saved_default_;     // default_smp_affinity, hex mask
+
+private:    // not possible
+    irq_steering(const irq_steering &);
+    irq_steering &operator=(const irq_steering &);
+
+private:    // internal
+    cpu_flags_t checked_cpus(const std::string &list) const;
+    bool set_affinity(irq_t irq, const std::string &list, int *error);
+    void set_default_affinity(const cpu_flags_t &cpus);
+
+public:
+    irq_steering(void);
+    ~irq_steering(void);
+
+    void protect(const cpuset &set);
+    void protect(const std::string &cpus);      // "2-3", "1,5", ...
+
+    void allow(irq_t irq, const std::string &cpus);
+
+    irq_steering_types::irq_report_t apply(void);
+    void restore(void);
+
+    // The numbered IRQs in /proc/interrupts right now.
+    static irq_steering_types::irq_vector_t list_irqs(void);
+};
+
+#endif  // IRQ_STEERING_H
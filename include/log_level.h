@@ -0,0 +1,111 @@
+#ifndef LOG_LEVEL_H
+#define LOG_LEVEL_H
+
+/**
+    Per-module debug levels that can be changed while the program runs.
+
+    Every .cpp with a *_name namespace also has a log_module next to its
+    NAME, and with RUNTIME_LOG_LEVELS set its *_CPRINT, *_VPRINT and *_DP
+    macros check that module's level instead of being compiled out
+    (program_IO.h).  A statement that's turned off costs a load of the
+    module's level and one compare, which is as predictable as branches
+    get.
+
+    A module at level n prints its CPRINTs and VPRINTs if n >= 0, and its
+    DP(d)s if d <= n.  LOG_OFF silences it entirely.  Modules start at
+    LOG_OFF, or DEBUG_0 in a DEBUG_ON build so CPRINTs show up the way
+    they always did, and then anything in the SYSTHING_LOG_LEVELS
+    environment variable is applied:
+
+        SYSTHING_LOG_LEVELS="cpuset=3,random*=1"
+
+    Names are the modules' NAMEs ("cpuset", "scheduler utils", ...); a
+    trailing '*' matches any name starting with what comes before it, and
+    "all" matches everything.  Later entries win.
+
+    Levels can be changed with set() or configure(), or from outside the
+    process with signals once install_signal_control() has been called:
+    by default SIGUSR1 turns every module up one level and SIGUSR2 turns
+    them down one.
+
+    Plain DP() (no module) still goes by the global debug_level.  A program
+    that sets debug_level and wants the modules to follow it can call
+    log_level::set_all(debug_level).
+*/
+
+#include <iosfwd>
+#include <string>
+
+#include <signal.h>                 // SIGUSR1, SIGUSR2
+
+namespace log_level_constants
+{
+    enum
+    {
+        LOG_OFF = -1,
+        MAX_LEVEL = 5               // DEBUG_5
+    };
+
+    const char ENVIRONMENT[] = "SYSTHING_LOG_LEVELS";
+    const char ALL[] = "all";
+}
+
+namespace LLC = log_level_constants;
+
+/**
+    One per module, at namespace scope so it's constructed (and registered)
+    during static initialization.  Never destroyed before exit, so the
+    registry's pointers stay good.
+*/
+
+class log_module
+{
+    volatile int level_;
+    const char *name_;
+    log_module *next_;
+
+private:    // not possible
+    log_module(const log_module &);
+    log_module &operator=(const log_module &);
+
+public:
+    // 'name' has to outlive us: it's meant to be the module's NAME.
+    explicit log_module(const std::string &name);
+
+    bool enabled(int level) const { return level <= level_; }
+
+    const char *name(void) const { return name_; }
+    int level(void) const { return level_; }
+    void set_level(int level);
+
+    // Adds 'delta' and clamps to LOG_OFF .. MAX_LEVEL.  Signal-safe.
+    void adjust(int delta);
+
+    log_module *next(void) const { return next_; }
+};
+
+namespace log_level
+{
+    // Every module registered so far, most recent first.
+    log_module *modules(void);
+
+    // Set every module matching 'name' ("all", "prefix*" or an exact
+    // name) to 'level'.  Returns how many matched.
+    unsigned int set(const std::string &name, int level);
+    void set_all(int level);
+
+    // Level of the first module named exactly 'name'; throws if none.
+    int get(const std::string &name);
+
+    // A comma-separated list of name=level, as in SYSTHING_LOG_LEVELS.
+    // Throws on a malformed entry, before changing anything.
+    void configure(const std::string &spec);
+
+    // One "name level" line per module.
+    void list(std::ostream &out);
+
+    // SIGUSR1 / SIGUSR2 (or whatever's given) turn all modules up / down.
+    void install_signal_control(int louder = SIGUSR1, int quieter = SIGUSR2);
+}
+
+#endif  // LOG_LEVEL_H
@@ -0,0 +1,115 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+/**
+    Memory caps that the kernel actually enforces.
+
+    set_RSS_limit() sets RLIMIT_RSS, which Linux stopped paying attention
+    to long ago.  What does work is the cgroup v2 memory controller:
+
+        memory.high     over this, the group's tasks get throttled and
+                        pushed into reclaim: the soft limit, the one you
+                        want to be near in normal running
+        memory.max      the hard limit: reclaim, then the OOM killer
+
+    A memory_budget is one cgroup v2 group, /sys/fs/cgroup/<base>/<name>/,
+    with the memory controller turned on for it.  cpuset_manager keeps one
+    per set that's been given a budget, named after the set, and puts tasks
+    in both when they're added to the set.  (The cpusets themselves live in
+    the old cpuset filesystem, so it really is two groups.)
+
+    memory_pressure_monitor is a PSI trigger on a group's memory.pressure
+    (or the whole system's, /proc/pressure/memory): it fires when tasks
+    have been stalled waiting on memory for 'stall' us out of any 'window'
+    us.  That shows up well before memory.max does, so a partition can
+    shed load while it's still only slow.  wait() blocks on it, or put
+    fd() in your own poll() for POLLPRI.
+*/
+
+#include <string>
+
+#include <stdint.h>
+#include <sys/types.h>              // pid_t
+
+#include "status.h"
+
+namespace memory_budget_constants
+{
+    const std::string CGROUP_ROOT("/sys/fs/cgroup/");
+    const std::string DEFAULT_BASE("systemthing");
+    const std::string SYSTEM_PRESSURE("/proc/pressure/memory");
+
+    const uint64_t UNLIMITED = ~0ULL;       // written as "max"
+
+    enum
+    {
+        // The kernel allows windows of 0.5 to 10 s, but without
+        // CAP_SYS_RESOURCE only multiples of 2 s.
+        DEFAULT_STALL_US = 150 * 1000,
+        DEFAULT_WINDOW_US = 2000 * 1000
+    };
+}
+
+namespace MBC = memory_budget_constants;
+
+class memory_budget
+{
+    std::string name_;
+    std::string path_;          // with trailing '/'
+    std::string procs_path_;    // for try_add_task(): no building strings
+
+private:    // not possible
+    memory_budget(const memory_budget &);
+    memory_budget &operator=(const memory_budget &);
+
+public:
+    // Creates the group (and <base>) if needed, and turns on the memory
+    // controller for it.  Throws if there's no cgroup v2 memory controller.
+    memory_budget(const std::string &name,
+                  const std::string &base = MBC::DEFAULT_BASE);
+    ~memory_budget(void);
+
+    // UNLIMITED for either means no limit.
+    void set_limits(uint64_t max_bytes, uint64_t high_bytes = MBC::UNLIMITED);
+
+    void add_task(pid_t process);
+    status_t try_add_task(pid_t process);
+
+    uint64_t current_bytes(void) const;
+
+    const std::string &name(void) const { return name_; }
+    const std::string &path(void) const { return path_; }
+};
+
+class memory_pressure_monitor
+{
+    int fd_;
+    std::string path_;
+
+private:    // not possible
+    memory_pressure_monitor(const memory_pressure_monitor &);
+    memory_pressure_monitor &operator=(const memory_pressure_monitor &);
+
+    void open_trigger(uint64_t stall_us, uint64_t window_us, bool full);
+
+public:
+    // 'full' counts only time when every task in the group was stalled,
+    // rather than at least one ("some").
+    memory_pressure_monitor(const memory_budget &budget,
+                            uint64_t stall_us = MBC::DEFAULT_STALL_US,
+                            uint64_t window_us = MBC::DEFAULT_WINDOW_US,
+                            bool full = false);
+
+    // The whole system.
+    explicit memory_pressure_monitor(uint64_t stall_us = MBC::DEFAULT_STALL_US,
+                                     uint64_t window_us = MBC::DEFAULT_WINDOW_US,
+                                     bool full = false);
+    ~memory_pressure_monitor(void);
+
+    // True if the trigger fired, false on timeout (-1 waits forever).
+    bool wait(int timeout_ms = -1);
+
+    int fd(void) const { return fd_; }
+};
+
+#endif  // MEMORY_BUDGET_H
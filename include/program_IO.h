@@ -25,6 +25,8 @@
 
 #include <errno.h>              // errno
 
+#include "log_level.h"          // log_module
+
 enum
 {
     DEFAULT_BUFFER_SIZE = 2048 + 1,
@@ -39,6 +41,35 @@ enum
 
 extern int debug_level;
 
+/*!
+    What kind of statement a piece of output came from.  Everything goes
+    out through program_output(), which writes it to std::cout, or hands it
+    to the async backend (async_log.h) when that's running.
+*/
+
+enum log_kind_t
+{
+    LOG_CPRINT,
+    LOG_VPRINT,
+    LOG_WARNING,
+    LOG_ERROR,
+    LOG_RUNTIME,
+    LOG_REPORT
+};
+
+void program_output(log_kind_t kind, const char *text);
+
+/*!
+    Binary logging (binary_log.h).  While 'binary_log_enabled' is set, the
+    CPRINT / DP family hand their format and raw arguments to
+    binary_record() instead of formatting on the spot.
+*/
+
+extern volatile int binary_log_enabled;
+
+void binary_record(log_kind_t kind, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
 /*!
     Transforms printf-like output into a single 'char *' of maximum length
     DEFAULT_BUFFER_SIZE (truncates if input data is longer) and outputs it
@@ -49,7 +80,7 @@ extern int debug_level;
 #define cprint(format, args...) do { \
                             char Q[DEFAULT_BUFFER_SIZE]; \
                             snprintf(Q, sizeof(Q), format, ##args); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_CPRINT, Q); \
                           } while (0)
 
 // 'v' for verbose
@@ -59,7 +90,7 @@ extern int debug_level;
                             snprintf(Z, sizeof(Z), format, ##args); \
                             snprintf(Q, sizeof(Q), "%s:%s:%d: %s",\
                                      __FILE__, __func__, __LINE__, Z); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_VPRINT, Q); \
                           } while (0)
 
 #define warning(format, args...) do { \
@@ -68,7 +99,7 @@ extern int debug_level;
                             snprintf(Z, sizeof(Z), format, ##args); \
                             snprintf(Q, sizeof(Q), "%s:%s:%d: WARNING: %s",\
                                      __FILE__, __func__, __LINE__, Z); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_WARNING, Q); \
                           } while (0)
 
 
@@ -92,7 +123,7 @@ extern int debug_level;
                             snprintf(Z, sizeof(Z), format, ##args); \
                             snprintf(Q, sizeof(Q), "%s:%s:%d:\nERROR: %s -- %s\n",\
                                      __FILE__, __func__, __LINE__, Z, strerror(errno)); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_ERROR, Q); \
                             throw std::runtime_error(Q); \
                           } while (0)
 
@@ -111,7 +142,7 @@ extern int debug_level;
                             snprintf(Z, sizeof(Z), format, ##args); \
                             snprintf(Q, sizeof(Q), "%s:%s:%d:\nRUNTIME error: %s\n",\
                                      __FILE__, __func__, __LINE__, Z); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_RUNTIME, Q); \
                             throw std::runtime_error(Q); \
                           } while (0)
 
@@ -123,9 +154,58 @@ extern int debug_level;
                             snprintf(Z, sizeof(Z), format, ##args); \
                             snprintf(Q, sizeof(Q), "%s:%s:%d:\nBADNESS: %s -- %s\n",\
                                      __FILE__, __func__, __LINE__, Z, strerror(errno)); \
-                            std::cout << Q << std::flush; \
+                            program_output(LOG_REPORT, Q); \
                           } while (0)
 
+/*!
+    Rate limited warning() and report_error(), for things that can go wrong
+    over and over: a failing write in a loop, a teardown that complains
+    every time.  Each call site gets its own static log_limiter, a token
+    bucket (kept as GCRA: one "next allowed" time, updated with a CAS, so
+    there's no lock) allowing LOG_LIMIT_BURST messages at once and one
+    every LOG_LIMIT_PERIOD_MS after that.  The rest are counted, and the
+    next one that gets through is preceded by how many were held back.
+
+    A suppressed call costs a coarse clock read and an atomic increment:
+    no formatting and no output.
+*/
+
+enum
+{
+    LOG_LIMIT_BURST = 5,
+    LOG_LIMIT_PERIOD_MS = 1000
+};
+
+struct log_limiter
+{
+    volatile long long next_allowed;    //* ns, CLOCK_MONOTONIC_COARSE
+    volatile unsigned long suppressed;  //* since the last one printed
+};
+
+// True if this one should go out; 'suppressed' gets how many didn't since
+// the last one that did.
+bool log_limit(log_limiter *limiter, unsigned long *suppressed);
+void log_suppressed(log_kind_t kind, const char *file, const char *function,
+                    int line, unsigned long count);
+
+#define LOG_LIMITED(kind, output, format, args...) do { \
+                            static log_limiter LIMITER_Q; \
+                            unsigned long SUPPRESSED_Q; \
+                            if (log_limit(&LIMITER_Q, &SUPPRESSED_Q)) \
+                            { \
+                                if (SUPPRESSED_Q) \
+                                    log_suppressed(kind, __FILE__, __func__, \
+                                                   __LINE__, SUPPRESSED_Q); \
+                                output(format, ##args); \
+                            } \
+                          } while (0)
+
+#define warning_limited(format, args...) \
+    LOG_LIMITED(LOG_WARNING, warning, format, ##args)
+
+#define report_error_limited(format, args...) \
+    LOG_LIMITED(LOG_REPORT, report_error, format, ##args)
+
 /**
     Takes a variable name 'field', and print out both the field name and the
     value of the field in hexidecial: intended for numeric values.  May not
@@ -155,6 +235,23 @@ extern int debug_level;
     libc folks.  I would think branch prediction here would be very easy,
     but I dunno.  Maybe code just gets to be too branchy.
 */
+
+/*!
+    What the CPRINT / DP family print with once they've decided to print:
+    formatted right here, or handed to binary_log (binary_log.h) as is.
+*/
+
+#define DEBUG_PRINT(format, args...) \
+    do { \
+        if (binary_log_enabled) \
+            binary_record(LOG_CPRINT, format, ##args); \
+        else \
+            cprint(format, ##args); \
+    } while (0)
+
+#define DEBUG_PRINT_WITH_NAME(name, format, args...) \
+    DEBUG_PRINT("%s: "format, name.c_str(), ##args)
+
 #if !DEBUG_ON
     #define CPRINT_WITH_NAME(name, format, args...) do {} while(0)
     #define VPRINT_WITH_NAME(name, format, args...) do {} while(0) 
@@ -163,7 +260,7 @@ extern int debug_level;
 #else
 
     #define CPRINT_WITH_NAME(name, format, args...) \
-        cprint("%s: "format, name.c_str(), ##args)
+        DEBUG_PRINT_WITH_NAME(name, format, ##args)
 
     #define VPRINT_WITH_NAME(name, format, args...) \
         vprint("%s: "format, name.c_str(), ##args)
@@ -178,13 +275,51 @@ extern int debug_level;
     #define DP(debug, format, args...) \
     do { \
         if ((debug) <= debug_level) \
-            cprint(format, ##args); \
+            DEBUG_PRINT(format, ##args); \
     } while (0)
 
     #define DEBUG_DECLARE(x)                        x
 
 #endif  // DEBUG_ON
 
+/*!
+    The same again, but for a module with its own runtime level
+    (log_level.h).  With RUNTIME_LOG_LEVELS these stay in the build
+    whether or not DEBUG_ON is set, and a statement that's turned off
+    costs one compare against the module's level.  Without it they're
+    the plain versions above.
+
+    Every module's *_CPRINT, *_VPRINT and *_DP go through these.
+*/
+#if RUNTIME_LOG_LEVELS
+    #define CPRINT_WITH_MODULE(module, name, format, args...) \
+    do { \
+        if ((module).enabled(DEBUG_0)) \
+            DEBUG_PRINT_WITH_NAME(name, format, ##args); \
+    } while (0)
+
+    #define VPRINT_WITH_MODULE(module, name, format, args...) \
+    do { \
+        if ((module).enabled(DEBUG_0)) \
+            vprint("%s: "format, name.c_str(), ##args); \
+    } while (0)
+
+    #define DP_WITH_MODULE(module, debug, name, format, args...) \
+    do { \
+        if ((module).enabled(debug)) \
+            DEBUG_PRINT_WITH_NAME(name, format, ##args); \
+    } while (0)
+#else
+    #define CPRINT_WITH_MODULE(module, name, format, args...) \
+        CPRINT_WITH_NAME(name, format, ##args)
+
+    #define VPRINT_WITH_MODULE(module, name, format, args...) \
+        VPRINT_WITH_NAME(name, format, ##args)
+
+    #define DP_WITH_MODULE(module, debug, name, format, args...) \
+        DP(debug, "%s: "format, name.c_str(), ##args)
+#endif  // RUNTIME_LOG_LEVELS
+
 /*
     These seem important enough to keep at all times.
 */
@@ -204,5 +339,11 @@ extern int debug_level;
 #define REPORT_WITH_NAME(name, format, args...) \
     report_error("%s: "format, name.c_str(), ##args)
 
+#define WARNING_LIMITED_WITH_NAME(name, format, args...) \
+    warning_limited("%s: "format, name.c_str(), ##args)
+
+#define REPORT_LIMITED_WITH_NAME(name, format, args...) \
+    report_error_limited("%s: "format, name.c_str(), ##args)
+
 #endif  // PROGRAM_IO_H
 
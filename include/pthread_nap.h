@@ -4,6 +4,8 @@
 #include <pthread.h>
 #include <string>
 
+#include "utility.h"                // mutex_protocol_t
+
 namespace pthread_nap_constants
 {
     const std::string DEFAULT_NAME("pthread nap default name");
@@ -23,10 +25,13 @@ private:
 
 public:
 
-    pthread_nap(const std::string &name = PNC::DEFAULT_NAME);
+    pthread_nap(const std::string &name = PNC::DEFAULT_NAME,
+                utility::mutex_protocol_t protocol = utility::MUTEX_DEFAULT,
+                int ceiling = 0);
     ~pthread_nap(void);
     
     void block(void);
+    bool timed_block(double seconds);
     void wake_up(void);
 };
 
@@ -0,0 +1,88 @@
+#ifndef RANDOM_DIAGNOSTICS_H
+#define RANDOM_DIAGNOSTICS_H
+
+/**
+    Quick sanity checks and speed measurements for random_utilities, so
+    that making a generator faster can't quietly make it wrong.
+
+    check_quality() runs, for one generator:
+
+        chi-square:   values bucketed by their top 8 bits (or directly, for
+                      small ranges) against a flat distribution, for the
+                      raw draws, every get_random<T>, the bounded draws and
+                      the bulk fills.
+        coverage:     every get_random<T> stays inside its documented range
+                      and gets near both ends of it.  The 8 and 16 bit ones
+                      have to hit both ends exactly.
+        correlation:  lag-1 serial correlation of erand() (Knuth's
+                      serial correlation coefficient).
+
+    The limits are loose (about p = 0.001) so a good generator passes
+    essentially every time; this catches broken code, it isn't TestU01.
+
+    measure_throughput() times every draw and every bulk fill in values
+    per second, with 'threads' threads going at once, each on its own
+    split() engine.  1 thread gives the single-threaded numbers; more than
+    that shows whether anything is being shared that shouldn't be.
+
+    Both are ordinary library calls: run them from whatever program or
+    startup check wants them, and print the reports with operator <<.
+    tools/random_check runs both over every generator ('make check'), and
+    fails if any check does.
+*/
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "random_utilities.h"
+
+namespace random_diagnostics_constants
+{
+    enum
+    {
+        DEFAULT_SAMPLES = 1 << 20,      // per check
+        DEFAULT_DRAWS = 1 << 22         // per subject, per thread
+    };
+}
+
+namespace RDC = random_diagnostics_constants;
+
+namespace random_utilities
+{
+    struct quality_report_t
+    {
+        std::string subject;    //* what was drawn, e.g. "get_random<short>"
+        std::string check;      //* "chi-square", "coverage", "correlation"
+        double statistic;
+        double limit;
+        bool passed;
+    };
+
+    struct throughput_report_t
+    {
+        std::string subject;
+        unsigned int threads;
+        double values_per_second;   //* all threads together
+    };
+
+    std::vector<quality_report_t>
+    check_quality(generator_t g,
+                  unsigned long samples = RDC::DEFAULT_SAMPLES,
+                  uint64_t seed = 1);
+
+    std::vector<throughput_report_t>
+    measure_throughput(generator_t g,
+                       unsigned int threads = 1,
+                       unsigned long draws = RDC::DEFAULT_DRAWS);
+
+    bool all_passed(const std::vector<quality_report_t> &reports);
+
+    const char *generator_name(generator_t g);
+
+    std::ostream &operator <<(std::ostream &o, const quality_report_t &r);
+    std::ostream &operator <<(std::ostream &o, const throughput_report_t &r);
+
+}   // end 'random_utilities' namespace
+
+#endif  // RANDOM_DIAGNOSTICS_H
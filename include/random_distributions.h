@@ -0,0 +1,135 @@
+#ifndef RANDOM_DISTRIBUTIONS_H
+#define RANDOM_DISTRIBUTIONS_H
+
+/**
+    Non-uniform distributions on top of random_engine, for synthesizing
+    workloads: inter-arrival times, service times, popularity and so on.
+
+    Everything is table-driven so the common case is a lookup, a multiply
+    and a compare, with no log() or exp():
+
+        normal, exponential:   Marsaglia and Tsang's ziggurat.  ~99% of
+                               samples take the fast path.
+        lognormal:             exp() of a ziggurat normal.
+        discrete weights:      Walker/Vose alias table.  O(1) per sample
+                               however many outcomes there are.
+        Zipf:                  an alias table over the ranks.
+        Poisson:               table inversion for small means, Hoermann's
+                               PTRS transformed rejection for big ones.
+
+    Each has a one-at-a-time form and a fill form for whole buffers.  All
+    of them draw from whatever random_engine you hand them, so they're
+    reproducible from the engine's seed, and the versions without an
+    engine use the calling thread's default_engine().
+
+    The ziggurat tables are shared and built on first use.  The samplers
+    are read-only after construction, so one can be shared by any number
+    of threads as long as each brings its own engine.
+*/
+
+#include <vector>
+
+#include <stddef.h>             // size_t
+#include <stdint.h>
+
+#include "random_utilities.h"
+
+namespace random_utilities
+{
+    double random_normal(random_engine &e);                 // N(0, 1)
+    double random_normal(random_engine &e, double mean, double stddev);
+    double random_exponential(random_engine &e);            // mean 1
+    double random_exponential(random_engine &e, double rate);
+    double random_lognormal(random_engine &e, double mu, double sigma);
+
+    double random_normal(double mean = 0.0, double stddev = 1.0);
+    double random_exponential(double rate = 1.0);
+    double random_lognormal(double mu, double sigma);
+
+    void fill_normal(random_engine &e, double *out, size_t n,
+                     double mean = 0.0, double stddev = 1.0);
+    void fill_exponential(random_engine &e, double *out, size_t n,
+                          double rate = 1.0);
+    void fill_lognormal(random_engine &e, double *out, size_t n,
+                        double mu, double sigma);
+
+    /**
+        Picks index i with probability weights[i] / sum(weights).  The
+        weights don't need to be normalized, but can't be negative, and
+        can't all be 0.
+    */
+    class alias_table
+    {
+
+    private:
+
+        std::vector<uint32_t> threshold_;   //* keep i if coin < this
+        std::vector<uint32_t> alias_;       //* otherwise take this
+
+    public:
+
+        explicit alias_table(const std::vector<double> &weights);
+
+        uint32_t size(void) const { return threshold_.size(); }
+
+        uint32_t sample(random_engine &e) const
+        {
+            uint32_t i = e.bounded32(size());
+            return (e.next32() < threshold_[i]) ? i : alias_[i];
+        }
+
+        void fill(random_engine &e, uint32_t *out, size_t n) const;
+    };
+
+    /**
+        Ranks 1 to n, where rank k comes up in proportion to 1 / k^s.
+    */
+    class zipf_sampler
+    {
+
+    private:
+
+        alias_table table_;
+
+        static std::vector<double> weights(uint32_t n, double s);
+
+    public:
+
+        zipf_sampler(uint32_t n, double s);
+
+        uint32_t sample(random_engine &e) const { return table_.sample(e) + 1; }
+        void fill(random_engine &e, uint32_t *out, size_t n) const;
+    };
+
+    /**
+        Counts of a Poisson process with the given mean.
+    */
+    class poisson_sampler
+    {
+
+    private:
+
+        double mean_;
+        std::vector<double> cdf_;   //* inversion table, small means only
+
+        // PTRS constants, big means only
+        double sqrt_mean_;
+        double log_mean_;
+        double a_;
+        double b_;
+        double inv_alpha_;
+        double v_r_;
+
+    public:
+
+        explicit poisson_sampler(double mean);
+
+        double mean(void) const { return mean_; }
+
+        unsigned int sample(random_engine &e) const;
+        void fill(random_engine &e, unsigned int *out, size_t n) const;
+    };
+
+}   // end 'random_utilities' namespace
+
+#endif  // RANDOM_DISTRIBUTIONS_H
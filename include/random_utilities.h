@@ -14,13 +14,36 @@
     and scale yourself.  You can seed the generators with whatever state
     you'd like, so you should presumably be able to replay if the order of
     calls and whatall are well ordered.
+
+    All the state lives in a random_engine.  Every thread gets its own
+    default engine the first time it asks for a number, and the functions
+    that don't take an engine use that one.  So threads don't share (and
+    fight over) one set of state, and each thread's sequence only depends
+    on what that thread does.  A new thread's default engine starts from
+    whatever was last handed to the seed_*() functions, moved on to a
+    stream of its own by thread_jump() once for every default engine made
+    before it since that seeding.  The thread that called seed_all() gets
+    stream 0, which is exactly the seed, and threads that ask for numbers
+    after that get streams 1, 2, ... in the order they first ask.  So
+    given the seed_all() and that order the numbers are repeatable, and no
+    two threads ever see the same sequence.  If you need something else,
+    make your own random_engine and use the versions that take one.
+
+    For parallel runs, don't make up a seed per thread: have each worker
+    split() its engine off one master seed, which guarantees the workers'
+    sequences never overlap, and save_state() it if the run needs to be
+    replayed exactly.
 */
 
 #include <iosfwd>
 #include <string>
 
 #include <stdlib.h>         // erand(), etc.
+#include <string.h>         // memset(), memcpy()
 #include <stdint.h>
+#include <stddef.h>         // size_t
+
+#include "types.h"          // byte_vector_t
 
 ////////////////////////////////////////////////////////////////////////////////
 // Stuff and Junk
@@ -32,9 +55,15 @@ namespace random_utilities
     // functions.
     enum
     {
-        RANDOM_STATE_ARRAY_SIZE = 3 // 3 x uint16_t = 48 bits (required amount)
+        RANDOM_STATE_ARRAY_SIZE = 3,// 3 x uint16_t = 48 bits (required amount)
+        RANDOM_LANES = 4            // interleaved streams for bulk fills
     };
 
+    // thread_jump() distances.  rand48 runs out first: its period of 2^48
+    // holds 4096 threads' worth of 2^36 calls each.
+    const uint64_t RAND48_THREAD_STRIDE = 1ULL << 36;
+    const uint64_t PHILOX_THREAD_STRIDE = 1ULL << 48;
+
     // Keep state in this
     struct seed_t
     {
@@ -67,27 +96,295 @@ namespace random_utilities
 
     std::ostream &operator <<(std::ostream &o, const seed_t &t);
 
+    /**
+        Which generator an engine runs.
+
+        RAND48 is the original: the SUSv3 48-bit LCGs via libc, three
+        separate streams, 31 or 32 bits per call.
+
+        XOSHIRO256 is Vigna and Blackman's xoshiro256**: 256 bits of state,
+        64 good bits per step, a handful of shifts and adds, no libc call.
+        Several times faster per value, and every type comes from the one
+        stream, seeded by seed_all() (the per-routine seed_*rand48() only
+        touch the RAND48 streams).
+
+        PHILOX is Salmon et al.'s Philox4x32-10, which is counter-based:
+        value n of the stream is a pure function of (key, n), so you can
+        seek() straight to any position without generating what's in
+        between.  Hand each loop iteration its own position and a parallel
+        loop gives the same numbers however its iterations get spread over
+        the cores.  A bit slower per value than xoshiro.
+    */
+    enum generator_t
+    {
+        GENERATOR_RAND48,
+        GENERATOR_XOSHIRO256,
+        GENERATOR_PHILOX
+    };
+
+    // Philox4x32-10 without an engine: 64-bit word 'n' of the stream for
+    // 'key', the 4 x 32 bits of one block (words 2 * block and
+    // 2 * block + 1), and words first .. first + n - 1 in one go.
+    uint64_t philox_at(uint64_t key, uint64_t n);
+    void philox_block(uint64_t key, uint64_t block, uint32_t out[4]);
+    void philox_fill(uint64_t key, uint64_t first, uint64_t *out, size_t n);
+
+    /**
+        One independent set of generator state.  Not thread-safe: one
+        engine per thread, or lock it yourself.  Copying an engine forks
+        the sequence.
+    */
+    class random_engine
+    {
+
+    private:
+
+        generator_t generator_;
+
+        seed_t erand_state_;
+        seed_t nrand_state_;
+        seed_t jrand_state_;
+
+        uint64_t xoshiro_[4];
+
+        // The bulk fills run RANDOM_LANES separate xoshiro256** streams
+        // side by side, stored word-major (lanes_[word][lane]) so one
+        // state word of every lane sits in one SIMD register.
+        uint64_t lanes_[4][RANDOM_LANES];
+
+        uint64_t philox_key_;
+        uint64_t philox_counter_;   //* next word of the Philox stream
+        uint64_t philox_spare_;     //* word 'counter' when it's odd
+
+    private:
+
+        static uint64_t rotl(uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        uint64_t xoshiro_next(void)
+        {
+            uint64_t *s = xoshiro_;
+            const uint64_t result = rotl(s[1] * 5, 7) * 9;
+            const uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+        uint64_t philox_next(void)
+        {
+            uint64_t n = philox_counter_++;
+            if (n & 1)
+                return philox_spare_;
+
+            uint32_t block[4];
+            philox_block(philox_key_, n >> 1, block);
+            philox_spare_ = block[2] | (static_cast<uint64_t>(block[3]) << 32);
+            return block[0] | (static_cast<uint64_t>(block[1]) << 32);
+        }
+
+        // 64 bits from whichever of xoshiro or Philox is running.
+        uint64_t word64(void)
+        {
+            if (generator_ == GENERATOR_XOSHIRO256)
+                return xoshiro_next();
+            return philox_next();
+        }
+
+        void stretch_seed(const seed_t &p);
+        void generate_lanes(uint64_t *out, size_t n);
+        void generate(uint64_t *out, size_t n);
+        void jump_lanes(const uint64_t *polynomial);
+
+    public:
+
+        explicit random_engine(generator_t g = GENERATOR_RAND48);
+        explicit random_engine(const seed_t &p,
+                               generator_t g = GENERATOR_RAND48);
+
+        generator_t generator(void) const { return generator_; }
+
+        void seed_erand48(const seed_t &p) { erand_state_ = p; }
+        void seed_nrand48(const seed_t &p) { nrand_state_ = p; }
+        void seed_jrand48(const seed_t &p) { jrand_state_ = p; }
+        void seed_all(const seed_t &p);
+
+        // Philox position, counted in 64-bit words.
+        void seed_philox(uint64_t key, uint64_t counter = 0);
+        void seek(uint64_t counter);
+        uint64_t tell(void) const { return philox_counter_; }
+
+        // Streams.  jump() moves the xoshiro stream (not the lanes) ahead
+        // 2^128 steps, long_jump() 2^192.  advance_rand48() moves all
+        // three rand48 streams ahead 'steps' calls.
+        void jump(void);
+        void long_jump(void);
+        void advance_rand48(uint64_t steps);
+
+        // On to the next of the streams default engines are handed out
+        // from, one per thread: jump() for xoshiro and the bulk lanes
+        // alike, RAND48_THREAD_STRIDE calls for rand48, and
+        // PHILOX_THREAD_STRIDE words for Philox.
+        void thread_jump(void);
+
+        // Make this engine substream 'index' of 'count' cut from 'master'.
+        // The same (master, index, count) always gives the same engine,
+        // and no two indexes ever overlap.
+        void split(uint64_t master, unsigned int index, unsigned int count);
+
+        // Everything, generator included, so a run can be picked up again
+        // exactly where it was.  restore_state() throws on junk.
+        void save_state(byte_vector_t &bytes) const;
+        void restore_state(const byte_vector_t &bytes);
+
+        // The raw draws, named for the SUSv3 routine behind them (which is
+        // what actually runs with GENERATOR_RAND48).
+
+        double erand(void)                                  // [0.0, 1.0)
+        {
+            if (generator_ != GENERATOR_RAND48)
+                return (word64() >> 11) * (1.0 / 9007199254740992.0);
+            return erand48(erand_state_.s);
+        }
+
+        long nrand(void)                                    // [0, 2^31)
+        {
+            if (generator_ != GENERATOR_RAND48)
+                return static_cast<long>(word64() >> 33);
+            return nrand48(nrand_state_.s);
+        }
+
+        long jrand(void)                                    // [-2^31, 2^31)
+        {
+            if (generator_ != GENERATOR_RAND48)
+                return static_cast<int32_t>(word64() >> 32);
+            return jrand48(jrand_state_.s);
+        }
+
+        // All 64 bits.  RAND48 glues two jrand48() calls together.
+        uint64_t next64(void)
+        {
+            if (generator_ != GENERATOR_RAND48)
+                return word64();
+            uint64_t high = static_cast<uint32_t>(jrand48(jrand_state_.s));
+            return (high << 32)
+                   | static_cast<uint32_t>(jrand48(jrand_state_.s));
+        }
+
+        // 32 random bits, whatever the generator.
+        uint32_t next32(void) { return static_cast<uint32_t>(jrand()); }
+
+        // Unbiased values in [0, bound) by multiply-shift with rejection
+        // (Lemire): no '%' except on the rare rejection path, and no
+        // floating point.  A bound of 0 means the whole range.
+        uint32_t bounded32(uint32_t bound);
+        uint64_t bounded64(uint64_t bound);
+
+        // Unbiased values in [lo, hi], both ends included.
+        int uniform(int lo, int hi);
+        unsigned int uniform(unsigned int lo, unsigned int hi);
+        long uniform(long lo, long hi);
+        unsigned long uniform(unsigned long lo, unsigned long hi);
+        long long uniform(long long lo, long long hi);
+        unsigned long long uniform(unsigned long long lo,
+                                   unsigned long long hi);
+
+        // Bulk fills.  These come off the interleaved lanes (which
+        // seed_all() seeds) for RAND48 and XOSHIRO256, so they don't
+        // advance the one-at-a-time streams and vice versa.  With PHILOX
+        // they come off the counter like everything else, a whole number
+        // of RANDOM_LANES words at a time.
+        void fill(double *out, size_t n);                   // [0.0, 1.0)
+        void fill(uint32_t *out, size_t n);                 // all 32 bits
+        void fill(uint32_t *out, size_t n, uint32_t bound); // [0, bound)
+        void fill(byte_vector_t &bytes);                    // whole vector
+    };
+
+    random_engine &default_engine(void);
+    void set_default_generator(generator_t g);
+
     void seed_erand48(const seed_t &p);
     void seed_nrand48(const seed_t &p);
     void seed_jrand48(const seed_t &p);
     void seed_all(const seed_t &p);
 
+    bool random_gt(random_engine &e, const double odds);
+    bool random_gte(random_engine &e, const double odds);
+    bool random_lt(random_engine &e, const double odds);
+    bool random_lte(random_engine &e, const double odds);
+
     bool random_gt(const double odds);
     bool random_gte(const double odds);
     bool random_lt(const double odds);
     bool random_lte(const double odds);
 
+    double get_random(random_engine &e);
     double get_random(void);
 
-    template <typename T> T get_random(void);
+    template <typename T> T get_random(random_engine &e);
+
+    // How many random bits get_random<T>() hands back, for the integer
+    // specializations.  int64_t and uint64_t are long or long long,
+    // whichever stdint.h picked, and come out at 64 either way:
+    // random_utilities.cpp won't compile if they don't.
+    template <typename T> struct random_bits { enum { value = 0 }; };
+    template<> struct random_bits<signed char> { enum { value = 8 }; };
+    template<> struct random_bits<unsigned char> { enum { value = 8 }; };
+    template<> struct random_bits<short> { enum { value = 16 }; };
+    template<> struct random_bits<unsigned short> { enum { value = 16 }; };
+    template<> struct random_bits<int> { enum { value = 32 }; };
+    template<> struct random_bits<unsigned int> { enum { value = 32 }; };
+    template<> struct random_bits<long>
+    { enum { value = (sizeof(long) == 8) ? 64 : 32 }; };
+    template<> struct random_bits<unsigned long>
+    { enum { value = (sizeof(unsigned long) == 8) ? 64 : 32 }; };
+    template<> struct random_bits<long long> { enum { value = 64 }; };
+    template<> struct random_bits<unsigned long long> { enum { value = 64 }; };
+
     // specializations of above
-    template<> int get_random(void);
-    template<> long get_random(void);
-    template<> unsigned long get_random(void);
-    template<> unsigned int get_random(void);
+    template<> signed char get_random(random_engine &e);
+    template<> unsigned char get_random(random_engine &e);
+    template<> short get_random(random_engine &e);
+    template<> unsigned short get_random(random_engine &e);
+    template<> int get_random(random_engine &e);
+    template<> long get_random(random_engine &e);
+    template<> unsigned long get_random(random_engine &e);
+    template<> unsigned int get_random(random_engine &e);
+    template<> long long get_random(random_engine &e);
+    template<> unsigned long long get_random(random_engine &e);
+
+    // Same thing off the calling thread's default engine.
+    template <typename T> T get_random(void)
+    {
+        return get_random<T>(default_engine());
+    }
+
     // overload
+    unsigned int get_random(random_engine &e, unsigned int max);
     unsigned int get_random(unsigned int max);
 
+    // Range-inclusive, unbiased, off the calling thread's default engine.
+    int uniform(int lo, int hi);
+    unsigned int uniform(unsigned int lo, unsigned int hi);
+    long uniform(long lo, long hi);
+    unsigned long uniform(unsigned long lo, unsigned long hi);
+    long long uniform(long long lo, long long hi);
+    unsigned long long uniform(unsigned long long lo, unsigned long long hi);
+
+    // Bulk fills off the calling thread's default engine.
+    void fill(double *out, size_t n);
+    void fill(uint32_t *out, size_t n);
+    void fill(uint32_t *out, size_t n, uint32_t bound);
+    void fill(byte_vector_t &bytes);
+
 }   // end 'random_utilities' namespace
 
 #endif  // RANDOM_UTILITIES_H
@@ -0,0 +1,428 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+/**
+    Bounded lock-free ring queues for handing stuff between pinned threads.
+
+    spsc_ring: one producer thread, one consumer thread.  No atomic
+    read-modify-write at all on the fast path: each side owns one index
+    and only reads the other's now and then (the cached copies).
+
+    mpsc_ring: any number of producers, one consumer.  Producers claim
+    slots with a compare-and-swap on the tail; each slot carries a sequence
+    number so the consumer can tell when a claimed slot has actually been
+    filled in (Dmitry Vyukov's bounded queue, cut down to one consumer).
+
+    Both round the capacity up to a power of two, keep the producer and
+    consumer indices on separate cache lines, and support batch push/pop
+    so a burst costs one index update instead of one per item.
+
+    Neither blocks the producer: push() on a full ring returns false and
+    it's up to the caller whether to spin, drop or complain.  The consumer
+    can block, though: pop_wait() spins for 'spin_budget' tries, and only
+    then parks on a futex (the pthread_nap idea without the mutex).
+    Producers only make a syscall when the consumer is actually parked.
+
+    T must be default constructible and assignable: the slots are a plain
+    array of T.
+
+    Ordering relies on x86's store->store and load->load ordering, so the
+    only fences are compiler barriers, plus one real fence per push to
+    check for a parked consumer.
+*/
+
+#include <cstddef>
+
+#include "utility.h"            // futex_*, cpu_relax(), compiler_barrier()
+
+namespace ring_queue_constants
+{
+    enum
+    {
+        CACHE_LINE = 64,
+        DEFAULT_SPIN_BUDGET = 4000
+    };
+}
+
+namespace RQC = ring_queue_constants;
+
+////////////////////////////////////////////////////////////////////////////////
+// Consumer parking
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Where the consumer sleeps when its ring runs dry.  The handshake is:
+
+        consumer                        producer
+        --------                        --------
+        s = prepare()  (sleeping = 1)   publish item
+        re-check ring                   notify(): fence, read sleeping
+        park(s)
+
+    Both sides fence between their write and their read, so either the
+    consumer's re-check sees the item or the producer sees 'sleeping' and
+    bumps the sequence.  park() returns at once if the sequence has
+    already moved.
+*/
+
+class ring_waiter
+{
+
+private:
+
+    volatile int sequence_;
+    volatile int sleeping_;
+
+public:
+
+    ring_waiter(void): sequence_(0), sleeping_(0) {}
+
+    int prepare(void)
+    {
+        int s = sequence_;
+        sleeping_ = 1;
+        __sync_synchronize();
+        return s;
+    }
+
+    void park(int s) { utility::futex_wait(&sequence_, s); }
+    void cancel(void) { sleeping_ = 0; }
+
+    void notify(void)
+    {
+        __sync_synchronize();
+        if (sleeping_)
+        {
+            sleeping_ = 0;
+            __sync_fetch_and_add(&sequence_, 1);
+            utility::futex_wake(&sequence_, 1);
+        }
+    }
+};
+
+namespace ring_queue_internal
+{
+    // Smallest power of two >= n (and at least 2).
+    inline unsigned long
+    round_up_pow2(unsigned long n)
+    {
+        unsigned long size = 2;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Single producer, single consumer
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+class spsc_ring
+{
+
+private:
+
+    char pad0_[RQC::CACHE_LINE];
+
+    // consumer's line
+    volatile unsigned long head_;
+    unsigned long cached_tail_;
+    char pad1_[RQC::CACHE_LINE - 2 * sizeof(unsigned long)];
+
+    // producer's line
+    volatile unsigned long tail_;
+    unsigned long cached_head_;
+    char pad2_[RQC::CACHE_LINE - 2 * sizeof(unsigned long)];
+
+    ring_waiter waiter_;
+    char pad3_[RQC::CACHE_LINE - sizeof(ring_waiter)];
+
+    // read-only after construction
+    unsigned long mask_;
+    unsigned int spin_budget_;
+    T *slots_;
+
+private:    // not possible
+
+    spsc_ring(const spsc_ring &r);
+    spsc_ring &operator =(const spsc_ring &r);
+
+public:
+
+    explicit spsc_ring(unsigned long capacity,
+                       unsigned int spin_budget = RQC::DEFAULT_SPIN_BUDGET):
+        head_(0),
+        cached_tail_(0),
+        tail_(0),
+        cached_head_(0),
+        waiter_(),
+        mask_(ring_queue_internal::round_up_pow2(capacity) - 1),
+        spin_budget_(spin_budget),
+        slots_(new T[mask_ + 1])
+    {
+    }
+
+    ~spsc_ring(void) { delete [] slots_; }
+
+    unsigned long capacity(void) const { return mask_ + 1; }
+    unsigned long size(void) const { return tail_ - head_; }
+    bool empty(void) const { return tail_ == head_; }
+
+    /**
+        Push as many of the 'n' items as fit.  Returns how many went in.
+    */
+
+    unsigned long
+    push_batch(const T *items, unsigned long n)
+    {
+        unsigned long tail = tail_;
+        unsigned long room = capacity() - (tail - cached_head_);
+        if (room < n)
+        {
+            cached_head_ = head_;
+            room = capacity() - (tail - cached_head_);
+        }
+        if (n > room)
+            n = room;
+        if (!n)
+            return 0;
+
+        for (unsigned long i = 0; i < n; ++i)
+            slots_[(tail + i) & mask_] = items[i];
+
+        utility::compiler_barrier();    // fill slots before publishing
+        tail_ = tail + n;
+        waiter_.notify();
+        return n;
+    }
+
+    bool push(const T &item) { return push_batch(&item, 1) == 1; }
+
+    /**
+        Pop up to 'max' items into 'out'.  Returns how many we got.
+    */
+
+    unsigned long
+    pop_batch(T *out, unsigned long max)
+    {
+        unsigned long head = head_;
+        unsigned long available = cached_tail_ - head;
+        if (available < max)
+        {
+            cached_tail_ = tail_;
+            utility::compiler_barrier();    // read tail before the slots
+            available = cached_tail_ - head;
+        }
+        if (max > available)
+            max = available;
+        if (!max)
+            return 0;
+
+        for (unsigned long i = 0; i < max; ++i)
+            out[i] = slots_[(head + i) & mask_];
+
+        utility::compiler_barrier();    // done with slots before freeing
+        head_ = head + max;
+        return max;
+    }
+
+    bool pop(T *out) { return pop_batch(out, 1) == 1; }
+
+    /**
+        Pop at least one item (up to 'max'), spinning and then sleeping
+        until something shows up.
+    */
+
+    unsigned long
+    pop_batch_wait(T *out, unsigned long max)
+    {
+        unsigned long got;
+        for (unsigned int i = 0; i < spin_budget_; ++i)
+        {
+            if ((got = pop_batch(out, max)))
+                return got;
+            utility::cpu_relax();
+        }
+
+        for ( ; ; )
+        {
+            int s = waiter_.prepare();
+            if ((got = pop_batch(out, max)))
+            {
+                waiter_.cancel();
+                return got;
+            }
+            waiter_.park(s);
+            waiter_.cancel();
+        }
+    }
+
+    void pop_wait(T *out) { pop_batch_wait(out, 1); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Multiple producers, single consumer
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+class mpsc_ring
+{
+
+private:
+
+    // A slot is free for position p when seq == p, and full when
+    // seq == p + 1.  The consumer frees it for the next lap by setting
+    // seq = p + capacity.
+    struct cell_t
+    {
+        volatile unsigned long seq;
+        T value;
+    };
+
+    char pad0_[RQC::CACHE_LINE];
+
+    // consumer's line
+    unsigned long head_;
+    char pad1_[RQC::CACHE_LINE - sizeof(unsigned long)];
+
+    // fought over by the producers
+    volatile unsigned long tail_;
+    char pad2_[RQC::CACHE_LINE - sizeof(unsigned long)];
+
+    ring_waiter waiter_;
+    char pad3_[RQC::CACHE_LINE - sizeof(ring_waiter)];
+
+    // read-only after construction
+    unsigned long mask_;
+    unsigned int spin_budget_;
+    cell_t *cells_;
+
+private:    // not possible
+
+    mpsc_ring(const mpsc_ring &r);
+    mpsc_ring &operator =(const mpsc_ring &r);
+
+public:
+
+    explicit mpsc_ring(unsigned long capacity,
+                       unsigned int spin_budget = RQC::DEFAULT_SPIN_BUDGET):
+        head_(0),
+        tail_(0),
+        waiter_(),
+        mask_(ring_queue_internal::round_up_pow2(capacity) - 1),
+        spin_budget_(spin_budget),
+        cells_(new cell_t[mask_ + 1])
+    {
+        for (unsigned long i = 0; i <= mask_; ++i)
+            cells_[i].seq = i;
+    }
+
+    ~mpsc_ring(void) { delete [] cells_; }
+
+    unsigned long capacity(void) const { return mask_ + 1; }
+
+    /**
+        Claim as many consecutive free slots as we can (up to 'n') with a
+        single compare-and-swap on the tail, fill them, then mark each one
+        full.  Returns how many items went in.
+    */
+
+    unsigned long
+    push_batch(const T *items, unsigned long n)
+    {
+        unsigned long pos;
+        unsigned long claimed;
+
+        for ( ; ; )
+        {
+            pos = tail_;
+            utility::compiler_barrier();    // read tail before the cells
+
+            claimed = 0;
+            while ((claimed < n) && (cells_[(pos + claimed) & mask_].seq
+                                     == pos + claimed))
+                ++claimed;
+
+            if (!claimed)
+            {
+                long diff = static_cast<long>(cells_[pos & mask_].seq - pos);
+                if (diff < 0)
+                    return 0;               // full
+                continue;                   // somebody beat us to it
+            }
+
+            if (__sync_bool_compare_and_swap(&tail_, pos, pos + claimed))
+                break;
+        }
+
+        for (unsigned long i = 0; i < claimed; ++i)
+        {
+            cell_t &cell = cells_[(pos + i) & mask_];
+            cell.value = items[i];
+            utility::compiler_barrier();    // value before sequence
+            cell.seq = pos + i + 1;
+        }
+
+        waiter_.notify();
+        return claimed;
+    }
+
+    bool push(const T &item) { return push_batch(&item, 1) == 1; }
+
+    /**
+        Items come out in the order their slots were claimed.  A producer
+        that has claimed a slot but not filled it yet holds up everything
+        behind it, so we may return fewer than are really queued.
+    */
+
+    unsigned long
+    pop_batch(T *out, unsigned long max)
+    {
+        unsigned long got = 0;
+        for ( ; got < max; ++got)
+        {
+            cell_t &cell = cells_[head_ & mask_];
+            if (cell.seq != head_ + 1)
+                break;
+            utility::compiler_barrier();    // sequence before value
+            out[got] = cell.value;
+            utility::compiler_barrier();    // value before freeing
+            cell.seq = head_ + mask_ + 1;
+            ++head_;
+        }
+        return got;
+    }
+
+    bool pop(T *out) { return pop_batch(out, 1) == 1; }
+
+    bool empty(void) const { return cells_[head_ & mask_].seq != head_ + 1; }
+
+    unsigned long
+    pop_batch_wait(T *out, unsigned long max)
+    {
+        unsigned long got;
+        for (unsigned int i = 0; i < spin_budget_; ++i)
+        {
+            if ((got = pop_batch(out, max)))
+                return got;
+            utility::cpu_relax();
+        }
+
+        for ( ; ; )
+        {
+            int s = waiter_.prepare();
+            if ((got = pop_batch(out, max)))
+            {
+                waiter_.cancel();
+                return got;
+            }
+            waiter_.park(s);
+            waiter_.cancel();
+        }
+    }
+
+    void pop_wait(T *out) { pop_batch_wait(out, 1); }
+};
+
+#endif  // RING_QUEUE_H
@@ -0,0 +1,122 @@
+#ifndef RT_MEMORY_H
+#define RT_MEMORY_H
+
+/**
+    Getting page faults out of the way before an RT thread starts its
+    loop, rather than during its first few iterations.
+
+    prepare_realtime_memory(), once, early in main():
+
+        mlockall(MCL_CURRENT | MCL_FUTURE)
+                    everything mapped now or later stays in RAM, and new
+                    mappings are faulted in when they're made.
+        mallopt()   malloc never gives memory back (M_TRIM_THRESHOLD) and
+                    never uses mmap() for big blocks (M_MMAP_MAX), so
+                    memory freed by one iteration is still locked and
+                    faulted in for the next.
+        heap        'heap_bytes' are malloc()ed, touched and freed, so the
+                    main arena starts out that big.  Threads that get
+                    arenas of their own don't benefit: pretouch in each
+                    thread, or set M_ARENA_MAX, if that matters.
+        stack       prefault_stack() for the calling thread.
+
+    prefault_stack() at the top of every RT thread: touches 'bytes' of
+    stack below the caller so the pages are there already.  Clamped to
+    what the thread's stack actually has.
+
+    rt_buffer is for big buffers (DMA rings, frame pools): an anonymous
+    mapping, touched all the way through, optionally backed by huge pages:
+
+        HUGE_PAGES_TRANSPARENT  2M aligned and madvise(MADV_HUGEPAGE):
+                                works anywhere THP is enabled, and falls
+                                back to small pages quietly.
+        HUGE_PAGES_EXPLICIT     MAP_HUGETLB from the hugetlbfs pool, which
+                                has to have been reserved
+                                (/proc/sys/vm/nr_hugepages): throws if it
+                                can't be had.
+
+    Fault counts come from getrusage(); fault_count() / faults_since()
+    bracket a warm-up to check it really was fault free.
+*/
+
+#include <iosfwd>
+
+#include <stddef.h>                 // size_t
+
+namespace rt_memory_constants
+{
+    enum
+    {
+        DEFAULT_STACK_BYTES = 256 * 1024,
+        DEFAULT_HEAP_BYTES = 16 * 1024 * 1024,
+        STACK_MARGIN = 32 * 1024,           // left untouched for the guard
+        HUGE_PAGE_BYTES = 2 * 1024 * 1024   // x86 THP size
+    };
+}
+
+namespace RMC = rt_memory_constants;
+
+namespace rt_memory
+{
+    struct fault_count_t
+    {
+        long minor;                 //* satisfied without I/O
+        long major;                 //* had to go to disk
+    };
+
+    struct memory_report_t
+    {
+        bool locked;                //* mlockall() worked
+        size_t stack_bytes;         //* actually prefaulted
+        size_t heap_bytes;
+        fault_count_t faults;       //* taken while preparing
+    };
+
+    memory_report_t
+    prepare_realtime_memory(size_t stack_bytes = RMC::DEFAULT_STACK_BYTES,
+                            size_t heap_bytes = RMC::DEFAULT_HEAP_BYTES);
+
+    // Returns how much was touched.
+    size_t prefault_stack(size_t bytes = RMC::DEFAULT_STACK_BYTES);
+
+    // For the whole process, or just the calling thread.
+    fault_count_t fault_count(bool this_thread_only = false);
+    fault_count_t faults_since(const fault_count_t &start,
+                               bool this_thread_only = false);
+
+    enum huge_pages_t
+    {
+        HUGE_PAGES_NONE,
+        HUGE_PAGES_TRANSPARENT,
+        HUGE_PAGES_EXPLICIT
+    };
+
+    std::ostream &operator <<(std::ostream &o, const fault_count_t &f);
+    std::ostream &operator <<(std::ostream &o, const memory_report_t &r);
+}
+
+/**
+    A prefaulted anonymous mapping, unmapped in the destructor.
+*/
+
+class rt_buffer
+{
+    void *data_;
+    size_t size_;                   // rounded up to the page size used
+    rt_memory::huge_pages_t huge_;
+
+private:    // not possible
+    rt_buffer(const rt_buffer &);
+    rt_buffer &operator=(const rt_buffer &);
+
+public:
+    explicit rt_buffer(size_t bytes, rt_memory::huge_pages_t huge
+                                         = rt_memory::HUGE_PAGES_NONE);
+    ~rt_buffer(void);
+
+    void *data(void) const { return data_; }
+    size_t size(void) const { return size_; }
+    rt_memory::huge_pages_t huge(void) const { return huge_; }
+};
+
+#endif  // RT_MEMORY_H
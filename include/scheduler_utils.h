@@ -14,10 +14,100 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <sched.h>
+#include <pthread.h>
+
+#include "status.h"
+
+namespace scheduler_constants
+{
+    enum
+    {
+        // set_deadline_scheduling() flags
+        DEADLINE_RECLAIM = 0x02,    // may use bandwidth others leave idle
+        DEADLINE_OVERRUN = 0x04,    // SIGXCPU when the runtime's used up
+
+        MIN_DEADLINE_RUNTIME = 1024 // ns: the kernel won't take less
+    };
+}
+
+namespace SCC = scheduler_constants;
+
+/**
+    'pid' can be any thread id: only that one thread changes, whichever it
+    is.  With 'reset_on_fork', children forked by the thread start out as
+    ordinary SCHED_OTHER processes instead of inheriting the RT policy.
+*/
 
 void set_realtime_priority(int priority,
                            pid_t pid = getpid(),
-                           unsigned sched_to_use = SCHED_RR);
+                           unsigned sched_to_use = SCHED_RR,
+                           bool reset_on_fork = false);
+
+// As above, without the output or exceptions (status.h).  Priorities out
+// of range are still clamped, just quietly.
+status_t try_set_realtime_priority(int priority,
+                                   pid_t pid = getpid(),
+                                   unsigned sched_to_use = SCHED_RR,
+                                   bool reset_on_fork = false);
+
+// The same, for a thread we have a handle to.
+void set_thread_realtime_priority(pthread_t thread,
+                                  int priority,
+                                  unsigned sched_to_use = SCHED_RR,
+                                  bool reset_on_fork = false);
+
+status_t try_set_thread_realtime_priority(pthread_t thread,
+                                          int priority,
+                                          unsigned sched_to_use = SCHED_RR,
+                                          bool reset_on_fork = false);
+
+// Every thread of process 'pid', including any started while we're at it
+// (utility::for_each_thread()).  Returns how many threads were changed.
+// 'reset_on_fork' takes a second walk over the threads: see the .cpp.  A
+// thread started after that walk's last look still comes up SCHED_OTHER,
+// so set it before the process starts threads if that matters.
+unsigned int set_process_realtime_priority(int priority,
+                                           pid_t pid = getpid(),
+                                           unsigned sched_to_use = SCHED_RR,
+                                           bool reset_on_fork = false);
+
+/**
+    SCHED_DEADLINE: every 'period' ns the thread gets 'runtime' ns of CPU,
+    to be used within 'deadline' ns of the start of the period.  A
+    'period' of 0 means the same as 'deadline'.  The kernel only accepts a
+    reservation if the total of everyone's runtime / period still fits
+    (admission control), and then guarantees it, which is a much stronger
+    promise than a FIFO priority picked by hand.  All times are in ns;
+    'tid' 0 is the calling thread.
+
+    Needs runtime <= deadline <= period, CAP_SYS_NICE, and an affinity
+    covering the thread's whole root domain (all CPUs, or all the CPUs of
+    an exclusive cpuset).  Failures say which of those it was.
+
+    The try_ version returns STATUS_NO_CAPACITY when admission control says
+    no, STATUS_NOT_ALLOWED for permissions or affinity, STATUS_INVALID for
+    parameters that can't work.
+*/
+
+void set_deadline_scheduling(uint64_t runtime,
+                             uint64_t deadline,
+                             uint64_t period = 0,
+                             pid_t tid = 0,
+                             unsigned int flags = 0);
+
+status_t try_set_deadline_scheduling(uint64_t runtime,
+                                     uint64_t deadline,
+                                     uint64_t period = 0,
+                                     pid_t tid = 0,
+                                     unsigned int flags = 0);
+
+/**
+    For a SCHED_DEADLINE thread that's done with this cycle's work: gives
+    up whatever runtime is left, and sleeps until the next period starts
+    with a fresh budget.  Call it at the bottom of the loop.
+*/
+
+void deadline_yield(void);
 
 void set_RSS_limit(uint64_t megabytes, bool arg_in_bytes = false);
 void set_core_limit(uint64_t megabytes);
@@ -0,0 +1,58 @@
+#ifndef SHARED_NAP_H
+#define SHARED_NAP_H
+
+/**
+    A pthread_nap that works between processes.  pthread_nap keeps its
+    mutex and cond var on the heap, so only threads of one process can use
+    it.  This one is nothing but a single futex word in shared memory,
+    which is about as cheap as it gets and doesn't care which address each
+    process has it mapped at.
+
+    Either let the class create/attach a POSIX shared memory object by name
+    (e.g. "/stage2_ready": one process creates, the others attach), or hand
+    it the address of an int inside a segment you've already mapped.
+
+    Semantics are the same as pthread_nap: block() sleeps until somebody
+    calls wake_up(), and a wake_up() with nobody sleeping is remembered
+    for the next block().  Multiple wake_up()s before a block() collapse
+    into one.
+*/
+
+#include <string>
+
+namespace shared_nap_constants
+{
+    const std::string DEFAULT_NAME("shared nap default name");
+}
+
+namespace SNC = shared_nap_constants;
+
+class shared_nap
+{
+
+private:
+
+    std::string name_;
+    std::string shm_name_;  //* empty if the caller supplied the memory
+    bool owner_;            //* we created the shm object: we unlink it
+
+    volatile int *word_;
+
+private:    // not possible
+
+    shared_nap(const shared_nap &n);
+    shared_nap &operator =(const shared_nap &n);
+
+public:
+
+    shared_nap(const std::string &shm_name, bool create,
+               const std::string &name = SNC::DEFAULT_NAME);
+    shared_nap(volatile int *word, bool initialize,
+               const std::string &name = SNC::DEFAULT_NAME);
+    ~shared_nap(void);
+
+    void block(void);
+    void wake_up(void);
+};
+
+#endif  // SHARED_NAP_H
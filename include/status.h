@@ -0,0 +1,61 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+/**
+    What the try_* entry points return instead of throwing.
+
+    The usual versions of run_on_cpu(), set_realtime_priority() and
+    friends report failure through ERROR / RUNTIME: two 2K strings, a
+    flushed write and an exception.  That's fine at setup time, but an RT
+    thread that tries to move itself around opportunistically shouldn't pay
+    for it on a routine "no".  The try_* versions do the same work and hand
+    back one of these: a code saying what kind of failure it was and the
+    errno that came with it, if any.  No allocation, no output, no throw.
+
+    The throwing versions are built on top of them, so they behave the
+    same way.
+*/
+
+#include <iosfwd>
+
+enum status_code_t
+{
+    STATUS_OK = 0,
+    STATUS_INVALID,             // bad argument: no such CPU, policy, ...
+    STATUS_NOT_ALLOWED,         // valid, but not for us (affinity mask)
+    STATUS_NOT_FOUND,           // no such cpuset, etc.
+    STATUS_NO_CAPACITY,         // refused by admission control
+    STATUS_SYSTEM               // a system call failed: see 'error'
+};
+
+/**
+    Small enough to come back in registers.
+*/
+
+struct status_t
+{
+    status_code_t code;
+    int error;                  //* errno behind it, if there was one
+
+    bool ok(void) const { return code == STATUS_OK; }
+};
+
+inline status_t
+make_status(status_code_t code, int error = 0)
+{
+    status_t s = { code, error };
+    return s;
+}
+
+inline status_t
+status_ok(void)
+{
+    return make_status(STATUS_OK);
+}
+
+// A fixed string for 'code': safe to call anywhere.
+const char *status_name(status_code_t code);
+
+std::ostream &operator <<(std::ostream &o, const status_t &s);
+
+#endif  // STATUS_H
@@ -0,0 +1,122 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/**
+    A work-stealing thread pool that stays inside one cpuset.
+
+    One worker is started for each CPU of the set and pinned there with
+    utility::run_on_cpu(), and optionally given a realtime priority with
+    set_realtime_priority().  So a pool can't oversubscribe its partition,
+    and it can't leak onto somebody else's CPUs either.
+
+    Each worker owns a Chase-Lev deque.  Tasks a worker submits while
+    running go on its own deque (LIFO for the owner, cache-warm).  Tasks
+    from outside go round-robin into the workers' inboxes (mpsc_ring),
+    which each worker moves onto its deque.  An idle worker steals from the
+    others, nearest first: its hyperthread sibling, then the rest of its
+    package, then other packages.  That is read out of
+    /sys/devices/system/cpu/cpuN/topology.  When a victim's deque is dry
+    the thief empties the victim's inbox onto its own deque instead, so
+    tasks handed to a worker that's stuck in a long task don't wait for it.
+    (An inbox has one consumer at a time: whoever holds its 'inbox_busy'
+    flag.)
+
+    Idle workers sleep on an event_group, so submit() costs a push and an
+    atomic bump, and only makes a syscall when somebody is asleep, and
+    then wakes just one of them.
+
+    Tasks are plain function pointer + argument pairs.  A task that throws
+    gets reported and the worker carries on.
+*/
+
+#include <string>
+#include <vector>
+
+#include <sched.h>                  // SCHED_FIFO
+
+#include "event_group.h"
+
+class cpuset;
+class cpuset_manager;
+struct pool_worker;
+
+typedef void (*task_function_t)(void *arg);
+
+struct pool_task
+{
+    task_function_t function;
+    void *arg;
+
+    pool_task(void): function(0), arg(0) {}
+    pool_task(task_function_t f, void *a): function(f), arg(a) {}
+};
+
+namespace thread_pool_constants
+{
+    const std::string DEFAULT_NAME("thread pool default name");
+
+    enum
+    {
+        NO_RT_PRIORITY = 0,     // leave workers at the default policy
+        DEQUE_SIZE = 4096,      // tasks per worker deque (power of 2)
+        INBOX_SIZE = 1024       // tasks per worker inbox (power of 2)
+    };
+}
+
+namespace TPC = thread_pool_constants;
+
+class thread_pool
+{
+
+private:
+
+    std::string name_;
+    int rt_priority_;
+    unsigned sched_;
+
+    std::vector<pool_worker *> workers_;
+    event_group work_available_;
+
+    volatile int pending_;          //* submitted but not finished
+    volatile int idle_waiters_;     //* threads in wait_idle()
+    volatile int stopping_;
+    volatile unsigned submit_cursor_;
+
+private:    // not possible
+
+    thread_pool(const thread_pool &p);
+    thread_pool &operator =(const thread_pool &p);
+
+private:    // internal
+
+    void start(const cpuset &set);
+    void stop(void);
+
+    static void *worker_main(void *arg);
+    void run_worker(pool_worker *w);
+    bool find_work(pool_worker *w, pool_task *task);
+    bool drain_inbox(pool_worker *from, pool_worker *to, pool_task *task);
+    void run_task(pool_worker *w, const pool_task &task);
+    void order_victims(pool_worker *w);
+
+public:
+
+    thread_pool(const cpuset &set,
+                int rt_priority = TPC::NO_RT_PRIORITY,
+                unsigned sched_to_use = SCHED_FIFO,
+                const std::string &name = TPC::DEFAULT_NAME);
+    thread_pool(const cpuset_manager &manager,
+                const std::string &set_name,
+                int rt_priority = TPC::NO_RT_PRIORITY,
+                unsigned sched_to_use = SCHED_FIFO,
+                const std::string &name = TPC::DEFAULT_NAME);
+    ~thread_pool(void);
+
+    unsigned int size(void) const { return workers_.size(); }
+    const std::string &name(void) const { return name_; }
+
+    void submit(task_function_t function, void *arg);
+    void wait_idle(void);
+};
+
+#endif  // THREAD_POOL_H
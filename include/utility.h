@@ -3,6 +3,10 @@
 
 #include <sys/types.h>          // pid_t
 #include <unistd.h>             // getpid
+#include <pthread.h>
+#include <sched.h>              // cpu_set_t
+
+#include "status.h"
 
 #define LOCK(mutex,ERROR_MACRO) do { \
                                     int ret = pthread_mutex_lock(mutex); \
@@ -18,9 +22,76 @@
 
 namespace utility
 {
+    /**
+        How a mutex deals with priorities.  The default does nothing, which
+        invites priority inversion as soon as a SCHED_FIFO thread and a
+        SCHED_OTHER thread share a lock.  INHERIT boosts the holder to the
+        priority of its highest waiter; PROTECT runs the holder at a fixed
+        ceiling priority for as long as it has the lock.  'make stress'
+        (tools/inversion_test.cpp) measures the difference.
+    */
+    enum mutex_protocol_t
+    {
+        MUTEX_DEFAULT,
+        MUTEX_PRIO_INHERIT,
+        MUTEX_PRIO_PROTECT
+    };
+
+    int init_mutex(pthread_mutex_t *mutex,
+                   mutex_protocol_t protocol = MUTEX_DEFAULT,
+                   int ceiling = 0);
 
     unsigned int how_many_cpus(void);
     void run_on_cpu(unsigned cpu, pid_t pid = getpid());
+    status_t try_run_on_cpu(unsigned cpu, pid_t pid = getpid());
+
+    /**
+        Affinity to a whole mask at once.  'tid' is a thread id (gettid()),
+        with 0 meaning the calling thread: despite the name,
+        sched_setaffinity() only ever changes one thread.  To change every
+        thread of a process, use set_process_affinity().
+    */
+    status_t try_set_affinity(const cpu_set_t &mask, pid_t tid = 0);
+    void set_affinity(const cpu_set_t &mask, pid_t tid = 0);
+
+    status_t try_set_thread_affinity(pthread_t thread, const cpu_set_t &mask);
+    void set_thread_affinity(pthread_t thread, const cpu_set_t &mask);
+
+    // Returns how many threads were changed.
+    unsigned int set_process_affinity(const cpu_set_t &mask,
+                                      pid_t pid = getpid());
+
+    /**
+        Calls 'action' once for every thread of process 'pid', including
+        ones that turn up while we're going: /proc/<pid>/task is read again
+        until a pass finds nobody new.  A thread started by one we've
+        already done inherits the change anyway, so once a pass comes up
+        empty every thread has it.  (Not with SCHED_RESET_ON_FORK, which
+        new threads don't inherit: set_process_realtime_priority().)
+
+        Threads that exit before we get to them (ESRCH) are skipped.  Stops
+        at the first other failure and returns it.  'count' gets how many
+        threads 'action' succeeded on.
+    */
+    typedef status_t (*thread_action_t)(pid_t tid, void *arg);
+
+    status_t for_each_thread(pid_t pid, thread_action_t action, void *arg,
+                             unsigned int *count = 0);
+
+    // Thin wrappers around the futex syscall: glibc doesn't give us one.
+    // 'shared' selects the process-shared flavor for words that live in
+    // shared memory.
+    int futex_wait(volatile int *word, int expected, bool shared = false);
+    int futex_wake(volatile int *word, int how_many, bool shared = false);
+
+    // For spin loops: 'pause' on x86, which is kinder to a hyperthreaded
+    // sibling and doubles as a compiler barrier.
+    inline void cpu_relax(void) { __asm__ __volatile__("rep; nop" ::: "memory"); }
+
+    // Keeps the compiler from moving loads and stores across this point.
+    // On x86 that's all a release store or an acquire load needs, since
+    // the hardware doesn't reorder stores with stores or loads with loads.
+    inline void compiler_barrier(void) { __asm__ __volatile__("" ::: "memory"); }
 }
 
 #endif  /* UTILITY_H */
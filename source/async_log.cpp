@@ -0,0 +1,629 @@
+#include "async_log.h"
+
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>                 // atexit()
+#include <string.h>                 // memcpy()
+#include <unistd.h>                 // write()
+
+#include "event_group.h"
+#include "program_IO.h"
+#include "ring_queue.h"
+#include "utility.h"
+
+namespace async_log_name
+{
+    const std::string NAME("async_log");
+    log_module MODULE(NAME);
+}
+
+#define AL_NAME async_log_name::NAME
+#define AL_MODULE async_log_name::MODULE
+#define AL_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(AL_MODULE, AL_NAME, fmt, ## args)
+#define AL_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(AL_MODULE, AL_NAME, fmt, ## args)
+#define AL_WARNING(fmt, args...) WARNING_WITH_NAME(AL_NAME, fmt, ## args)
+#define AL_ERROR(fmt, args...) ERROR_WITH_NAME(AL_NAME, fmt, ## args)
+#define AL_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(AL_NAME, fmt, ## args)
+#define AL_REPORT(fmt, args...) REPORT_WITH_NAME(AL_NAME, fmt, ## args)
+#define AL_DP(level, fmt, args...) DP_WITH_MODULE(AL_MODULE, level, AL_NAME, fmt, ## args)
+
+#define AL_LOCK(mutex) LOCK(mutex,AL_ERROR)
+#define AL_UNLOCK(mutex) UNLOCK(mutex,AL_ERROR)
+
+////////////////////////////////////////////////////////////////////////////////
+// Records && Rings
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    enum
+    {
+        // Enough chunks for anything the macros can produce; anything
+        // longer handed straight to submit() gets cut off.
+        MAX_RECORD_CHUNKS = (DEFAULT_BUFFER_SIZE + ALC::CHUNK_TEXT - 1)
+                            / ALC::CHUNK_TEXT,
+        DRAIN_CHUNKS = 64,
+        WRITE_BUFFER = 32 * 1024,
+        REAP_PASSES = 2,        // reap() passes that must find a buffer dead
+
+        CHUNK_MORE = 0x1,       // the record carries on in the next chunk
+        CHUNK_BINARY = 0x2      // for the binary file, not stdout
+    };
+
+    /**
+        A record is one or more chunks pushed in one go, every one but the
+        last with CHUNK_MORE set.  128 bytes, two to a cache line pair.
+    */
+
+    struct log_chunk
+    {
+        uint8_t kind;           //* log_kind_t, or a binary record type
+        uint8_t flags;          //* CHUNK_*
+        uint16_t length;        //* bytes of 'text' used
+        char text[ALC::CHUNK_TEXT];
+    };
+
+    struct log_buffer
+    {
+        spsc_ring<log_chunk> ring;
+        volatile unsigned long dropped;     //* bumped by the owner only
+        unsigned long reported;             //* writer's, of 'dropped'
+        volatile int dead;                  //* owner has exited
+        int dead_passes;                    //* writer's: reap()s that saw it
+
+        explicit log_buffer(unsigned int chunks):
+            ring(chunks, 0),
+            dropped(0),
+            reported(0),
+            dead(0),
+            dead_passes(0)
+        {
+        }
+    };
+
+    // Every thread's buffer, for the writer.  Buffers of exited threads
+    // stay until the writer has emptied them.
+    pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+    std::vector<log_buffer *> buffers;
+    volatile int buffers_generation = 0;
+    unsigned long retired_dropped = 0;
+
+    __thread log_buffer *thread_buffer = 0;
+    pthread_key_t buffer_key;
+    pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+    // start() / stop()
+    pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+    volatile int running_flag = 0;
+    volatile int stopping = 0;
+    volatile unsigned int ring_chunks = ALC::DEFAULT_RING_CHUNKS;
+    int writer_cpu = ALC::NO_CPU;
+    pthread_t writer;
+    bool exit_handler_registered = false;
+
+    // The writer sleeps here when every ring is empty.
+    ring_waiter writer_waiter;
+
+    volatile int flush_requests = 0;
+    volatile int flushes_done = 0;
+    event_group flushed("async log flushed");
+
+    // Where binary records go; they're thrown away while it's -1.
+    volatile int binary_fd = -1;
+
+    // What the writer has collected so far.
+    struct writer_output
+    {
+        std::vector<char> text;
+        std::vector<char> binary;
+        std::vector<char> record;   //* binary record being put together
+    };
+
+    /**
+        The owner is exiting.  Anything it logs after this (from another
+        key's destructor, say) goes into a new buffer, not this one, which
+        the writer may free once it has seen 'dead'.
+    */
+
+    void
+    mark_buffer_dead(void *arg)
+    {
+        log_buffer *b = static_cast<log_buffer *>(arg);
+        if (thread_buffer == b)
+            thread_buffer = 0;
+
+        __sync_synchronize();           // its last records before 'dead'
+        b->dead = 1;
+        writer_waiter.notify();
+    }
+
+    void
+    make_buffer_key(void)
+    {
+        int ret = pthread_key_create(&buffer_key, mark_buffer_dead);
+        if (ret)
+        {
+            errno = ret;
+            AL_ERROR("creating per-thread log buffer key");
+        }
+    }
+
+    log_buffer *
+    make_thread_buffer(void)
+    {
+        pthread_once(&buffer_key_once, make_buffer_key);
+
+        log_buffer *b = new log_buffer(ring_chunks);
+
+        AL_LOCK(&buffers_mutex);
+        buffers.push_back(b);
+        ++buffers_generation;
+        AL_UNLOCK(&buffers_mutex);
+
+        pthread_setspecific(buffer_key, b);
+        thread_buffer = b;
+        return b;
+    }
+
+    void
+    write_all(int fd, const char *p, size_t length)
+    {
+        while (length)
+        {
+            ssize_t ret = write(fd, p, length);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;                 // nowhere left to complain to
+            }
+            p += ret;
+            length -= ret;
+        }
+    }
+
+    void
+    write_out(writer_output &out)
+    {
+        if (!out.text.empty())
+        {
+            write_all(STDOUT_FILENO, &out.text[0], out.text.size());
+            out.text.clear();
+        }
+
+        if (!out.binary.empty())
+        {
+            int fd = binary_fd;
+            if (fd >= 0)
+                write_all(fd, &out.binary[0], out.binary.size());
+            out.binary.clear();
+        }
+    }
+
+    /**
+        Text chunks just get glued on.  Binary ones are collected until
+        the last chunk of their record, then framed as
+
+            kind        1 byte
+            length      2 bytes, little-endian
+            payload     'length' bytes
+    */
+
+    void
+    add_chunk(const log_chunk &c, writer_output &out)
+    {
+        if (!(c.flags & CHUNK_BINARY))
+        {
+            out.text.insert(out.text.end(), c.text, c.text + c.length);
+            return;
+        }
+
+        out.record.insert(out.record.end(), c.text, c.text + c.length);
+        if (c.flags & CHUNK_MORE)
+            return;
+
+        size_t length = out.record.size();
+        out.binary.push_back(c.kind);
+        out.binary.push_back(length & 0xFF);
+        out.binary.push_back(length >> 8);
+        out.binary.insert(out.binary.end(), out.record.begin(),
+                          out.record.end());
+        out.record.clear();
+    }
+
+    /**
+        Empty every ring in 'list' into 'out', writing whenever it fills.
+        A record is always pushed whole, so emptying a ring never leaves
+        half of one behind.  Returns true if there was anything at all.
+    */
+
+    bool
+    drain(const std::vector<log_buffer *> &list, writer_output &out)
+    {
+        log_chunk chunks[DRAIN_CHUNKS];
+        bool got_any = false;
+
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            log_buffer *b = list[i];
+
+            unsigned long n;
+            while ((n = b->ring.pop_batch(chunks, DRAIN_CHUNKS)))
+            {
+                got_any = true;
+                for (unsigned long c = 0; c < n; ++c)
+                    add_chunk(chunks[c], out);
+
+                if (out.text.size() + out.binary.size() >= WRITE_BUFFER)
+                    write_out(out);
+            }
+
+            unsigned long dropped = b->dropped;
+            if (dropped != b->reported)
+            {
+                char note[128];
+                int length = snprintf(note, sizeof(note),
+                                      "%s: %lu log records dropped: ring full\n",
+                                      C(AL_NAME), dropped - b->reported);
+                out.text.insert(out.text.end(), note, note + length);
+                b->reported = dropped;
+                got_any = true;
+            }
+        }
+
+        write_out(out);
+        return got_any;
+    }
+
+    /**
+        Forget the buffers of threads that have exited, once they're empty.
+        A buffer has to be found dead and empty by REAP_PASSES reap()s in a
+        row, with a whole drain pass between each, before it's freed: the
+        owner may still have been on its way out of a push when 'dead' was
+        first seen, and whatever that push left gets drained in between.
+        Returns true if a buffer is waiting on its next pass.
+    */
+
+    bool
+    reap(void)
+    {
+        bool waiting = false;
+
+        AL_LOCK(&buffers_mutex);
+        for (size_t i = 0; i < buffers.size(); )
+        {
+            log_buffer *b = buffers[i];
+            if (!b->dead)
+            {
+                ++i;
+                continue;
+            }
+
+            __sync_synchronize();       // 'dead' before the ring
+            if (!b->ring.empty() || (b->dropped != b->reported))
+            {
+                b->dead_passes = 0;
+                ++i;
+            }
+            else if (++b->dead_passes < REAP_PASSES)
+            {
+                waiting = true;
+                ++i;
+            }
+            else
+            {
+                retired_dropped += b->dropped;
+                delete b;
+                buffers[i] = buffers.back();
+                buffers.pop_back();
+                ++buffers_generation;
+            }
+        }
+        AL_UNLOCK(&buffers_mutex);
+
+        return waiting;
+    }
+
+    void
+    finish_flushes(int requests)
+    {
+        if (flushes_done != requests)
+        {
+            flushes_done = requests;
+            flushed.broadcast();
+        }
+    }
+
+    void
+    snapshot(std::vector<log_buffer *> &list, int &seen_generation)
+    {
+        if (buffers_generation == seen_generation)
+            return;
+
+        AL_LOCK(&buffers_mutex);
+        list = buffers;
+        seen_generation = buffers_generation;
+        AL_UNLOCK(&buffers_mutex);
+    }
+
+    /**
+        Drain, and when a whole pass finds nothing, tidy up, answer any
+        flush() that was asked for before the pass started, and sleep.
+        flush_requests is read after prepare()'s fence and before the
+        rings, so a flush() caller's records are seen by the pass that
+        answers it.
+    */
+
+    void *
+    writer_main(void *)
+    {
+        if (writer_cpu != ALC::NO_CPU)
+        {
+            try
+            {
+                utility::run_on_cpu(writer_cpu, 0);
+            }
+            catch (std::exception &)
+            {
+                // run_on_cpu() already said why; carry on unpinned
+            }
+        }
+
+        std::vector<log_buffer *> list;
+        int seen_generation = -1;
+        writer_output out;
+        out.text.reserve(WRITE_BUFFER + DEFAULT_BUFFER_SIZE);
+        out.binary.reserve(WRITE_BUFFER + DEFAULT_BUFFER_SIZE);
+
+        for ( ; ; )
+        {
+            int s = writer_waiter.prepare();
+            int requests = flush_requests;
+            int stop_now = stopping;
+
+            snapshot(list, seen_generation);
+            if (drain(list, out))
+            {
+                writer_waiter.cancel();
+                continue;
+            }
+
+            bool reap_again = reap();
+            finish_flushes(requests);
+
+            if (stop_now || reap_again)
+            {
+                writer_waiter.cancel();
+                if (stop_now)
+                    break;
+                continue;
+            }
+
+            writer_waiter.park(s);
+            writer_waiter.cancel();
+        }
+
+        return 0;
+    }
+
+    void
+    stop_at_exit(void)
+    {
+        async_log::stop();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Control
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Start the writer, pinned to 'cpu' unless that's NO_CPU.  Threads get a
+    ring of 'chunks' chunks the first time they log; threads that already
+    have one keep it.
+*/
+
+void
+async_log::start(int cpu, unsigned int chunks)
+{
+    AL_LOCK(&control_mutex);
+
+    if (running_flag)
+    {
+        AL_UNLOCK(&control_mutex);
+        AL_WARNING("already running\n");
+        return;
+    }
+
+    ring_chunks = chunks;
+    writer_cpu = cpu;
+    stopping = 0;
+
+    int ret = pthread_create(&writer, 0, writer_main, 0);
+    if (ret)
+    {
+        AL_UNLOCK(&control_mutex);
+        errno = ret;
+        AL_ERROR("couldn't start the writer thread");
+    }
+
+    running_flag = 1;
+
+    if (!exit_handler_registered)
+    {
+        atexit(stop_at_exit);
+        exit_handler_registered = true;
+    }
+
+    AL_UNLOCK(&control_mutex);
+}
+
+/**
+    Drain everything and go back to writing synchronously.  Anything that
+    raced in behind the writer's last pass gets written from here.
+*/
+
+void
+async_log::stop(void)
+{
+    AL_LOCK(&control_mutex);
+
+    if (!running_flag)
+    {
+        AL_UNLOCK(&control_mutex);
+        return;
+    }
+
+    running_flag = 0;
+    stopping = 1;
+    writer_waiter.notify();
+
+    int ret = pthread_join(writer, 0);
+    stopping = 0;
+
+    AL_LOCK(&buffers_mutex);
+    std::vector<log_buffer *> list(buffers);
+    AL_UNLOCK(&buffers_mutex);
+
+    writer_output out;
+    drain(list, out);
+    finish_flushes(flush_requests);
+
+    AL_UNLOCK(&control_mutex);
+
+    if (ret)
+    {
+        errno = ret;
+        AL_REPORT("couldn't join the writer thread");
+    }
+}
+
+bool
+async_log::running(void)
+{
+    return running_flag;
+}
+
+void
+async_log::flush(void)
+{
+    if (!running_flag)
+        return;
+
+    int request = __sync_add_and_fetch(&flush_requests, 1);
+    writer_waiter.notify();
+
+    for ( ; ; )
+    {
+        int seen = flushed.generation();
+        if ((flushes_done - request >= 0) || !running_flag)
+            return;
+        flushed.wait(seen);
+    }
+}
+
+unsigned long
+async_log::dropped(void)
+{
+    AL_LOCK(&buffers_mutex);
+    unsigned long total = retired_dropped;
+    for (size_t i = 0; i < buffers.size(); ++i)
+        total += buffers[i]->dropped;
+    AL_UNLOCK(&buffers_mutex);
+    return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Logging
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Cut the record into chunks on the stack and push them as one batch, or
+    not at all: the room check can only be pessimistic, since only the
+    writer makes more room.
+*/
+
+namespace
+{
+    bool
+    push_record(int kind, unsigned int flags, const char *data,
+                unsigned int length)
+    {
+        log_buffer *b = thread_buffer ? thread_buffer : make_thread_buffer();
+
+        if (length > MAX_RECORD_CHUNKS * ALC::CHUNK_TEXT)
+            length = MAX_RECORD_CHUNKS * ALC::CHUNK_TEXT;
+        unsigned int count = length ? (length + ALC::CHUNK_TEXT - 1)
+                                      / ALC::CHUNK_TEXT
+                                    : 1;
+
+        if (b->ring.capacity() - b->ring.size() < count)
+        {
+            ++b->dropped;
+            return false;
+        }
+
+        log_chunk chunks[MAX_RECORD_CHUNKS];
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            unsigned int piece = (length > ALC::CHUNK_TEXT) ? ALC::CHUNK_TEXT
+                                                            : length;
+            chunks[i].kind = kind;
+            chunks[i].flags = flags | ((i + 1 < count) ? CHUNK_MORE : 0);
+            chunks[i].length = piece;
+            memcpy(chunks[i].text, data, piece);
+            data += piece;
+            length -= piece;
+        }
+
+        b->ring.push_batch(chunks, count);
+        writer_waiter.notify();
+        return true;
+    }
+}
+
+bool
+async_log::submit(int kind, const char *text, unsigned int length)
+{
+    if (!running_flag)
+        return false;
+
+    push_record(kind, 0, text, length);
+    return true;
+}
+
+bool
+async_log::submit_binary(int kind, const void *data, unsigned int length)
+{
+    if (!running_flag)
+        return false;
+
+    return push_record(kind, CHUNK_BINARY, static_cast<const char *>(data),
+                       length);
+}
+
+/**
+    Binary records written from now on go to 'fd' (-1 to throw them
+    away).  The caller owns the descriptor: flush() before closing it.
+*/
+
+void
+async_log::set_binary_fd(int fd)
+{
+    binary_fd = fd;
+}
+
+#undef AL_NAME
+#undef AL_MODULE
+#undef AL_CPRINT
+#undef AL_VPRINT
+#undef AL_WARNING
+#undef AL_ERROR
+#undef AL_RUNTIME
+#undef AL_REPORT
+#undef AL_DP
+#undef AL_LOCK
+#undef AL_UNLOCK
@@ -0,0 +1,877 @@
+#include "binary_log.h"
+
+#include <iostream>
+#include <iterator>                 // istreambuf_iterator
+#include <map>
+#include <vector>
+
+#include <ctype.h>                  // isdigit()
+#include <fcntl.h>                  // open()
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>                 // ptrdiff_t
+#include <stdint.h>
+#include <string.h>                 // memcpy(), strlen()
+#include <unistd.h>                 // close(), write()
+
+#include "program_IO.h"
+#include "timing.h"                 // get_time()
+#include "utility.h"
+
+namespace binary_log_name
+{
+    const std::string NAME("binary_log");
+    log_module MODULE(NAME);
+}
+
+#define BL_NAME binary_log_name::NAME
+#define BL_MODULE binary_log_name::MODULE
+#define BL_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(BL_MODULE, BL_NAME, fmt, ## args)
+#define BL_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(BL_MODULE, BL_NAME, fmt, ## args)
+#define BL_WARNING(fmt, args...) WARNING_WITH_NAME(BL_NAME, fmt, ## args)
+#define BL_ERROR(fmt, args...) ERROR_WITH_NAME(BL_NAME, fmt, ## args)
+#define BL_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(BL_NAME, fmt, ## args)
+#define BL_REPORT(fmt, args...) REPORT_WITH_NAME(BL_NAME, fmt, ## args)
+#define BL_DP(level, fmt, args...) DP_WITH_MODULE(BL_MODULE, level, BL_NAME, fmt, ## args)
+
+#define BL_LOCK(mutex) LOCK(mutex,BL_ERROR)
+#define BL_UNLOCK(mutex) UNLOCK(mutex,BL_ERROR)
+
+volatile int binary_log_enabled = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Formats
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    enum
+    {
+        // What async_log will take in one record, comfortably.
+        MAX_RECORD = DEFAULT_BUFFER_SIZE - 1,
+        MAX_ARGUMENTS = 32,         // '*'s included
+        MAX_PROBES = 32,
+        NULL_STRING = 0xFFFF,
+
+        // format_entry::state
+        ENTRY_BUILDING = 0,
+        ENTRY_READY,
+        ENTRY_UNUSABLE              // something we can't encode: use text
+    };
+
+    // How each argument is pulled off the va_list and stored.
+    enum
+    {
+        ARG_INT = 'i',              // int and anything promoted to it
+        ARG_LONG = 'l',
+        ARG_LONG_LONG = 'q',
+        ARG_INTMAX = 'j',
+        ARG_SIZE = 'z',
+        ARG_PTRDIFF = 't',
+        ARG_DOUBLE = 'd',
+        ARG_LONG_DOUBLE = 'D',      // stored as a double
+        ARG_POINTER = 'p',
+        ARG_STRING = 's',
+        ARG_SKIP = 'n'              // %n: taken off the list, not stored
+    };
+
+    struct conversion
+    {
+        const char *start;          //* the '%'
+        const char *length;         //* first length modifier, if any
+        const char *end;            //* just past the conversion character
+        int stars;                  //* '*' widths and precisions
+        char code;                  //* ARG_*
+    };
+
+    struct format_entry
+    {
+        const char * volatile format;
+        volatile int state;
+        volatile int announced;     //* text written to the current file
+        char signature[MAX_ARGUMENTS + 1];
+    };
+
+    // Keyed by the format's address; entries are claimed with a CAS and
+    // never given back, so lookups need no lock.
+    format_entry formats[BLC::FORMAT_TABLE_SIZE];
+
+    pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+    int log_fd = -1;
+    bool started_async = false;
+
+    /**
+        Pick apart the conversion starting at the '%' at 'p' (not a "%%").
+        False for anything we can't carry over to the decoder faithfully:
+        positional arguments, wide characters and strings, %m and so on.
+    */
+
+    bool
+    parse_conversion(const char *p, conversion &c)
+    {
+        c.start = p++;
+        c.stars = 0;
+
+        while (*p && strchr("-+ #0'I", *p))
+            ++p;
+
+        if (*p == '*')
+        {
+            ++c.stars;
+            ++p;
+        }
+        else
+            while (isdigit(*p))
+                ++p;
+
+        if (*p == '$')
+            return false;
+
+        if (*p == '.')
+        {
+            ++p;
+            if (*p == '*')
+            {
+                ++c.stars;
+                ++p;
+            }
+            else
+                while (isdigit(*p))
+                    ++p;
+        }
+
+        c.length = p;
+        char size = 0;
+        switch (*p)
+        {
+            case 'h':
+                size = (p[1] == 'h') ? 'H' : 'h';
+                p += (size == 'H') ? 2 : 1;
+                break;
+            case 'l':
+                size = (p[1] == 'l') ? 'q' : 'l';
+                p += (size == 'q') ? 2 : 1;
+                break;
+            case 'q':
+            case 'L':
+            case 'j':
+            case 't':
+                size = *p++;
+                break;
+            case 'z':
+            case 'Z':
+                size = 'z';
+                ++p;
+                break;
+        }
+
+        if (!*p)
+            return false;
+        c.end = p + 1;
+
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                switch (size)
+                {
+                    case 0:
+                    case 'H':
+                    case 'h':
+                        c.code = ARG_INT;
+                        break;
+                    case 'l':
+                        c.code = ARG_LONG;
+                        break;
+                    case 'q':
+                    case 'L':
+                        c.code = ARG_LONG_LONG;
+                        break;
+                    case 'j':
+                        c.code = ARG_INTMAX;
+                        break;
+                    case 'z':
+                        c.code = ARG_SIZE;
+                        break;
+                    default:
+                        c.code = ARG_PTRDIFF;
+                        break;
+                }
+                return true;
+
+            case 'c':
+                c.code = ARG_INT;
+                return !size;
+
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                c.code = (size == 'L') ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+                return !size || (size == 'l') || (size == 'L');
+
+            case 's':
+                c.code = ARG_STRING;
+                return !size;
+
+            case 'p':
+                c.code = ARG_POINTER;
+                return !size;
+
+            case 'n':
+                c.code = ARG_SKIP;
+                return true;
+        }
+
+        return false;
+    }
+
+    bool
+    make_signature(const char *format, char *signature)
+    {
+        unsigned int n = 0;
+
+        for (const char *p = format; *p; )
+        {
+            if (*p != '%')
+            {
+                ++p;
+                continue;
+            }
+            if (p[1] == '%')
+            {
+                p += 2;
+                continue;
+            }
+
+            conversion c;
+            if (!parse_conversion(p, c))
+                return false;
+            if (n + c.stars + 1 > MAX_ARGUMENTS)
+                return false;
+
+            for (int s = 0; s < c.stars; ++s)
+                signature[n++] = ARG_INT;
+            signature[n++] = c.code;
+            p = c.end;
+        }
+
+        signature[n] = 0;
+        return true;
+    }
+
+    /**
+        The entry for 'format', claiming and filling in a free one if it's
+        new.  Zero if we should just use text this time: the table's full
+        around this address, the format can't be encoded, or another thread
+        is still working out its signature (we don't wait for it).
+    */
+
+    format_entry *
+    find_format(const char *format)
+    {
+        uint64_t h = reinterpret_cast<uintptr_t>(format)
+                     * 0x9E3779B97F4A7C15ULL;
+        unsigned int slot = h >> 32;
+
+        for (int probe = 0; probe < MAX_PROBES; ++probe, ++slot)
+        {
+            format_entry &e = formats[slot & (BLC::FORMAT_TABLE_SIZE - 1)];
+
+            const char *current = e.format;
+            if (!current)
+            {
+                if (!__sync_bool_compare_and_swap(&e.format,
+                                                  (const char *) 0, format))
+                {
+                    current = e.format;
+                }
+                else
+                {
+                    bool ok = make_signature(format, e.signature);
+                    __sync_synchronize();
+                    e.state = ok ? ENTRY_READY : ENTRY_UNUSABLE;
+                    return ok ? &e : 0;
+                }
+            }
+
+            if (current == format)
+            {
+                if (e.state != ENTRY_READY)
+                    return 0;
+                __sync_synchronize();
+                return &e;
+            }
+        }
+
+        return 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    // Encoding
+    ////////////////////////////////////////////////////////////////////////
+
+    struct record_writer
+    {
+        char *p;
+        char *end;
+
+        record_writer(char *buffer, unsigned int size):
+            p(buffer),
+            end(buffer + size)
+        {
+        }
+
+        bool put(const void *data, unsigned int length)
+        {
+            if (length > static_cast<unsigned int>(end - p))
+                return false;
+            memcpy(p, data, length);
+            p += length;
+            return true;
+        }
+
+        template <typename T>
+        bool put_value(T value)
+        {
+            return put(&value, sizeof(value));
+        }
+    };
+
+    /**
+        The first record to use a format in this file sends the format's
+        text ahead of it.  If that can't be queued nobody has announced it,
+        so the next one tries again.
+    */
+
+    bool
+    announce(format_entry &e)
+    {
+        if (e.announced
+            || !__sync_bool_compare_and_swap(&e.announced, 0, 1))
+        {
+            return true;
+        }
+
+        char buffer[MAX_RECORD];
+        record_writer w(buffer, sizeof(buffer));
+
+        unsigned int length = strlen(e.format);
+        if (length > MAX_RECORD - sizeof(uint64_t))
+            length = MAX_RECORD - sizeof(uint64_t);
+
+        w.put_value<uint64_t>(reinterpret_cast<uintptr_t>(e.format));
+        w.put(e.format, length);
+
+        if (async_log::submit_binary(BLC::FORMAT_RECORD, buffer,
+                                     w.p - buffer))
+        {
+            return true;
+        }
+
+        e.announced = 0;
+        return false;
+    }
+
+    /**
+        False if the record couldn't be encoded and should go out as text;
+        a full ring just drops it (async_log counts it), same as text.
+    */
+
+    bool
+    send_record(log_kind_t kind, format_entry &e, va_list args)
+    {
+        if (!announce(e))
+            return false;
+
+        char buffer[MAX_RECORD];
+        record_writer w(buffer, sizeof(buffer));
+
+        w.put_value<uint64_t>(reinterpret_cast<uintptr_t>(e.format));
+        w.put_value<double>(get_time());
+
+        for (const char *s = e.signature; *s; ++s)
+        {
+            bool ok = true;
+            switch (*s)
+            {
+                case ARG_INT:
+                    ok = w.put_value<int32_t>(va_arg(args, int));
+                    break;
+                case ARG_LONG:
+                    ok = w.put_value<int64_t>(va_arg(args, long));
+                    break;
+                case ARG_LONG_LONG:
+                    ok = w.put_value<int64_t>(va_arg(args, long long));
+                    break;
+                case ARG_INTMAX:
+                    ok = w.put_value<int64_t>(va_arg(args, intmax_t));
+                    break;
+                case ARG_SIZE:
+                    ok = w.put_value<int64_t>(va_arg(args, size_t));
+                    break;
+                case ARG_PTRDIFF:
+                    ok = w.put_value<int64_t>(va_arg(args, ptrdiff_t));
+                    break;
+                case ARG_DOUBLE:
+                    ok = w.put_value<double>(va_arg(args, double));
+                    break;
+                case ARG_LONG_DOUBLE:
+                    ok = w.put_value<double>(va_arg(args, long double));
+                    break;
+                case ARG_POINTER:
+                    ok = w.put_value<uint64_t>(
+                            reinterpret_cast<uintptr_t>(va_arg(args, void *)));
+                    break;
+                case ARG_STRING:
+                {
+                    const char *string = va_arg(args, const char *);
+                    if (!string)
+                    {
+                        ok = w.put_value<uint16_t>(NULL_STRING);
+                        break;
+                    }
+                    uint16_t length = strnlen(string, BLC::MAX_STRING);
+                    ok = w.put_value<uint16_t>(length)
+                         && w.put(string, length);
+                    break;
+                }
+                case ARG_SKIP:
+                    va_arg(args, void *);
+                    break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        async_log::submit_binary(kind, buffer, w.p - buffer);
+        return true;
+    }
+}
+
+/**
+    What the CPRINT / DP macros call while binary logging is on.  Anything
+    that can't be stored as a binary record is formatted here and goes out
+    as text, the way it would have anyway.
+*/
+
+void
+binary_record(log_kind_t kind, const char *format, ...)
+{
+    int saved_errno = errno;
+
+    va_list args;
+    va_list copy;
+    va_start(args, format);
+    va_copy(copy, args);
+
+    format_entry *e = 0;
+    if (binary_log_enabled && async_log::running())
+        e = find_format(format);
+
+    if (!e || !send_record(kind, *e, args))
+    {
+        char Q[DEFAULT_BUFFER_SIZE];
+        vsnprintf(Q, sizeof(Q), format, copy);
+        program_output(kind, Q);
+    }
+
+    va_end(copy);
+    va_end(args);
+
+    errno = saved_errno;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Control
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Truncate 'path', write the header, and start sending records to it.
+    async_log gets started with 'cpu' and 'ring_chunks' if it isn't
+    running already, and stopped again by stop().
+*/
+
+void
+binary_log::start(const std::string &path, int cpu, unsigned int ring_chunks)
+{
+    BL_LOCK(&control_mutex);
+
+    if (log_fd >= 0)
+    {
+        BL_UNLOCK(&control_mutex);
+        BL_WARNING("already logging\n");
+        return;
+    }
+
+    int fd = open(C(path), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        BL_UNLOCK(&control_mutex);
+        BL_ERROR("couldn't open '%s'", C(path));
+    }
+
+    char header[sizeof(BLC::MAGIC)];
+    memcpy(header, BLC::MAGIC, sizeof(header) - 1);
+    header[sizeof(header) - 1] = BLC::FILE_VERSION;
+
+    if (write(fd, header, sizeof(header)) != sizeof(header))
+    {
+        int saved_errno = errno;
+        close(fd);
+        BL_UNLOCK(&control_mutex);
+        errno = saved_errno;
+        BL_ERROR("couldn't write the header to '%s'", C(path));
+    }
+
+    // A new file: every format has to be sent again.
+    for (int i = 0; i < BLC::FORMAT_TABLE_SIZE; ++i)
+        formats[i].announced = 0;
+
+    log_fd = fd;
+    async_log::set_binary_fd(fd);
+
+    started_async = !async_log::running();
+    if (started_async)
+    {
+        try
+        {
+            async_log::start(cpu, ring_chunks);
+        }
+        catch (std::exception &)
+        {
+            async_log::set_binary_fd(-1);
+            close(fd);
+            log_fd = -1;
+            BL_UNLOCK(&control_mutex);
+            throw;
+        }
+    }
+
+    __sync_synchronize();
+    binary_log_enabled = 1;
+
+    BL_UNLOCK(&control_mutex);
+}
+
+/**
+    Back to text.  Everything logged before the call is in the file when
+    it's closed; a record racing with the call may be lost.
+*/
+
+void
+binary_log::stop(void)
+{
+    BL_LOCK(&control_mutex);
+
+    if (log_fd < 0)
+    {
+        BL_UNLOCK(&control_mutex);
+        return;
+    }
+
+    binary_log_enabled = 0;
+    __sync_synchronize();
+
+    if (started_async)
+        async_log::stop();
+    else
+        async_log::flush();
+
+    async_log::set_binary_fd(-1);
+    close(log_fd);
+    log_fd = -1;
+
+    BL_UNLOCK(&control_mutex);
+}
+
+bool
+binary_log::running(void)
+{
+    return binary_log_enabled;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decoding
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    struct payload_reader
+    {
+        const char *p;
+        const char *end;
+
+        payload_reader(const char *begin, const char *finish):
+            p(begin),
+            end(finish)
+        {
+        }
+
+        bool get(void *data, unsigned int length)
+        {
+            if (length > static_cast<unsigned int>(end - p))
+                return false;
+            memcpy(data, p, length);
+            p += length;
+            return true;
+        }
+
+        template <typename T>
+        bool get_value(T &value)
+        {
+            return get(&value, sizeof(value));
+        }
+    };
+
+    typedef std::map<uint64_t, std::string> format_map_t;
+
+    template <typename T>
+    void
+    format_one(std::ostream &out, const std::string &spec, int stars,
+               const int32_t *star, T value)
+    {
+        char piece[DEFAULT_BUFFER_SIZE];
+
+        switch (stars)
+        {
+            case 0:
+                snprintf(piece, sizeof(piece), C(spec), value);
+                break;
+            case 1:
+                snprintf(piece, sizeof(piece), C(spec), star[0], value);
+                break;
+            default:
+                snprintf(piece, sizeof(piece), C(spec), star[0], star[1],
+                         value);
+                break;
+        }
+
+        out << piece;
+    }
+
+    /**
+        One conversion's worth of arguments out of 'r' and onto 'out'.
+        Stored integers other than int are 64 bits whatever they started
+        as, so their spec is rewritten with "ll".
+    */
+
+    bool
+    decode_conversion(const conversion &c, payload_reader &r,
+                      std::ostream &out)
+    {
+        int32_t star[2];
+        for (int s = 0; s < c.stars; ++s)
+            if (!r.get_value(star[s]))
+                return false;
+
+        std::string prefix(c.start, c.length);
+        char type = c.end[-1];
+
+        switch (c.code)
+        {
+            case ARG_INT:
+            {
+                int32_t v;
+                if (!r.get_value(v))
+                    return false;
+                format_one(out, std::string(c.start, c.end), c.stars, star,
+                           static_cast<int>(v));
+                return true;
+            }
+            case ARG_LONG:
+            case ARG_LONG_LONG:
+            case ARG_INTMAX:
+            case ARG_SIZE:
+            case ARG_PTRDIFF:
+            {
+                int64_t v;
+                if (!r.get_value(v))
+                    return false;
+                format_one(out, prefix + "ll" + type, c.stars, star,
+                           static_cast<long long>(v));
+                return true;
+            }
+            case ARG_DOUBLE:
+            case ARG_LONG_DOUBLE:
+            {
+                double v;
+                if (!r.get_value(v))
+                    return false;
+                format_one(out, prefix + type, c.stars, star, v);
+                return true;
+            }
+            case ARG_POINTER:
+            {
+                uint64_t v;
+                if (!r.get_value(v))
+                    return false;
+                format_one(out, prefix + type, c.stars, star,
+                           reinterpret_cast<void *>(
+                               static_cast<uintptr_t>(v)));
+                return true;
+            }
+            case ARG_STRING:
+            {
+                uint16_t length;
+                if (!r.get_value(length))
+                    return false;
+                if (length == NULL_STRING)
+                {
+                    format_one(out, prefix + type, c.stars, star, "(null)");
+                    return true;
+                }
+                std::string s(length, '\0');
+                if (length && !r.get(&s[0], length))
+                    return false;
+                format_one(out, prefix + type, c.stars, star, C(s));
+                return true;
+            }
+        }
+
+        return true;                        // ARG_SKIP
+    }
+
+    void
+    decode_record(const format_map_t &formats, payload_reader r,
+                  std::ostream &out)
+    {
+        uint64_t address;
+        double when;
+        if (!r.get_value(address) || !r.get_value(when))
+        {
+            out << "<short record>\n";
+            return;
+        }
+
+        char stamp[64];
+        snprintf(stamp, sizeof(stamp), "%.9f ", when);
+        out << stamp;
+
+        format_map_t::const_iterator f = formats.find(address);
+        if (f == formats.end())
+        {
+            snprintf(stamp, sizeof(stamp), "<unknown format 0x%llx>\n",
+                     static_cast<unsigned long long>(address));
+            out << stamp;
+            return;
+        }
+
+        const char *p = C(f->second);
+        while (*p)
+        {
+            const char *percent = strchr(p, '%');
+            if (!percent)
+            {
+                out << p;
+                break;
+            }
+
+            out.write(p, percent - p);
+            if (percent[1] == '%')
+            {
+                out << '%';
+                p = percent + 2;
+                continue;
+            }
+
+            conversion c;
+            if (!parse_conversion(percent, c))
+            {
+                out << percent;             // can't happen for a real record
+                break;
+            }
+            if (!decode_conversion(c, r, out))
+            {
+                out << "<truncated>\n";
+                return;
+            }
+            p = c.end;
+        }
+    }
+}
+
+/**
+    Two passes: format texts can turn up after records that use them when
+    two threads race to announce one, so collect them all first.
+*/
+
+void
+binary_log::decode(std::istream &in, std::ostream &out)
+{
+    std::vector<char> file((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+
+    const size_t header = sizeof(BLC::MAGIC);
+    if ((file.size() < header)
+        || memcmp(&file[0], BLC::MAGIC, header - 1))
+    {
+        BL_RUNTIME("not a binary log\n");
+    }
+    if (file[header - 1] != BLC::FILE_VERSION)
+    {
+        BL_RUNTIME("binary log version %d, expected %d\n",
+                   file[header - 1], BLC::FILE_VERSION);
+    }
+
+    const char *begin = &file[0] + header;
+    const char *end = &file[0] + file.size();
+
+    format_map_t formats;
+    for (const char *p = begin; end - p >= 3; )
+    {
+        unsigned int kind = static_cast<uint8_t>(p[0]);
+        unsigned int length = static_cast<uint8_t>(p[1])
+                              | (static_cast<uint8_t>(p[2]) << 8);
+        if (static_cast<unsigned int>(end - p - 3) < length)
+            break;
+
+        if ((kind == BLC::FORMAT_RECORD) && (length >= sizeof(uint64_t)))
+        {
+            uint64_t address;
+            memcpy(&address, p + 3, sizeof(address));
+            formats[address].assign(p + 3 + sizeof(address),
+                                    p + 3 + length);
+        }
+        p += 3 + length;
+    }
+
+    const char *p = begin;
+    while (end - p >= 3)
+    {
+        unsigned int kind = static_cast<uint8_t>(p[0]);
+        unsigned int length = static_cast<uint8_t>(p[1])
+                              | (static_cast<uint8_t>(p[2]) << 8);
+        if (static_cast<unsigned int>(end - p - 3) < length)
+            break;
+
+        if (kind != BLC::FORMAT_RECORD)
+            decode_record(formats,
+                          payload_reader(p + 3, p + 3 + length), out);
+        p += 3 + length;
+    }
+
+    if (p != end)
+        out << "<log ends partway through a record>\n";
+}
+
+#undef BL_NAME
+#undef BL_MODULE
+#undef BL_CPRINT
+#undef BL_VPRINT
+#undef BL_WARNING
+#undef BL_ERROR
+#undef BL_RUNTIME
+#undef BL_REPORT
+#undef BL_DP
+#undef BL_LOCK
+#undef BL_UNLOCK
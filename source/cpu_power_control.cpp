@@ -0,0 +1,297 @@
+#include "cpu_power_control.h"
+
+#include <errno.h>
+#include <fcntl.h>                  // open()
+#include <stdint.h>                 // int32_t
+#include <stdio.h>                  // snprintf()
+#include <stdlib.h>                 // strtoul()
+#include <unistd.h>                 // read(), write(), close()
+
+#include "program_IO.h"
+
+namespace cpu_power_control_name
+{
+    const std::string NAME("cpu_power_control");
+    log_module MODULE(NAME);
+}
+
+#define PC_NAME cpu_power_control_name::NAME
+#define PC_MODULE cpu_power_control_name::MODULE
+#define PC_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(PC_MODULE, PC_NAME, fmt, ## args)
+#define PC_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(PC_MODULE, PC_NAME, fmt, ## args)
+#define PC_WARNING(fmt, args...) WARNING_WITH_NAME(PC_NAME, fmt, ## args)
+#define PC_ERROR(fmt, args...) ERROR_WITH_NAME(PC_NAME, fmt, ## args)
+#define PC_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(PC_NAME, fmt, ## args)
+#define PC_REPORT(fmt, args...) REPORT_WITH_NAME(PC_NAME, fmt, ## args)
+#define PC_DP(level, fmt, args...) DP_WITH_MODULE(PC_MODULE, level, PC_NAME, fmt, ## args)
+
+namespace
+{
+    enum
+    {
+        MAX_PATH_LENGTH = 256,
+        MAX_NUMBER_TEXT = 32
+    };
+
+    // Empty if it can't be read.
+    std::string
+    read_text(const std::string &path)
+    {
+        std::string text;
+        int fd = open(C(path), O_RDONLY);
+        if (fd < 0)
+            return text;
+
+        char buffer[256];
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+            text.append(buffer, got);
+        close(fd);
+
+        while (!text.empty() && (text[text.size() - 1] == '\n'))
+            text.erase(text.size() - 1);
+        return text;
+    }
+
+    // Returns 0 or the errno.  sysfs wants the value in one write().
+    int
+    write_text(const std::string &path, const std::string &text)
+    {
+        int fd = open(C(path), O_WRONLY);
+        if (fd < 0)
+            return errno;
+
+        ssize_t ret;
+        do
+        {
+            ret = write(fd, C(text), text.size());
+        } while ((ret < 0) && (errno == EINTR));
+
+        int saved_errno = errno;
+        close(fd);
+
+        if (ret != static_cast<ssize_t>(text.size()))
+            return (ret < 0) ? saved_errno : EIO;
+        return 0;
+    }
+
+    std::string
+    number_text(unsigned long n)
+    {
+        char digits[MAX_NUMBER_TEXT];
+        snprintf(digits, sizeof(digits), "%lu", n);
+        return digits;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructors and destructor
+////////////////////////////////////////////////////////////////////////////////
+
+cpu_power_control::cpu_power_control(const cpuset &set):
+    CPUs_(set.CPUs()),
+    saved_(),
+    dma_latency_fd_(-1)
+{
+    if (CPUs_.empty())
+        PC_RUNTIME("cpuset '%s' has no CPUs", C(set.name()));
+}
+
+cpu_power_control::cpu_power_control(const cpu_vector_t &cpus):
+    CPUs_(cpus),
+    saved_(),
+    dma_latency_fd_(-1)
+{
+    if (CPUs_.empty())
+        PC_RUNTIME("no CPUs to control");
+}
+
+cpu_power_control::~cpu_power_control(void)
+{
+    restore();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    The device takes a binary 32 bit value.  Writing again while it's open
+    just changes the request.
+*/
+
+void
+cpu_power_control::hold_dma_latency(unsigned int latency_us)
+{
+    if (dma_latency_fd_ < 0)
+    {
+        dma_latency_fd_ = open(C(PCC::DMA_LATENCY_DEVICE), O_RDWR);
+        if (dma_latency_fd_ < 0)
+            PC_ERROR("couldn't open '%s'", C(PCC::DMA_LATENCY_DEVICE));
+    }
+
+    int32_t value = latency_us;
+    if (write(dma_latency_fd_, &value, sizeof(value)) != sizeof(value))
+    {
+        int err = errno;
+        release_dma_latency();
+        errno = err;
+        PC_ERROR("couldn't request %u us from '%s'", latency_us,
+                 C(PCC::DMA_LATENCY_DEVICE));
+    }
+
+    PC_CPRINT("holding CPU wake-up latency at %u us\n", latency_us);
+}
+
+void
+cpu_power_control::release_dma_latency(void)
+{
+    if (dma_latency_fd_ < 0)
+        return;
+
+    if (close(dma_latency_fd_))
+        PC_REPORT("close() of '%s' failed", C(PCC::DMA_LATENCY_DEVICE));
+    dma_latency_fd_ = -1;
+}
+
+void
+cpu_power_control::set_governor(const std::string &governor)
+{
+    for (cpu_vector_t::const_iterator c = CPUs_.begin(); c != CPUs_.end(); ++c)
+        change(cpu_path(*c, "cpufreq/scaling_governor"), governor);
+
+    PC_DP(DEBUG_1, "governor '%s' on %lu CPUs\n", C(governor),
+          (unsigned long)CPUs_.size());
+}
+
+/**
+    With 0, each CPU gets its own scaling_max_freq: they needn't all be
+    the same part.
+*/
+
+void
+cpu_power_control::set_min_frequency(unsigned int kHz)
+{
+    for (cpu_vector_t::const_iterator c = CPUs_.begin(); c != CPUs_.end(); ++c)
+    {
+        std::string value(number_text(kHz));
+        if (!kHz)
+        {
+            std::string max_path(cpu_path(*c, "cpufreq/scaling_max_freq"));
+            value = read_text(max_path);
+            if (value.empty())
+                PC_ERROR("couldn't read '%s': no cpufreq?", C(max_path));
+        }
+
+        change(cpu_path(*c, "cpufreq/scaling_min_freq"), value);
+    }
+}
+
+/**
+    State 0 is polling, with no latency to speak of, so it's never the one
+    disabled: a CPU always has somewhere to idle.
+*/
+
+unsigned int
+cpu_power_control::disable_idle_states(unsigned int max_latency_us)
+{
+    unsigned int disabled = 0;
+    char state[MAX_PATH_LENGTH];
+
+    for (cpu_vector_t::const_iterator c = CPUs_.begin(); c != CPUs_.end(); ++c)
+    {
+        for (unsigned s = 0; s < PCC::MAX_IDLE_STATES; ++s)
+        {
+            snprintf(state, sizeof(state), "cpuidle/state%u/", s);
+            std::string base(cpu_path(*c, state));
+
+            std::string latency(read_text(base + "latency"));
+            if (latency.empty())
+                break;
+
+            if (strtoul(C(latency), 0, 10) <= max_latency_us)
+                continue;
+
+            std::string disable_path(base + "disable");
+            if (read_text(disable_path) == "1")
+                continue;
+
+            change(disable_path, "1");
+            ++disabled;
+        }
+    }
+
+    PC_CPRINT("%u idle states over %u us disabled on %lu CPUs\n", disabled,
+              max_latency_us, (unsigned long)CPUs_.size());
+    return disabled;
+}
+
+/**
+    Never throws: the destructor uses it.
+*/
+
+void
+cpu_power_control::restore(void)
+{
+    for (std::vector<setting_t>::reverse_iterator s = saved_.rbegin();
+         s != saved_.rend(); ++s)
+    {
+        int err = write_text(s->first, s->second);
+        if (err)
+        {
+            errno = err;
+            PC_REPORT("couldn't restore '%s' to '%s'", C(s->first),
+                      C(s->second));
+        }
+    }
+    saved_.clear();
+
+    release_dma_latency();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Only the first value seen for a file is kept, so changing something
+    twice still restores what was there before either.
+*/
+
+void
+cpu_power_control::change(const std::string &path, const std::string &value)
+{
+    std::string original(read_text(path));
+    if (original.empty())
+        PC_ERROR("couldn't read '%s'", C(path));
+
+    int err = write_text(path, value);
+    if (err)
+    {
+        errno = err;
+        PC_ERROR("couldn't write '%s' to '%s'", C(value), C(path));
+    }
+
+    for (std::vector<setting_t>::const_iterator s = saved_.begin();
+         s != saved_.end(); ++s)
+        if (s->first == path)
+            return;
+
+    saved_.push_back(setting_t(path, original));
+}
+
+std::string
+cpu_power_control::cpu_path(cpuid_t cpu, const char *file) const
+{
+    return PCC::CPU_SYSFS + number_text(cpu) + "/" + file;
+}
+
+#undef PC_NAME
+#undef PC_MODULE
+#undef PC_CPRINT
+#undef PC_VPRINT
+#undef PC_WARNING
+#undef PC_ERROR
+#undef PC_RUNTIME
+#undef PC_REPORT
+#undef PC_DP
@@ -7,6 +7,7 @@
 #include <fcntl.h>                          // open()
 #include <errno.h>
 
+#include <algorithm>                        // remove()
 #include <sstream>
 #include <ostream>
 
@@ -15,6 +16,7 @@
 namespace cpuset_name
 {
     const std::string NAME("cpuset");
+    log_module MODULE(NAME);
 }
 
 namespace
@@ -25,6 +27,7 @@ namespace
         LINES_OF_TEXT_PER_CPU   = 20,   // /proc/cpuinfo: 20 if 1, 40 if 2, etc.
         MAX_CPUS                = 16,
         MAX_PATH_LENGTH         = 1024,
+        PIDS_RESERVED           = 32,   // so try_add_task() won't allocate
         TRIES                   = 3
     };
 
@@ -59,13 +62,16 @@ namespace
 #define RELEASE_NOTIFY_OFF(path) std::string(ECHO_OFF + (path) + "notify_on_release")
 
 #define CS_NAME cpuset_name::NAME
-#define CS_CPRINT(fmt, args...)  CPRINT_WITH_NAME(CS_NAME, fmt, ##args)
-#define CS_VPRINT(fmt, args...)  VPRINT_WITH_NAME(CS_NAME, fmt, ##args)
+#define CS_MODULE cpuset_name::MODULE
+#define CS_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(CS_MODULE, CS_NAME, fmt, ##args)
+#define CS_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(CS_MODULE, CS_NAME, fmt, ##args)
 #define CS_WARNING(fmt, args...) WARNING_WITH_NAME(CS_NAME, fmt, ##args)
 #define CS_ERROR(fmt, args...) ERROR_WITH_NAME(CS_NAME, fmt, ##args)
 #define CS_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(CS_NAME, fmt, ##args)
 #define CS_REPORT(fmt, args...) REPORT_WITH_NAME(CS_NAME, fmt, ##args);
-#define CS_DP(level, fmt, args...) DP(level, CS_NAME, fmt, ##args)
+#define CS_WARNING_LIMITED(fmt, args...) WARNING_LIMITED_WITH_NAME(CS_NAME, fmt, ##args)
+#define CS_REPORT_LIMITED(fmt, args...) REPORT_LIMITED_WITH_NAME(CS_NAME, fmt, ##args)
+#define CS_DP(level, fmt, args...) DP_WITH_MODULE(CS_MODULE, level, CS_NAME, fmt, ##args)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Static 
@@ -97,6 +103,7 @@ unsigned int cpuset::number_cpus_ = 0;
 cpuset::cpuset(void):
     name_(new std::string(cpuset_constants::ROOT_NAME)),
     path_(new std::string(CPUSET_PATH)),
+    tasks_path_(CPUSET_PATH + "tasks"),
     CPUs_(new cpu_vector_t()),
     pids_(new pid_vector_t()),
     cpu_is_exclusive_(true),
@@ -168,6 +175,7 @@ cpuset::cpuset
 ):
     name_(new std::string(name)),
     path_(),
+    tasks_path_(),
     CPUs_(new cpu_vector_t()),
     pids_(new pid_vector_t()),
     cpu_is_exclusive_(cpu_is_exclusive),
@@ -186,6 +194,8 @@ cpuset::cpuset
     std::string cmd;
     std::string base_path((parent_ ? parent_->path() : CPUSET_PATH));
     path_ = new std::string(base_path + name + "/");
+    tasks_path_ = *path_ + "tasks";
+    pids_->reserve(PIDS_RESERVED);
 
     // Check for parent's directory
     cmd = DIR_EXISTS_COMMAND + base_path;
@@ -218,7 +228,8 @@ cpuset::cpuset
         CS_CPRINT("Failed setting cpus for '%s': trying to clean up",CP(name_));
         ret = rmdir(CP(path_));
         if (ret)
-            CS_REPORT("%s: failed to remove CPUset: rmdir() failed", CP(name_));
+            CS_REPORT_LIMITED("%s: failed to remove CPUset: rmdir() failed",
+                              CP(name_));
         delete name_;
         delete path_;
         delete CPUs_;
@@ -264,11 +275,12 @@ cpuset::remove_root_cpuset(void)
 {
     int ret = umount(CP(path_));
     if (ret)
-        CS_REPORT("%s: failed to unmount cpuset", CP(name_));
+        CS_REPORT_LIMITED("%s: failed to unmount cpuset", CP(name_));
 
     ret = rmdir(CP(path_));
     if (ret)
-        CS_REPORT("%s: failed to remove CPUset: rmdir() failed", CP(name_));
+        CS_REPORT_LIMITED("%s: failed to remove CPUset: rmdir() failed",
+                          CP(name_));
 }
 
 /**
@@ -282,24 +294,28 @@ cpuset::~cpuset(void)
 
     CS_CPRINT("Deleting CPU set with name '%s'\n", CP(name_));
 
-    // delete children
-    cpuset_vector_t::iterator i = children_.begin();
-    cpuset_vector_t::iterator e = children_.end();
-    for ( ; i != e; ++i)
+    // delete children: each takes itself off children_ as it goes
+    while (!children_.empty())
     {
-        CS_CPRINT("Deleting child '%s'\n", C((*i)->name()));
-        delete *i;
+        CS_CPRINT("Deleting child '%s'\n", C(children_.back()->name()));
+        delete children_.back();
     }
 
     ret = chdir("/");
     if (ret)
-        CS_REPORT("%s: unable to \"cd /\" in order to unmount set", CP(name_));
+        CS_REPORT_LIMITED("%s: unable to \"cd /\" in order to unmount set",
+                          CP(name_));
 
     if (parent_)
     {
+        cpuset_vector_t &siblings = parent_->children_;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), this),
+                       siblings.end());
+
         ret = rmdir(CP(path_));
         if (ret)
-            CS_REPORT("%s: failed to remove CPUset: rmdir() failed", CP(name_));
+            CS_REPORT_LIMITED("%s: failed to remove CPUset: rmdir() failed",
+                              CP(name_));
     } else
         remove_root_cpuset();
 
@@ -547,25 +563,89 @@ cpuset::add_cpulist_to_cpuset(const std::string &cpulist)
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
-    Add the process 'pid' to the cpuset.
-*/ 
+    Add the process 'pid' to the cpuset, by writing it to the set's tasks
+    file.  This used to be "echo pid > tasks" run from wherever we
+    happened to be, which only worked if that was the set's directory.
+*/
 
-void
-cpuset::add_task(pid_t pid)
+status_t
+cpuset::try_add_task(pid_t pid)
 {
-    int length = 0;
-    for (pid_t x = pid ; x ; x /= 10)
-        ++length; 
-    
-    char digits[length + 1];
-    sprintf(digits, "%u", pid);
-    std::string cmd(ECHO + X(digits) + X(" > tasks"));
+    char digits[3 * sizeof(pid_t) + 2];
+    int length = snprintf(digits, sizeof(digits), "%d\n", pid);
 
-    int ret = system(C(cmd));
-    if (ret)
-        CS_ERROR("%s: Failed adding task %u: %s", CP(name_), pid, C(cmd));
+    int fd = open(C(tasks_path_), O_WRONLY);
+    if (fd < 0)
+        return make_status(STATUS_SYSTEM, errno);
+
+    ssize_t ret;
+    do
+    {
+        ret = write(fd, digits, length);
+    } while ((ret < 0) && (errno == EINTR));
+
+    int saved_errno = errno;
+    close(fd);
+
+    if (ret != length)
+        return make_status(STATUS_SYSTEM, (ret < 0) ? saved_errno : EIO);
 
     pids_->push_back(pid);
+    return status_ok();
+}
+
+/**
+    The tasks file takes one pid per write(), but there's no need to open
+    it again for each.
+*/
+
+unsigned int
+cpuset::add_tasks(const pid_vector_t &pids, pid_vector_t *refused)
+{
+    int fd = open(C(tasks_path_), O_WRONLY);
+    if (fd < 0)
+        CS_ERROR("%s: couldn't open '%s'", CP(name_), C(tasks_path_));
+
+    unsigned int added = 0;
+    char digits[3 * sizeof(pid_t) + 2];
+
+    for (pid_vector_t::const_iterator p = pids.begin(); p != pids.end(); ++p)
+    {
+        int length = snprintf(digits, sizeof(digits), "%d\n", *p);
+
+        ssize_t ret;
+        do
+        {
+            ret = write(fd, digits, length);
+        } while ((ret < 0) && (errno == EINTR));
+
+        if (ret == length)
+        {
+            pids_->push_back(*p);
+            ++added;
+        }
+        else if ((ret >= 0) || (errno != ESRCH))
+        {
+            CS_DP(DEBUG_1, "%s: task %d refused\n", CP(name_), *p);
+            if (refused)
+                refused->push_back(*p);
+        }
+    }
+
+    close(fd);
+    return added;
+}
+
+void
+cpuset::add_task(pid_t pid)
+{
+    status_t s = try_add_task(pid);
+    if (!s.ok())
+    {
+        errno = s.error;
+        CS_ERROR("%s: Failed adding task %d to '%s'", CP(name_), pid,
+                 C(tasks_path_));
+    }
 }
 
 /**
@@ -627,10 +707,13 @@ operator <<(std::ostream &o, const cpuset &s)
 
 #undef X
 #undef CS_NAME
+#undef CS_MODULE
 #undef CS_CPRINT
 #undef CS_VPRINT
 #undef CS_RUNTIME
 #undef CS_DP
+#undef CS_WARNING_LIMITED
+#undef CS_REPORT_LIMITED
 #undef S
 #undef SP
 
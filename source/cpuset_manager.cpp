@@ -3,30 +3,109 @@
 #include "program_IO.h"
 #include "utility.h"
 
+#include <set>
 #include <sstream>
 #include <ostream>
 
+#include <stdio.h>                  // fopen(), fgets()
+#include <stdlib.h>                 // strtoul()
+#include <string.h>                 // strrchr()
+
 namespace cpuset_manager_name
 {
     const std::string NAME("cpuset manager");
+    log_module MODULE(NAME);
 }
 
 namespace
 {
     enum
     {
-        MAX_CPU_STRING = 100
+        MAX_CPU_STRING = 100,
+        MAX_EVACUATION_PASSES = 8,  // tasks fork while we're moving them
+        MAX_STAT_LINE = 1024,
+        STAT_FIELDS_BEFORE_FLAGS = 6    // after "pid (comm)"
     };
+
+    // From linux/sched.h
+    const unsigned long PF_KTHREAD = 0x00200000;
+    const unsigned long PF_NO_SETAFFINITY = 0x04000000;
+
+    // Empty if it can't be read.
+    pid_vector_t
+    read_tasks(const std::string &path)
+    {
+        pid_vector_t pids;
+        FILE *f = fopen(C(path), "r");
+        if (!f)
+            return pids;
+
+        int pid;
+        while (fscanf(f, "%d", &pid) == 1)
+            pids.push_back(pid);
+        fclose(f);
+        return pids;
+    }
+
+    enum task_kind_t
+    {
+        TASK_GONE,
+        TASK_MOVABLE,
+        TASK_PINNED_KERNEL_THREAD
+    };
+
+    /**
+        A kernel thread the kernel won't let anybody move: the per-CPU
+        ones.  Unbound kernel threads (kthreadd, kworker/uN:M) don't have
+        PF_NO_SETAFFINITY and go with everything else.
+
+        The command name can have spaces and parentheses in it, so the
+        fields are counted from the last ')'.
+    */
+
+    task_kind_t
+    task_kind(pid_t pid)
+    {
+        char path[MAX_STAT_LINE];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+        FILE *f = fopen(path, "r");
+        if (!f)
+            return TASK_GONE;
+
+        char line[MAX_STAT_LINE];
+        char *ok = fgets(line, sizeof(line), f);
+        fclose(f);
+        if (!ok)
+            return TASK_GONE;
+
+        char *p = strrchr(line, ')');
+        if (!p)
+            return TASK_MOVABLE;
+
+        ++p;
+        for (unsigned field = 0; p && (field < STAT_FIELDS_BEFORE_FLAGS); ++field)
+            p = strchr(p + 1, ' ');
+        if (!p)
+            return TASK_MOVABLE;
+
+        unsigned long flags = strtoul(p, 0, 10);
+        if ((flags & PF_KTHREAD) && (flags & PF_NO_SETAFFINITY))
+            return TASK_PINNED_KERNEL_THREAD;
+
+        return TASK_MOVABLE;
+    }
 }
 
 #define CSM_NAME cpuset_manager_name::NAME
-#define CSM_CPRINT(fmt, args...)  CPRINT_WITH_NAME(CSM_NAME, fmt, ##args)
-#define CSM_VPRINT(fmt, args...)  VPRINT_WITH_NAME(CSM_NAME, fmt, ##args)
+#define CSM_MODULE cpuset_manager_name::MODULE
+#define CSM_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(CSM_MODULE, CSM_NAME, fmt, ##args)
+#define CSM_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(CSM_MODULE, CSM_NAME, fmt, ##args)
 #define CSM_WARNING(fmt, args...) WARNING_WITH_NAME(CSM_NAME, fmt, ##args)
 #define CSM_ERROR(fmt, args...) ERROR_WITH_NAME(CSM_NAME, fmt, ##args)
 #define CSM_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(CSM_NAME, fmt, ##args)
 #define CSM_REPORT(fmt, args...) REPORT_WITH_NAME(CSM_NAME, fmt, ##args);
-#define CSM_DP(level, fmt, args...) DP(level, CSM_NAME, fmt, ##args)
+#define CSM_DP(level, fmt, args...) DP_WITH_MODULE(CSM_MODULE, level, CSM_NAME, fmt, ##args)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Constructor and destructor
@@ -38,17 +117,38 @@ namespace
 
 cpuset_manager::cpuset_manager(void):
     root_(new cpuset()),
-    set_map_()
+    set_map_(),
+    budget_map_(),
+    irqs_(0),
+    evacuated_()
 {
     set_map_[root_->name()] = root_;
 }
 
 /**
-    Root recurses to delete all children.
+    Root recurses to delete all children.  Budgets aren't in a tree, so
+    they go one at a time.  IRQs go back where they were first, while the
+    sets they were kept off still exist, and evacuated tasks go back to
+    root before their housekeeping set is removed.
 */
 
 cpuset_manager::~cpuset_manager(void)
 {
+    delete irqs_;
+
+    try
+    {
+        return_to_root();
+    }
+    catch (std::exception &)
+    {
+        // already reported; the rmdir()s will complain too
+    }
+
+    for (budget_map_t::iterator b = budget_map_.begin();
+         b != budget_map_.end(); ++b)
+        delete b->second;
+
     delete root_;
 }
 
@@ -88,7 +188,8 @@ cpuset_manager::new_set
 }
 
 /**
-    Add some actual processes to your shiny cpuset.
+    Add some actual processes to your shiny cpuset, and to its memory
+    budget if it has one.
 */
 
 void
@@ -99,6 +200,33 @@ cpuset_manager::add_task_to_set(const std::string &name, pid_t process)
         CSM_RUNTIME("Cannot get cpuset '%s': not found", C(name));
 
     s->second->add_task(process);
+
+    budget_map_t::iterator b = budget_map_.find(name);
+    if (b != budget_map_.end())
+        b->second->add_task(process);
+}
+
+/**
+    STATUS_NOT_FOUND if there's no set called 'name'; otherwise whatever
+    cpuset::try_add_task() and memory_budget::try_add_task() say.
+*/
+
+status_t
+cpuset_manager::try_add_task_to_set(const std::string &name, pid_t process)
+{
+    cpuset_map_t::iterator s = set_map_.find(name);
+    if (s == set_map_.end())
+        return make_status(STATUS_NOT_FOUND);
+
+    status_t status = s->second->try_add_task(process);
+    if (!status.ok())
+        return status;
+
+    budget_map_t::iterator b = budget_map_.find(name);
+    if (b != budget_map_.end())
+        return b->second->try_add_task(process);
+
+    return status;
 }
 
 /**
@@ -119,8 +247,80 @@ cpuset_manager::remove_set(const std::string &cpuset_name)
     if (s == set_map_.end())
         CSM_RUNTIME("Cannot remove cpuset '%s': not found",C(cpuset_name));
 
-    delete s->second;
-    set_map_.erase(s);
+    cpuset *going = s->second;
+    forget_set(*going);
+    delete going;
+}
+
+/**
+    Drop everything we keep by name for 'set' and all its descendants,
+    which its destructor is about to take with it.  Their memory budgets
+    go now too, cgroups and all.
+*/
+
+void
+cpuset_manager::forget_set(const cpuset &set)
+{
+    const cpuset_vector_t &children = set.children();
+    for (cpuset_vector_t::const_iterator c = children.begin();
+         c != children.end(); ++c)
+        forget_set(**c);
+
+    budget_map_t::iterator b = budget_map_.find(set.name());
+    if (b != budget_map_.end())
+    {
+        delete b->second;
+        budget_map_.erase(b);
+    }
+
+    evacuated_.erase(set.name());
+    set_map_.erase(set.name());
+}
+
+/**
+    The root set covers everything, so there's no budgeting it: that's
+    what memory.max on the whole machine is.
+*/
+
+void
+cpuset_manager::set_memory_budget
+(
+    const std::string &cpuset_name,
+    uint64_t max_bytes,
+    uint64_t high_bytes
+)
+{
+    if (cpuset_name == root_->name())
+        CSM_RUNTIME("Cannot give the root cpuset a memory budget");
+
+    if (set_map_.count(cpuset_name) == 0)
+        CSM_RUNTIME("Cannot budget cpuset '%s': not found", C(cpuset_name));
+
+    memory_budget *&budget = budget_map_[cpuset_name];
+    if (!budget)
+    {
+        try
+        {
+            budget = new memory_budget(cpuset_name);
+        }
+        catch (...)
+        {
+            budget_map_.erase(cpuset_name);
+            throw;
+        }
+    }
+
+    budget->set_limits(max_bytes, high_bytes);
+}
+
+const memory_budget &
+cpuset_manager::get_memory_budget(const std::string &cpuset_name) const
+{
+    budget_map_t::const_iterator b = budget_map_.find(cpuset_name);
+    if (b == budget_map_.end())
+        CSM_RUNTIME("cpuset '%s' has no memory budget", C(cpuset_name));
+
+    return *(b->second);
 }
 
 /**
@@ -173,6 +373,160 @@ cpuset_manager::print(void) const
     return o.str(); 
 }
 
+/**
+    Protecting CPUs is one way: once steered off, IRQs stay off until the
+    manager goes, even if the set is removed first.
+*/
+
+irq_steering_types::irq_report_t
+cpuset_manager::steer_irqs_away_from(const std::string &cpuset_name)
+{
+    if (cpuset_name == root_->name())
+        CSM_RUNTIME("Cannot steer IRQs away from the root cpuset: it has "
+                    "every CPU");
+
+    const cpuset &set = get_set(cpuset_name);
+
+    if (!irqs_)
+        irqs_ = new irq_steering();
+
+    irqs_->protect(set);
+    return irqs_->apply();
+}
+
+void
+cpuset_manager::allow_irq(irq_steering_types::irq_t irq,
+                          const std::string &cpus)
+{
+    if (!irqs_)
+        irqs_ = new irq_steering();
+
+    irqs_->allow(irq, cpus);
+}
+
+/**
+    Root's task list is read again after each pass, since tasks still in
+    root can fork (their children land in root too) while we're busy.
+    Ones that have been refused or skipped once aren't tried again, so a
+    pass that finds nothing new to move is the last.
+*/
+
+evacuation_report_t
+cpuset_manager::evacuate_to(const std::string &housekeeping_set)
+{
+    if (housekeeping_set == root_->name())
+        CSM_RUNTIME("Cannot evacuate the root cpuset into itself");
+
+    cpuset &to = gimme_the_damn_set(housekeeping_set);
+    std::string root_tasks(root_->path() + "tasks");
+
+    evacuation_report_t report;
+    report.moved = 0;
+    report.pinned_kernel_threads = 0;
+    report.exited = 0;
+    report.passes = 0;
+
+    std::set<pid_t> left_alone;
+
+    while (report.passes < MAX_EVACUATION_PASSES)
+    {
+        pid_vector_t tasks(read_tasks(root_tasks));
+        if (tasks.empty() && !report.passes)
+            CSM_RUNTIME("Couldn't read the task list '%s'", C(root_tasks));
+        ++report.passes;
+
+        pid_vector_t movable;
+        movable.reserve(tasks.size());
+        for (pid_vector_t::const_iterator t = tasks.begin();
+             t != tasks.end(); ++t)
+        {
+            if (left_alone.count(*t))
+                continue;
+
+            switch (task_kind(*t))
+            {
+                case TASK_GONE:
+                    ++report.exited;
+                    left_alone.insert(*t);
+                    break;
+                case TASK_PINNED_KERNEL_THREAD:
+                    ++report.pinned_kernel_threads;
+                    left_alone.insert(*t);
+                    break;
+                case TASK_MOVABLE:
+                    movable.push_back(*t);
+                    break;
+            }
+        }
+
+        if (movable.empty())
+            break;
+
+        unsigned int refused_before = report.refused.size();
+        unsigned int moved = to.add_tasks(movable, &report.refused);
+        report.moved += moved;
+        report.exited += movable.size() - moved
+                         - (report.refused.size() - refused_before);
+
+        std::set<pid_t> refused(report.refused.begin() + refused_before,
+                                report.refused.end());
+        left_alone.insert(refused.begin(), refused.end());
+
+        // Ones that exited on the way get recorded too: return_to_root()
+        // only moves what's still in the set anyway.
+        pid_vector_t &record = evacuated_[housekeeping_set];
+        for (pid_vector_t::const_iterator m = movable.begin();
+             m != movable.end(); ++m)
+            if (!refused.count(*m))
+                record.push_back(*m);
+    }
+
+    std::ostringstream o;
+    o << report;
+    CSM_CPRINT("Evacuated into '%s': %s\n", C(housekeeping_set), C(o.str()));
+
+    return report;
+}
+
+/**
+    Only tasks still in their housekeeping set go back: any moved on to
+    another set since stay where they were put.  Called by the destructor,
+    so it only throws if root's task file can't be opened.
+*/
+
+unsigned int
+cpuset_manager::return_to_root(void)
+{
+    unsigned int returned = 0;
+
+    for (evacuation_map_t::iterator e = evacuated_.begin();
+         e != evacuated_.end(); ++e)
+    {
+        cpuset_map_t::const_iterator s = set_map_.find(e->first);
+        if (s == set_map_.end())
+            continue;
+
+        pid_vector_t there(read_tasks(s->second->path() + "tasks"));
+        std::set<pid_t> still_there(there.begin(), there.end());
+
+        pid_vector_t going;
+        for (pid_vector_t::const_iterator p = e->second.begin();
+             p != e->second.end(); ++p)
+            if (still_there.count(*p))
+                going.push_back(*p);
+
+        pid_vector_t refused;
+        unsigned int moved = root_->add_tasks(going, &refused);
+        returned += moved;
+
+        CSM_CPRINT("%u tasks back in root from '%s', %lu refused\n", moved,
+                   C(e->first), (unsigned long)refused.size());
+    }
+
+    evacuated_.clear();
+    return returned;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Not in Class
 ////////////////////////////////////////////////////////////////////////////////
@@ -184,7 +538,26 @@ operator <<(std::ostream &o, const cpuset_manager &s)
     return o;
 }
 
+std::ostream &
+operator <<(std::ostream &o, const evacuation_report_t &r)
+{
+    o << r.moved << " tasks moved, " << r.pinned_kernel_threads
+      << " per-CPU kernel threads left, " << r.exited << " exited, "
+      << r.passes << " passes";
+
+    if (!r.refused.empty())
+    {
+        o << ", refused:";
+        for (pid_vector_t::const_iterator p = r.refused.begin();
+             p != r.refused.end(); ++p)
+            o << " " << *p;
+    }
+
+    return o;
+}
+
 #undef CSM_NAME
+#undef CSM_MODULE
 #undef CSM_CPRINT
 #undef CSM_VPRINT
 #undef CSM_WARNING
@@ -0,0 +1,223 @@
+#include "event_group.h"
+#include "program_IO.h"
+#include "utility.h"
+
+#include <limits.h>                 // INT_MAX
+#include <errno.h>
+
+namespace event_group_name
+{
+    const std::string NAME("event_group");
+    log_module MODULE(NAME);
+}
+
+#define EG_NAME event_group_name::NAME
+#define EG_MODULE event_group_name::MODULE
+#define EG_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(EG_MODULE, EG_NAME, fmt, ## args)
+#define EG_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(EG_MODULE, EG_NAME, fmt, ## args)
+#define EG_WARNING(fmt, args...) WARNING_WITH_NAME(EG_NAME, fmt, ## args)
+#define EG_ERROR(fmt, args...) ERROR_WITH_NAME(EG_NAME, fmt, ## args)
+#define EG_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(EG_NAME, fmt, ## args)
+#define EG_REPORT(fmt, args...) REPORT_WITH_NAME(EG_NAME, fmt, ## args)
+#define EG_DP(level, fmt, args...) DP_WITH_MODULE(EG_MODULE, level, EG_NAME, fmt, ## args)
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+/**
+    Common sleeping code for both classes: spin on '*word' for a while, and
+    if it still reads 'seen' then register as a waiter and go to sleep in
+    the kernel until it changes.
+
+    The waiter count lets the waking side skip the syscall altogether when
+    everybody is still spinning, which is the case we're hoping for.
+*/
+
+void
+wait_for_change(volatile int *word, int seen, volatile int *waiters,
+                unsigned int spins, const std::string &name)
+{
+    for (unsigned int i = 0; i < spins; ++i)
+    {
+        if (*word != seen)
+            return;
+        utility::cpu_relax();
+    }
+
+    __sync_fetch_and_add(waiters, 1);
+    while (*word == seen)
+    {
+        int ret = utility::futex_wait(word, seen);
+        if (ret && (errno != EAGAIN) && (errno != EINTR))
+        {
+            __sync_fetch_and_sub(waiters, 1);
+            EG_ERROR("futex wait for '%s'", C(name));
+        }
+    }
+    __sync_fetch_and_sub(waiters, 1);
+}
+
+/**
+    Bump the word that everybody is watching and kick any sleepers.  The
+    atomic add is a full barrier, so a waiter that registered itself before
+    we read 'waiters' is seen, and one that registers afterwards will find
+    the word already changed and won't sleep.
+*/
+
+void
+release(volatile int *word, volatile int *waiters, int how_many,
+        const std::string &name)
+{
+    __sync_fetch_and_add(word, 1);
+    if (*waiters)
+    {
+        int ret = utility::futex_wake(word, how_many);
+        if (ret == -1)
+            EG_ERROR("futex wake for '%s'", C(name));
+    }
+}
+
+void
+release_all(volatile int *word, volatile int *waiters, const std::string &name)
+{
+    release(word, waiters, INT_MAX, name);
+}
+
+}   // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// event_group
+////////////////////////////////////////////////////////////////////////////////
+
+event_group::event_group(const std::string &name, unsigned int spins):
+    name_(name),
+    spins_(spins),
+    generation_(0),
+    waiters_(0)
+{
+}
+
+/**
+    Destroying a group that people are still sleeping on is the caller's
+    problem, but it's worth a mention.
+*/
+
+event_group::~event_group(void)
+{
+    if (waiters_)
+        EG_WARNING("'%s' destroyed with %d threads waiting\n",
+                   C(name_), waiters_);
+}
+
+/**
+    Wait until the generation moves past 'seen_generation'.  Returns
+    immediately if a broadcast already happened.
+*/
+
+void
+event_group::wait(int seen_generation)
+{
+    wait_for_change(&generation_, seen_generation, &waiters_, spins_, name_);
+}
+
+/**
+    Wait for the next broadcast.  Racy with respect to a broadcast that
+    lands before we get here: use generation() and wait() if that matters.
+*/
+
+void
+event_group::block(void)
+{
+    wait(generation_);
+}
+
+/**
+    Release everybody waiting on the group.  Costs one atomic add, plus one
+    syscall if anybody actually went to sleep.
+*/
+
+void
+event_group::broadcast(void)
+{
+    release_all(&generation_, &waiters_, name_);
+}
+
+/**
+    Wake one sleeper, if there are any.  Whoever else was asleep stays
+    asleep, with a stale generation, and returns at once the next time
+    anything wakes it.
+*/
+
+void
+event_group::signal(void)
+{
+    release(&generation_, &waiters_, 1, name_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// phase_barrier
+////////////////////////////////////////////////////////////////////////////////
+
+phase_barrier::phase_barrier
+(
+    unsigned int parties,
+    const std::string &name,
+    unsigned int spins
+):
+    name_(name),
+    parties_(parties),
+    spins_(spins),
+    phase_(0),
+    arrived_(0),
+    waiters_(0)
+{
+    if (!parties_)
+        EG_RUNTIME("'%s': a barrier needs at least one participant", C(name_));
+}
+
+phase_barrier::~phase_barrier(void)
+{
+    if (arrived_)
+        EG_WARNING("'%s' destroyed with %d of %u participants waiting\n",
+                   C(name_), arrived_, parties_);
+}
+
+/**
+    Block until all 'parties' participants have arrived.  The last one to
+    show up resets the count and flips the phase, which releases everybody
+    else.  Returns true for exactly one participant per phase (the last
+    arrival) in case somebody needs to do a bit of serial work.
+
+    Nobody can arrive for the next phase until the phase flips, so
+    resetting 'arrived_' before flipping is safe.
+*/
+
+bool
+phase_barrier::arrive_and_wait(void)
+{
+    int phase = phase_;
+
+    if (__sync_add_and_fetch(&arrived_, 1) == static_cast<int>(parties_))
+    {
+        arrived_ = 0;
+        release_all(&phase_, &waiters_, name_);
+        return true;
+    }
+
+    wait_for_change(&phase_, phase, &waiters_, spins_, name_);
+    return false;
+}
+
+#undef EG_NAME
+#undef EG_MODULE
+#undef EG_CPRINT
+#undef EG_VPRINT
+#undef EG_WARNING
+#undef EG_ERROR
+#undef EG_RUNTIME
+#undef EG_REPORT
+#undef EG_DP
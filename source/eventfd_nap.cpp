@@ -0,0 +1,119 @@
+#include "eventfd_nap.h"
+#include "program_IO.h"
+
+#include <sys/eventfd.h>            // eventfd()
+#include <poll.h>                   // poll()
+#include <unistd.h>                 // read(), write(), close()
+#include <stdint.h>
+#include <errno.h>
+
+namespace eventfd_nap_name
+{
+    const std::string NAME("eventfd_nap");
+    log_module MODULE(NAME);
+}
+
+#define EN_NAME eventfd_nap_name::NAME
+#define EN_MODULE eventfd_nap_name::MODULE
+#define EN_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(EN_MODULE, EN_NAME, fmt, ## args)
+#define EN_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(EN_MODULE, EN_NAME, fmt, ## args)
+#define EN_WARNING(fmt, args...) WARNING_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_ERROR(fmt, args...) ERROR_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_REPORT(fmt, args...) REPORT_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_WARNING_LIMITED(fmt, args...) WARNING_LIMITED_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_REPORT_LIMITED(fmt, args...) REPORT_LIMITED_WITH_NAME(EN_NAME, fmt, ## args)
+#define EN_DP(level, fmt, args...) DP_WITH_MODULE(EN_MODULE, level, EN_NAME, fmt, ## args)
+
+/**
+    The fd is non-blocking so that consume() from an event loop can never
+    hang; block() does its waiting in poll() instead.
+*/
+
+eventfd_nap::eventfd_nap(const std::string &name):
+    name_(name),
+    fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (fd_ == -1)
+        EN_ERROR("Error creating eventfd '%s'", C(name_));
+}
+
+eventfd_nap::~eventfd_nap(void)
+{
+    if (close(fd_))
+        EN_REPORT_LIMITED("Cannot close eventfd '%s'", C(name_));
+}
+
+/**
+    Clear any pending wakeups.  Returns true if there were some.  Reading
+    an eventfd hands back the count and resets it, so several wake_up()s
+    collapse into one, same as pthread_nap.
+*/
+
+bool
+eventfd_nap::consume(void)
+{
+    uint64_t count;
+    for ( ; ; )
+    {
+        ssize_t ret = read(fd_, &count, sizeof(count));
+        if (ret == sizeof(count))
+            return true;
+        if ((ret == -1) && (errno == EAGAIN))
+            return false;
+        if ((ret == -1) && (errno == EINTR))
+            continue;
+        EN_ERROR("read of eventfd '%s'", C(name_));
+    }
+}
+
+void
+eventfd_nap::block(void)
+{
+    struct pollfd p;
+    p.fd = fd_;
+    p.events = POLLIN;
+
+    while (!consume())
+    {
+        p.revents = 0;
+        int ret = poll(&p, 1, -1);
+        if ((ret == -1) && (errno != EINTR))
+            EN_ERROR("poll of eventfd '%s'", C(name_));
+    }
+}
+
+/**
+    Adding to the count can only fail with EAGAIN if it would overflow,
+    which takes 2^64 - 1 unconsumed wakeups: that still means somebody
+    will wake up, so it's ignored.
+*/
+
+void
+eventfd_nap::wake_up(void)
+{
+    const uint64_t one = 1;
+    for ( ; ; )
+    {
+        ssize_t ret = write(fd_, &one, sizeof(one));
+        if (ret == sizeof(one))
+            return;
+        if ((ret == -1) && (errno == EAGAIN))
+            return;
+        if ((ret == -1) && (errno == EINTR))
+            continue;
+        EN_ERROR("write of eventfd '%s'", C(name_));
+    }
+}
+
+#undef EN_NAME
+#undef EN_MODULE
+#undef EN_CPRINT
+#undef EN_VPRINT
+#undef EN_WARNING
+#undef EN_ERROR
+#undef EN_RUNTIME
+#undef EN_REPORT
+#undef EN_WARNING_LIMITED
+#undef EN_REPORT_LIMITED
+#undef EN_DP
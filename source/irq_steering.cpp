@@ -0,0 +1,491 @@
+#include "irq_steering.h"
+#include "cpuset.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>                  // open()
+#include <stdio.h>                  // snprintf()
+#include <stdlib.h>                 // strtoul()
+#include <string.h>                 // strerror()
+#include <unistd.h>                 // read(), write()
+
+#include <ostream>
+
+#include "program_IO.h"
+
+namespace irq_steering_name
+{
+    const std::string NAME("irq_steering");
+    log_module MODULE(NAME);
+}
+
+#define IRQ_NAME irq_steering_name::NAME
+#define IRQ_MODULE irq_steering_name::MODULE
+#define IRQ_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(IRQ_MODULE, IRQ_NAME, fmt, ## args)
+#define IRQ_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(IRQ_MODULE, IRQ_NAME, fmt, ## args)
+#define IRQ_WARNING(fmt, args...) WARNING_WITH_NAME(IRQ_NAME, fmt, ## args)
+#define IRQ_ERROR(fmt, args...) ERROR_WITH_NAME(IRQ_NAME, fmt, ## args)
+#define IRQ_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(IRQ_NAME, fmt, ## args)
+#define IRQ_REPORT(fmt, args...) REPORT_WITH_NAME(IRQ_NAME, fmt, ## args)
+#define IRQ_DP(level, fmt, args...) DP_WITH_MODULE(IRQ_MODULE, level, IRQ_NAME, fmt, ## args)
+
+using irq_steering_types::irq_t;
+using irq_steering_types::irq_vector_t;
+using irq_steering_types::cpu_flags_t;
+using irq_steering_types::irq_report_t;
+
+namespace
+{
+    enum
+    {
+        BITS_PER_WORD = 32,             // smp_affinity masks come in these
+        MAX_NUMBER_TEXT = 32
+    };
+
+    const std::string DEFAULT_AFFINITY(ISC::PROC_IRQ + "default_smp_affinity");
+
+    // Empty if it can't be read.
+    std::string
+    read_text(const std::string &path)
+    {
+        std::string text;
+        int fd = open(C(path), O_RDONLY);
+        if (fd < 0)
+            return text;
+
+        char buffer[4096];
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+            text.append(buffer, got);
+        close(fd);
+
+        while (!text.empty() && (text[text.size() - 1] == '\n'))
+            text.erase(text.size() - 1);
+        return text;
+    }
+
+    // Returns 0 or the errno.  The value has to go in one write().
+    int
+    write_text(const std::string &path, const std::string &text)
+    {
+        int fd = open(C(path), O_WRONLY);
+        if (fd < 0)
+            return errno;
+
+        ssize_t ret;
+        do
+        {
+            ret = write(fd, C(text), text.size());
+        } while ((ret < 0) && (errno == EINTR));
+
+        int saved_errno = errno;
+        close(fd);
+
+        if (ret != static_cast<ssize_t>(text.size()))
+            return (ret < 0) ? saved_errno : EIO;
+        return 0;
+    }
+
+    std::string
+    affinity_path(irq_t irq)
+    {
+        char number[MAX_NUMBER_TEXT];
+        snprintf(number, sizeof(number), "%u", irq);
+        return ISC::PROC_IRQ + number + "/smp_affinity_list";
+    }
+
+    /**
+        "0-3,8" and the like.  CPUs past 'count' are dropped if 'strict' is
+        false (the kernel's lists can name CPUs that are offline) and make
+        it fail otherwise.  False on anything unparseable.
+    */
+
+    bool
+    parse_cpus(const std::string &list, unsigned count, bool strict,
+               cpu_flags_t *cpus)
+    {
+        cpus->assign(count, false);
+
+        const char *p = C(list);
+        while (*p)
+        {
+            char *end;
+            unsigned long first = strtoul(p, &end, 10);
+            if (end == p)
+                return false;
+
+            unsigned long last = first;
+            p = end;
+            if (*p == '-')
+            {
+                ++p;
+                last = strtoul(p, &end, 10);
+                if ((end == p) || (last < first))
+                    return false;
+                p = end;
+            }
+
+            if (*p == ',')
+                ++p;
+            else if (*p)
+                return false;
+
+            for (unsigned long cpu = first; cpu <= last; ++cpu)
+            {
+                if (cpu < count)
+                    (*cpus)[cpu] = true;
+                else if (strict)
+                    return false;
+                else
+                    break;
+            }
+        }
+
+        return true;
+    }
+
+    std::string
+    format_cpus(const cpu_flags_t &cpus)
+    {
+        std::string list;
+        char range[2 * MAX_NUMBER_TEXT];
+
+        for (unsigned cpu = 0; cpu < cpus.size(); ++cpu)
+        {
+            if (!cpus[cpu])
+                continue;
+
+            unsigned last = cpu;
+            while ((last + 1 < cpus.size()) && cpus[last + 1])
+                ++last;
+
+            if (last == cpu)
+                snprintf(range, sizeof(range), "%s%u",
+                         list.empty() ? "" : ",", cpu);
+            else
+                snprintf(range, sizeof(range), "%s%u-%u",
+                         list.empty() ? "" : ",", cpu, last);
+            list += range;
+            cpu = last;
+        }
+
+        return list;
+    }
+
+    // What default_smp_affinity wants: hex, 32 bits at a time, high first.
+    std::string
+    format_mask(const cpu_flags_t &cpus)
+    {
+        std::string mask;
+        char word_text[MAX_NUMBER_TEXT];
+
+        unsigned words = (cpus.size() + BITS_PER_WORD - 1) / BITS_PER_WORD;
+        for (unsigned w = words; w-- > 0; )
+        {
+            unsigned long word = 0;
+            for (unsigned bit = 0; bit < BITS_PER_WORD; ++bit)
+            {
+                unsigned cpu = w * BITS_PER_WORD + bit;
+                if ((cpu < cpus.size()) && cpus[cpu])
+                    word |= 1UL << bit;
+            }
+
+            snprintf(word_text, sizeof(word_text), "%s%08lx",
+                     mask.empty() ? "" : ",", word);
+            mask += word_text;
+        }
+
+        return mask;
+    }
+
+    bool
+    any(const cpu_flags_t &cpus)
+    {
+        for (unsigned cpu = 0; cpu < cpus.size(); ++cpu)
+            if (cpus[cpu])
+                return true;
+        return false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor and destructor
+////////////////////////////////////////////////////////////////////////////////
+
+irq_steering::irq_steering(void):
+    cpu_count_(utility::how_many_cpus()),
+    protected_(cpu_count_, false),
+    allowed_(),
+    saved_(),
+    saved_default_()
+{
+}
+
+irq_steering::~irq_steering(void)
+{
+    restore();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////////////////////////
+
+void
+irq_steering::protect(const cpuset &set)
+{
+    const cpu_vector_t &cpus = set.CPUs();
+    for (cpu_vector_t::const_iterator c = cpus.begin(); c != cpus.end(); ++c)
+    {
+        if (*c >= cpu_count_)
+            IRQ_RUNTIME("cpuset '%s' has CPU %u: only %u online",
+                        C(set.name()), *c, cpu_count_);
+        protected_[*c] = true;
+    }
+}
+
+void
+irq_steering::protect(const std::string &cpus)
+{
+    cpu_flags_t more = checked_cpus(cpus);
+    for (unsigned cpu = 0; cpu < cpu_count_; ++cpu)
+        if (more[cpu])
+            protected_[cpu] = true;
+}
+
+/**
+    Takes effect at the next apply().
+*/
+
+void
+irq_steering::allow(irq_t irq, const std::string &cpus)
+{
+    allowed_[irq] = format_cpus(checked_cpus(cpus));
+}
+
+/**
+    An IRQ's original affinity is saved the first time we change it, so
+    calling this more than once still restores to what was there before
+    any of them.
+*/
+
+irq_report_t
+irq_steering::apply(void)
+{
+    if (!any(protected_))
+        IRQ_RUNTIME("no CPUs protected: nothing to steer away from");
+
+    cpu_flags_t housekeeping(cpu_count_, false);
+    for (unsigned cpu = 0; cpu < cpu_count_; ++cpu)
+        housekeeping[cpu] = !protected_[cpu];
+    if (!any(housekeeping))
+        IRQ_RUNTIME("every CPU is protected: nowhere left for IRQs");
+
+    irq_report_t report;
+    report.moved = 0;
+    report.allowed = 0;
+    report.untouched = 0;
+
+    irq_vector_t irqs(list_irqs());
+    for (irq_vector_t::const_iterator i = irqs.begin(); i != irqs.end(); ++i)
+    {
+        std::string current(read_text(affinity_path(*i)));
+        if (current.empty())
+            continue;               // gone, or no affinity to speak of
+
+        std::string target;
+        affinity_map_t::const_iterator a = allowed_.find(*i);
+        if (a != allowed_.end())
+        {
+            target = a->second;
+        }
+        else
+        {
+            cpu_flags_t cpus;
+            if (!parse_cpus(current, cpu_count_, false, &cpus))
+            {
+                IRQ_DP(DEBUG_1, "IRQ %u: can't make sense of '%s'\n", *i,
+                       C(current));
+                continue;
+            }
+
+            bool clash = false;
+            for (unsigned cpu = 0; cpu < cpu_count_; ++cpu)
+            {
+                if (cpus[cpu] && protected_[cpu])
+                {
+                    cpus[cpu] = false;
+                    clash = true;
+                }
+            }
+
+            if (!clash)
+            {
+                ++report.untouched;
+                continue;
+            }
+
+            target = format_cpus(any(cpus) ? cpus : housekeeping);
+        }
+
+        bool first_time = (saved_.count(*i) == 0);
+        if (first_time)
+            saved_[*i] = current;
+
+        int error;
+        if (set_affinity(*i, target, &error))
+        {
+            if (a != allowed_.end())
+                ++report.allowed;
+            else
+                ++report.moved;
+        }
+        else
+        {
+            IRQ_DP(DEBUG_1, "IRQ %u: can't go to %s: %s\n", *i, C(target),
+                   strerror(error));
+            report.unmovable.push_back(*i);
+            if (first_time)
+                saved_.erase(*i);
+        }
+    }
+
+    set_default_affinity(housekeeping);
+
+    IRQ_CPRINT("IRQs: %u moved, %u allowed, %u already clear, %lu unmovable\n",
+               report.moved, report.allowed, report.untouched,
+               (unsigned long)report.unmovable.size());
+
+    return report;
+}
+
+/**
+    Never throws: the destructor uses it.  IRQs that have gone away since
+    (a module unloaded) are just skipped.
+*/
+
+void
+irq_steering::restore(void)
+{
+    for (affinity_map_t::const_iterator s = saved_.begin();
+         s != saved_.end(); ++s)
+    {
+        int error;
+        if (!set_affinity(s->first, s->second, &error) && (error != ENOENT))
+        {
+            errno = error;
+            IRQ_REPORT("couldn't restore IRQ %u to %s", s->first,
+                       C(s->second));
+        }
+    }
+    saved_.clear();
+
+    if (!saved_default_.empty())
+    {
+        int error = write_text(DEFAULT_AFFINITY, saved_default_);
+        if (error)
+        {
+            errno = error;
+            IRQ_REPORT("couldn't restore '%s'", C(DEFAULT_AFFINITY));
+        }
+        saved_default_.clear();
+    }
+}
+
+/**
+    The first column of /proc/interrupts is the IRQ number, or a name for
+    the architecture's own (NMI, LOC, ...), which aren't steerable.
+*/
+
+irq_vector_t
+irq_steering::list_irqs(void)
+{
+    std::string text(read_text(ISC::PROC_INTERRUPTS));
+    if (text.empty())
+        IRQ_ERROR("couldn't read '%s'", C(ISC::PROC_INTERRUPTS));
+
+    irq_vector_t irqs;
+    std::string::size_type line = text.find('\n');     // skip CPU header
+    while (line != std::string::npos)
+    {
+        const char *p = C(text) + line + 1;
+        char *end;
+        unsigned long irq = strtoul(p, &end, 10);
+        if ((end != p) && (*end == ':'))
+            irqs.push_back(irq);
+
+        line = text.find('\n', line + 1);
+    }
+
+    return irqs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal
+////////////////////////////////////////////////////////////////////////////////
+
+cpu_flags_t
+irq_steering::checked_cpus(const std::string &list) const
+{
+    cpu_flags_t cpus;
+    if (!parse_cpus(list, cpu_count_, true, &cpus) || !any(cpus))
+        IRQ_RUNTIME("bad CPU list '%s' (%u CPUs online)", C(list), cpu_count_);
+    return cpus;
+}
+
+bool
+irq_steering::set_affinity(irq_t irq, const std::string &list, int *error)
+{
+    *error = write_text(affinity_path(irq), list);
+    return !*error;
+}
+
+/**
+    Not fatal if it can't be set: the IRQs that exist now are what
+    matter most.
+*/
+
+void
+irq_steering::set_default_affinity(const cpu_flags_t &cpus)
+{
+    if (saved_default_.empty())
+        saved_default_ = read_text(DEFAULT_AFFINITY);
+
+    int error = write_text(DEFAULT_AFFINITY, format_mask(cpus));
+    if (error)
+    {
+        errno = error;
+        IRQ_REPORT("couldn't set '%s': new IRQs may land on protected CPUs",
+                   C(DEFAULT_AFFINITY));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+////////////////////////////////////////////////////////////////////////////////
+
+std::ostream &
+irq_steering_types::operator <<(std::ostream &o, const irq_report_t &r)
+{
+    o << r.moved << " IRQs moved, " << r.allowed << " allowed, "
+      << r.untouched << " already clear";
+
+    if (!r.unmovable.empty())
+    {
+        o << ", unmovable:";
+        for (irq_vector_t::const_iterator i = r.unmovable.begin();
+             i != r.unmovable.end(); ++i)
+            o << " " << *i;
+    }
+
+    return o;
+}
+
+#undef IRQ_NAME
+#undef IRQ_MODULE
+#undef IRQ_CPRINT
+#undef IRQ_VPRINT
+#undef IRQ_WARNING
+#undef IRQ_ERROR
+#undef IRQ_RUNTIME
+#undef IRQ_REPORT
+#undef IRQ_DP
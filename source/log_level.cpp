@@ -0,0 +1,290 @@
+#include "log_level.h"
+
+#include <ostream>
+#include <utility>                  // std::pair
+#include <vector>
+
+#include <errno.h>
+#include <stdlib.h>                 // getenv(), strtol()
+#include <string.h>                 // memset()
+
+#include "program_IO.h"
+
+namespace log_level_name
+{
+    const std::string NAME("log_level");
+    log_module MODULE(NAME);
+}
+
+#define LL_NAME log_level_name::NAME
+#define LL_MODULE log_level_name::MODULE
+#define LL_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(LL_MODULE, LL_NAME, fmt, ## args)
+#define LL_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(LL_MODULE, LL_NAME, fmt, ## args)
+#define LL_WARNING(fmt, args...) WARNING_WITH_NAME(LL_NAME, fmt, ## args)
+#define LL_ERROR(fmt, args...) ERROR_WITH_NAME(LL_NAME, fmt, ## args)
+#define LL_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(LL_NAME, fmt, ## args)
+#define LL_REPORT(fmt, args...) REPORT_WITH_NAME(LL_NAME, fmt, ## args)
+#define LL_DP(level, fmt, args...) DP_WITH_MODULE(LL_MODULE, level, LL_NAME, fmt, ## args)
+
+namespace
+{
+#if DEBUG_ON
+    const int DEFAULT_LEVEL = DEBUG_0;
+#else
+    const int DEFAULT_LEVEL = LLC::LOG_OFF;
+#endif
+
+    // Plain zero-initialized data, so it's good before any constructor
+    // runs: modules in other files may register before this one's static
+    // initialization has happened.
+    log_module * volatile module_list = 0;
+
+    volatile int louder_signal = SIGUSR1;
+
+    typedef std::pair<std::string, int> setting_t;
+    typedef std::vector<setting_t> settings_t;
+
+    int
+    clamp(int level)
+    {
+        if (level < LLC::LOG_OFF)
+            return LLC::LOG_OFF;
+        if (level > LLC::MAX_LEVEL)
+            return LLC::MAX_LEVEL;
+        return level;
+    }
+
+    bool
+    matches(const std::string &pattern, const char *name)
+    {
+        if (pattern == LLC::ALL)
+            return true;
+
+        std::string::size_type length = pattern.size();
+        if (length && (pattern[length - 1] == '*'))
+            return !pattern.compare(0, length - 1, name, 0, length - 1)
+                   && (strlen(name) >= length - 1);
+
+        return pattern == name;
+    }
+
+    /**
+        "name=level,name=level".  Spaces around either side are dropped,
+        since module names have them in the middle ("scheduler utils") and
+        people will put them around the commas too.
+    */
+
+    std::string
+    trim(const std::string &s)
+    {
+        std::string::size_type first = s.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            return std::string();
+        std::string::size_type last = s.find_last_not_of(" \t");
+        return s.substr(first, last - first + 1);
+    }
+
+    bool
+    parse(const std::string &spec, settings_t &settings, std::string &bad)
+    {
+        std::string::size_type start = 0;
+        while (start <= spec.size())
+        {
+            std::string::size_type comma = spec.find(',', start);
+            if (comma == std::string::npos)
+                comma = spec.size();
+
+            std::string entry = trim(spec.substr(start, comma - start));
+            start = comma + 1;
+            if (entry.empty())
+                continue;
+
+            std::string::size_type equals = entry.find('=');
+            std::string name = trim(entry.substr(0, equals));
+            std::string value = (equals == std::string::npos)
+                                ? std::string()
+                                : trim(entry.substr(equals + 1));
+
+            char *end;
+            errno = 0;
+            long level = strtol(C(value), &end, 10);
+            if (name.empty() || value.empty() || *end || errno
+                || (level < LLC::LOG_OFF) || (level > LLC::MAX_LEVEL))
+            {
+                bad = entry;
+                return false;
+            }
+
+            settings.push_back(setting_t(name, level));
+        }
+
+        return true;
+    }
+
+    /**
+        Runs during static initialization, possibly before std::cout is
+        usable, so a bad environment variable just gets ignored here;
+        configure() with the same string will say what's wrong with it.
+    */
+
+    int
+    environment_level(const char *name)
+    {
+        int level = DEFAULT_LEVEL;
+
+        const char *spec = getenv(LLC::ENVIRONMENT);
+        if (!spec)
+            return level;
+
+        int saved_errno = errno;
+        settings_t settings;
+        std::string bad;
+        if (parse(spec, settings, bad))
+        {
+            for (size_t i = 0; i < settings.size(); ++i)
+                if (matches(settings[i].first, name))
+                    level = settings[i].second;
+        }
+        errno = saved_errno;
+
+        return level;
+    }
+
+    void
+    signal_handler(int signal)
+    {
+        int delta = (signal == louder_signal) ? 1 : -1;
+        for (log_module *m = module_list; m; m = m->next())
+            m->adjust(delta);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// log_module
+////////////////////////////////////////////////////////////////////////////////
+
+log_module::log_module(const std::string &name):
+    level_(environment_level(name.c_str())),
+    name_(name.c_str()),
+    next_(0)
+{
+    // Pushed onto the front; 'next_' is set before we're visible, so
+    // walkers (a signal handler, say) never see a half-linked module.
+    log_module *head;
+    do
+    {
+        head = module_list;
+        next_ = head;
+    } while (!__sync_bool_compare_and_swap(&module_list, head, this));
+}
+
+void
+log_module::set_level(int level)
+{
+    level_ = clamp(level);
+}
+
+void
+log_module::adjust(int delta)
+{
+    int old_level;
+    do
+    {
+        old_level = level_;
+    } while (!__sync_bool_compare_and_swap(&level_, old_level,
+                                           clamp(old_level + delta)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// log_level
+////////////////////////////////////////////////////////////////////////////////
+
+log_module *
+log_level::modules(void)
+{
+    return module_list;
+}
+
+unsigned int
+log_level::set(const std::string &name, int level)
+{
+    unsigned int count = 0;
+    for (log_module *m = module_list; m; m = m->next())
+    {
+        if (matches(name, m->name()))
+        {
+            m->set_level(level);
+            ++count;
+        }
+    }
+
+    LL_DP(DEBUG_1, "'%s' set to %d: %u modules\n", C(name), level, count);
+    return count;
+}
+
+void
+log_level::set_all(int level)
+{
+    set(LLC::ALL, level);
+}
+
+int
+log_level::get(const std::string &name)
+{
+    for (log_module *m = module_list; m; m = m->next())
+        if (name == m->name())
+            return m->level();
+
+    LL_RUNTIME("no module named '%s'\n", C(name));
+    return LLC::LOG_OFF;                    // not reached
+}
+
+void
+log_level::configure(const std::string &spec)
+{
+    settings_t settings;
+    std::string bad;
+    if (!parse(spec, settings, bad))
+        LL_RUNTIME("bad setting '%s': want name=level, level %d to %d\n",
+                   C(bad), LLC::LOG_OFF, LLC::MAX_LEVEL);
+
+    for (size_t i = 0; i < settings.size(); ++i)
+        if (!set(settings[i].first, settings[i].second))
+            LL_WARNING("'%s' doesn't match any module\n",
+                       C(settings[i].first));
+}
+
+void
+log_level::list(std::ostream &out)
+{
+    for (log_module *m = module_list; m; m = m->next())
+        out << m->name() << ' ' << m->level() << '\n';
+}
+
+void
+log_level::install_signal_control(int louder, int quieter)
+{
+    louder_signal = louder;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaddset(&action.sa_mask, louder);
+    sigaddset(&action.sa_mask, quieter);
+
+    if (sigaction(louder, &action, 0) || sigaction(quieter, &action, 0))
+        LL_ERROR("installing handlers for signals %d and %d",
+                 louder, quieter);
+}
+
+#undef LL_NAME
+#undef LL_MODULE
+#undef LL_CPRINT
+#undef LL_VPRINT
+#undef LL_WARNING
+#undef LL_ERROR
+#undef LL_RUNTIME
+#undef LL_REPORT
+#undef LL_DP
@@ -0,0 +1,347 @@
+#include "memory_budget.h"
+
+#include <errno.h>
+#include <fcntl.h>                  // open()
+#include <poll.h>
+#include <stdio.h>                  // snprintf()
+#include <stdlib.h>                 // strtoull()
+#include <string.h>
+#include <sys/stat.h>               // mkdir()
+#include <unistd.h>                 // rmdir(), write()
+
+#include "program_IO.h"
+
+namespace memory_budget_name
+{
+    const std::string NAME("memory_budget");
+    log_module MODULE(NAME);
+}
+
+#define MB_NAME memory_budget_name::NAME
+#define MB_MODULE memory_budget_name::MODULE
+#define MB_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(MB_MODULE, MB_NAME, fmt, ## args)
+#define MB_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(MB_MODULE, MB_NAME, fmt, ## args)
+#define MB_WARNING(fmt, args...) WARNING_WITH_NAME(MB_NAME, fmt, ## args)
+#define MB_ERROR(fmt, args...) ERROR_WITH_NAME(MB_NAME, fmt, ## args)
+#define MB_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(MB_NAME, fmt, ## args)
+#define MB_REPORT(fmt, args...) REPORT_WITH_NAME(MB_NAME, fmt, ## args)
+#define MB_DP(level, fmt, args...) DP_WITH_MODULE(MB_MODULE, level, MB_NAME, fmt, ## args)
+
+namespace
+{
+    enum
+    {
+        MAX_NUMBER_TEXT = 32,
+        MAX_TRIGGER_TEXT = 64
+    };
+
+    const std::string ENABLE_MEMORY("+memory");
+
+    /**
+        cgroup files want the whole value in one write().  Returns 0 or the
+        errno; doesn't allocate, so try_add_task() can use it.
+    */
+
+    int
+    write_text(const char *path, const char *text, size_t length)
+    {
+        int fd = open(path, O_WRONLY);
+        if (fd < 0)
+            return errno;
+
+        ssize_t ret;
+        do
+        {
+            ret = write(fd, text, length);
+        } while ((ret < 0) && (errno == EINTR));
+
+        int saved_errno = errno;
+        close(fd);
+
+        if (ret != static_cast<ssize_t>(length))
+            return (ret < 0) ? saved_errno : EIO;
+        return 0;
+    }
+
+    int
+    write_text(const std::string &path, const std::string &text)
+    {
+        return write_text(C(path), C(text), text.size());
+    }
+
+    // Empty if it can't be read.
+    std::string
+    read_text(const std::string &path)
+    {
+        std::string text;
+        int fd = open(C(path), O_RDONLY);
+        if (fd < 0)
+            return text;
+
+        char buffer[256];
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+            text.append(buffer, got);
+        close(fd);
+        return text;
+    }
+
+    std::string
+    limit_text(uint64_t bytes)
+    {
+        if (bytes == MBC::UNLIMITED)
+            return "max";
+
+        char digits[MAX_NUMBER_TEXT];
+        snprintf(digits, sizeof(digits), "%llu", (unsigned long long)bytes);
+        return digits;
+    }
+
+    void
+    make_group(const std::string &path)
+    {
+        if (mkdir(C(path), 0755) && (errno != EEXIST))
+            MB_ERROR("couldn't create cgroup '%s'", C(path));
+    }
+
+    // So that children of 'path' get memory.max and friends.
+    void
+    enable_memory(const std::string &path)
+    {
+        std::string control(path + "cgroup.subtree_control");
+        int err = write_text(control, ENABLE_MEMORY);
+        if (err)
+        {
+            errno = err;
+            MB_ERROR("couldn't enable the memory controller in '%s'",
+                     C(control));
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// memory_budget
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    cgroup v2 only allows controllers to be enabled for a group's children
+    if the group itself has no tasks (the root excepted), so <base> is
+    just a container: the tasks go in the groups under it.
+*/
+
+memory_budget::memory_budget(const std::string &name, const std::string &base):
+    name_(name),
+    path_(MBC::CGROUP_ROOT + base + "/" + name + "/"),
+    procs_path_(path_ + "cgroup.procs")
+{
+    if (name.empty() || (name.find('/') != std::string::npos))
+        MB_RUNTIME("bad memory budget name '%s'", C(name));
+
+    std::string controllers(read_text(MBC::CGROUP_ROOT + "cgroup.controllers"));
+    if (controllers.find("memory") == std::string::npos)
+        MB_RUNTIME("no cgroup v2 memory controller under '%s'",
+                   C(MBC::CGROUP_ROOT));
+
+    std::string base_path(MBC::CGROUP_ROOT + base + "/");
+
+    enable_memory(MBC::CGROUP_ROOT);
+    make_group(base_path);
+    enable_memory(base_path);
+    make_group(path_);
+
+    MB_DP(DEBUG_1, "memory budget '%s' at '%s'\n", C(name_), C(path_));
+}
+
+/**
+    rmdir() fails if there are still tasks in the group: they don't get
+    moved anywhere on our say-so, same as with cpusets.
+*/
+
+memory_budget::~memory_budget(void)
+{
+    if (rmdir(C(path_)))
+        MB_REPORT("couldn't remove cgroup '%s': tasks still in it?", C(path_));
+}
+
+/**
+    high first, so that when both come down there's never a moment where
+    high is over max.
+*/
+
+void
+memory_budget::set_limits(uint64_t max_bytes, uint64_t high_bytes)
+{
+    if ((high_bytes != MBC::UNLIMITED) && (high_bytes > max_bytes))
+        MB_RUNTIME("'%s': memory.high %llu over memory.max %llu", C(name_),
+                   (unsigned long long)high_bytes,
+                   (unsigned long long)max_bytes);
+
+    std::string high_path(path_ + "memory.high");
+    int err = write_text(high_path, limit_text(high_bytes));
+    if (!err)
+    {
+        std::string max_path(path_ + "memory.max");
+        err = write_text(max_path, limit_text(max_bytes));
+        if (err)
+        {
+            errno = err;
+            MB_ERROR("couldn't write '%s'", C(max_path));
+        }
+    }
+    else
+    {
+        errno = err;
+        MB_ERROR("couldn't write '%s'", C(high_path));
+    }
+
+    MB_CPRINT("'%s': max %s, high %s\n", C(name_), C(limit_text(max_bytes)),
+              C(limit_text(high_bytes)));
+}
+
+/**
+    cgroup.procs moves the whole process, all its threads.
+*/
+
+status_t
+memory_budget::try_add_task(pid_t process)
+{
+    char digits[3 * sizeof(pid_t) + 2];
+    int length = snprintf(digits, sizeof(digits), "%d\n", process);
+
+    int err = write_text(C(procs_path_), digits, length);
+    if (err)
+        return make_status((err == ESRCH) ? STATUS_NOT_FOUND : STATUS_SYSTEM,
+                           err);
+
+    return status_ok();
+}
+
+void
+memory_budget::add_task(pid_t process)
+{
+    status_t s = try_add_task(process);
+    if (!s.ok())
+    {
+        errno = s.error;
+        MB_ERROR("'%s': failed adding task %d to '%s'", C(name_), process,
+                 C(procs_path_));
+    }
+}
+
+uint64_t
+memory_budget::current_bytes(void) const
+{
+    std::string path(path_ + "memory.current");
+    std::string text(read_text(path));
+    if (text.empty())
+        MB_ERROR("couldn't read '%s'", C(path));
+
+    return strtoull(C(text), 0, 10);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// memory_pressure_monitor
+////////////////////////////////////////////////////////////////////////////////
+
+memory_pressure_monitor::memory_pressure_monitor
+(
+    const memory_budget &budget,
+    uint64_t stall_us,
+    uint64_t window_us,
+    bool full
+):
+    fd_(-1),
+    path_(budget.path() + "memory.pressure")
+{
+    open_trigger(stall_us, window_us, full);
+}
+
+memory_pressure_monitor::memory_pressure_monitor
+(
+    uint64_t stall_us,
+    uint64_t window_us,
+    bool full
+):
+    fd_(-1),
+    path_(MBC::SYSTEM_PRESSURE)
+{
+    open_trigger(stall_us, window_us, full);
+}
+
+memory_pressure_monitor::~memory_pressure_monitor(void)
+{
+    if ((fd_ >= 0) && close(fd_))
+        MB_REPORT("close() of '%s' failed", C(path_));
+}
+
+/**
+    The trigger lives as long as the fd it was written to.  The kernel
+    wants the terminating NUL too.
+*/
+
+void
+memory_pressure_monitor::open_trigger(uint64_t stall_us,
+                                      uint64_t window_us,
+                                      bool full)
+{
+    if (!stall_us || (stall_us > window_us))
+        MB_RUNTIME("stall of %llu us doesn't fit a %llu us window",
+                   (unsigned long long)stall_us,
+                   (unsigned long long)window_us);
+
+    char trigger[MAX_TRIGGER_TEXT];
+    int length = snprintf(trigger, sizeof(trigger), "%s %llu %llu",
+                          full ? "full" : "some",
+                          (unsigned long long)stall_us,
+                          (unsigned long long)window_us);
+
+    fd_ = open(C(path_), O_RDWR | O_NONBLOCK);
+    if (fd_ < 0)
+        MB_ERROR("couldn't open '%s': kernel without PSI?", C(path_));
+
+    if (write(fd_, trigger, length + 1) < 0)
+    {
+        int err = errno;
+        close(fd_);
+        fd_ = -1;
+        errno = err;
+        MB_ERROR("'%s' refused trigger '%s' (window not a multiple of 2 s "
+                 "and no CAP_SYS_RESOURCE?)", C(path_), trigger);
+    }
+
+    MB_DP(DEBUG_1, "'%s': trigger '%s'\n", C(path_), trigger);
+}
+
+/**
+    POLLERR means the group went away underneath us.  A signal counts as
+    a timeout.
+*/
+
+bool
+memory_pressure_monitor::wait(int timeout_ms)
+{
+    struct pollfd p = { fd_, POLLPRI, 0 };
+
+    int ret = poll(&p, 1, timeout_ms);
+    if (ret < 0)
+    {
+        if (errno == EINTR)
+            return false;
+        MB_ERROR("poll() on '%s' failed", C(path_));
+    }
+
+    if (p.revents & POLLERR)
+        MB_RUNTIME("'%s' is gone", C(path_));
+
+    return (p.revents & POLLPRI) != 0;
+}
+
+#undef MB_NAME
+#undef MB_MODULE
+#undef MB_CPRINT
+#undef MB_VPRINT
+#undef MB_WARNING
+#undef MB_ERROR
+#undef MB_RUNTIME
+#undef MB_REPORT
+#undef MB_DP
@@ -0,0 +1,86 @@
+#include "program_IO.h"
+
+#include <string.h>             // strlen()
+#include <time.h>               // clock_gettime()
+
+#include "async_log.h"
+
+/**
+    Where every program_IO macro ends up.  With the async backend running
+    the text gets queued; otherwise it goes straight to std::cout, which is
+    what the macros always did.
+
+    errno is put back the way it was, since report_error() callers may
+    still want to look at it afterwards.
+*/
+
+void
+program_output(log_kind_t kind, const char *text)
+{
+    int saved_errno = errno;
+
+    if (!async_log::submit(kind, text, strlen(text)))
+        std::cout << text << std::flush;
+
+    errno = saved_errno;
+}
+
+/**
+    The GCRA form of a token bucket: 'next_allowed' is when the bucket
+    would be full again if nothing else happened.  A message is allowed if
+    that's no more than the burst's worth of periods in the future, and
+    pushes it on by one period.  Only the CAS winner gets to print.
+*/
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    #define LIMIT_CLOCK CLOCK_MONOTONIC_COARSE  // vDSO, no syscall
+#else
+    #define LIMIT_CLOCK CLOCK_MONOTONIC
+#endif
+
+bool
+log_limit(log_limiter *limiter, unsigned long *suppressed)
+{
+    const long long period = LOG_LIMIT_PERIOD_MS * 1000000LL;
+    const long long tolerance = (LOG_LIMIT_BURST - 1) * period;
+
+    int saved_errno = errno;
+    struct timespec ts;
+    clock_gettime(LIMIT_CLOCK, &ts);
+    errno = saved_errno;
+
+    long long now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    for ( ; ; )
+    {
+        long long next = limiter->next_allowed;
+        long long start = (next > now) ? next : now;
+
+        if (start - now > tolerance)
+        {
+            __sync_fetch_and_add(&limiter->suppressed, 1);
+            return false;
+        }
+
+        if (__sync_bool_compare_and_swap(&limiter->next_allowed, next,
+                                         start + period))
+        {
+            break;
+        }
+    }
+
+    *suppressed = __sync_lock_test_and_set(&limiter->suppressed, 0);
+    return true;
+}
+
+#undef LIMIT_CLOCK
+
+void
+log_suppressed(log_kind_t kind, const char *file, const char *function,
+               int line, unsigned long count)
+{
+    char Q[DEFAULT_BUFFER_SIZE];
+    snprintf(Q, sizeof(Q), "%s:%s:%d: %lu similar messages suppressed\n",
+             file, function, line, count);
+    program_output(kind, Q);
+}
@@ -2,25 +2,56 @@
 #include "program_IO.h"
 #include "utility.h"
 
+#include <errno.h>
+#include <time.h>                   // clock_gettime()
+
 namespace pthread_nap_name
 {
     const std::string NAME("pthread_nap");
+    log_module MODULE(NAME);
 }
 
 #define PN_NAME pthread_nap_name::NAME
-#define PN_CPRINT(fmt, args...)  CPRINT_WITH_NAME(PN_NAME, fmt, ## args)
-#define PN_VPRINT(fmt, args...)  VPRINT_WITH_NAME(PN_NAME, fmt, ## args)
+#define PN_MODULE pthread_nap_name::MODULE
+#define PN_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(PN_MODULE, PN_NAME, fmt, ## args)
+#define PN_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(PN_MODULE, PN_NAME, fmt, ## args)
 #define PN_WARNING(fmt, args...) WARNING_WITH_NAME(PN_NAME, fmt, ## args)
 #define PN_ERROR(fmt, args...) ERROR_WITH_NAME(PN_NAME, fmt, ## args)
 #define PN_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(PN_NAME, fmt, ## args)
 #define PN_REPORT(fmt, args...) REPORT_WITH_NAME(PN_NAME, fmt, ## args)
-#define PN_DP(level, fmt, args...) DP(level, PN_NAME, fmt, ## args)
+#define PN_WARNING_LIMITED(fmt, args...) WARNING_LIMITED_WITH_NAME(PN_NAME, fmt, ## args)
+#define PN_REPORT_LIMITED(fmt, args...) REPORT_LIMITED_WITH_NAME(PN_NAME, fmt, ## args)
+#define PN_DP(level, fmt, args...) DP_WITH_MODULE(PN_MODULE, level, PN_NAME, fmt, ## args)
 
 #define PN_LOCK(mutex) LOCK(mutex,PN_ERROR)
 #define PN_UNLOCK(mutex) UNLOCK(mutex,PN_ERROR)
 
 
-pthread_nap::pthread_nap(const std::string &name):
+namespace
+{
+    enum
+    {
+        NANOS_PER_SECOND = 1000000000
+    };
+}
+
+/**
+    'protocol' and 'ceiling' pick how the internal mutex treats priorities:
+    see utility::init_mutex().  If a SCHED_FIFO thread is going to block()
+    while plain SCHED_OTHER threads call wake_up(), then use
+    MUTEX_PRIO_INHERIT, or the waker can get preempted while holding the
+    lock and leave the RT thread stuck behind it.
+
+    The condition variable always runs off CLOCK_MONOTONIC so that
+    timed_block() isn't thrown around by somebody setting the date.
+*/
+
+pthread_nap::pthread_nap
+(
+    const std::string &name,
+    utility::mutex_protocol_t protocol,
+    int ceiling
+):
     name_(name),
     cond_(new pthread_cond_t()),
     cond_mutex_(new pthread_mutex_t()),
@@ -28,13 +59,25 @@ pthread_nap::pthread_nap(const std::string &name):
 {
     int ret;
 
-    ret = pthread_mutex_init(cond_mutex_, 0);
+    ret = utility::init_mutex(cond_mutex_, protocol, ceiling);
     if (ret)
+    {
+        errno = ret;
         PN_ERROR("Error creating cond var mutex '%s'", C(name_));
+    }
 
-    ret = pthread_cond_init(cond_, 0);
+    pthread_condattr_t attr;
+    ret = pthread_condattr_init(&attr);
+    if (!ret)
+        ret = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (!ret)
+        ret = pthread_cond_init(cond_, &attr);
+    pthread_condattr_destroy(&attr);
     if (ret)
+    {
+        errno = ret;
         PN_ERROR("Error creating cond variable '%s'", C(name_));
+    }
 }
 
 pthread_nap::~pthread_nap(void)
@@ -43,11 +86,17 @@ pthread_nap::~pthread_nap(void)
 
     ret = pthread_mutex_destroy(cond_mutex_);
     if (ret)
-        PN_REPORT("Cannot destroy cond var mutex '%s'", C(name_));
+    {
+        errno = ret;
+        PN_REPORT_LIMITED("Cannot destroy cond var mutex '%s'", C(name_));
+    }
 
     ret = pthread_cond_destroy(cond_);
     if (ret)
-        PN_REPORT("Cannot destroy cond var '%s'", C(name_));
+    {
+        errno = ret;
+        PN_REPORT_LIMITED("Cannot destroy cond var '%s'", C(name_));
+    }
 
     delete cond_;
     delete cond_mutex_;
@@ -65,10 +114,52 @@ pthread_nap::block(void)
         if (ret)
             PN_ERROR("pthread_cond_wait for '%s'", C(name_));
     }
+    wake_up_ = 0;
     PN_UNLOCK(cond_mutex_);
 
 //  PN_CPRINT("'%s': woke up\n", C(name_));
+}
+
+/**
+    Like block(), but give up after 'seconds'.  Returns true if we were
+    woken up, false if we timed out.
+*/
+
+bool
+pthread_nap::timed_block(double seconds)
+{
+    struct timespec deadline;
+    if (clock_gettime(CLOCK_MONOTONIC, &deadline))
+        PN_ERROR("clock_gettime for '%s'", C(name_));
+
+    long whole = static_cast<long>(seconds);
+    deadline.tv_sec += whole;
+    deadline.tv_nsec += static_cast<long>((seconds - whole) * NANOS_PER_SECOND);
+    if (deadline.tv_nsec >= NANOS_PER_SECOND)
+    {
+        deadline.tv_nsec -= NANOS_PER_SECOND;
+        ++deadline.tv_sec;
+    }
+
+    bool woke;
+    PN_LOCK(cond_mutex_);
+    while (!wake_up_)
+    {
+        int ret = pthread_cond_timedwait(cond_, cond_mutex_, &deadline);
+        if (ret == ETIMEDOUT)
+            break;
+        if (ret)
+        {
+            PN_UNLOCK(cond_mutex_);
+            errno = ret;
+            PN_ERROR("pthread_cond_timedwait for '%s'", C(name_));
+        }
+    }
+    woke = wake_up_;
     wake_up_ = 0;
+    PN_UNLOCK(cond_mutex_);
+
+    return woke;
 }
 
 void
@@ -90,12 +181,15 @@ pthread_nap::wake_up(void)
 }
 
 #undef PN_NAME
+#undef PN_MODULE
 #undef PN_CPRINT
 #undef PN_VPRINT
 #undef PN_WARNING
 #undef PN_ERROR
 #undef PN_RUNTIME
 #undef PN_REPORT
+#undef PN_WARNING_LIMITED
+#undef PN_REPORT_LIMITED
 #undef PN_DP
 #undef PN_LOG
 #undef PN_LOCK 
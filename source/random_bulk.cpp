@@ -0,0 +1,377 @@
+#include "random_utilities.h"
+
+#include <string.h>                 // memcpy()
+
+#if defined(__i386__) || defined(__x86_64__)
+    #define RANDOM_BULK_X86
+    #include <immintrin.h>          // AVX2 and SSE2, whatever -march says
+#endif
+
+/**
+    Bulk fills for random_engine.  Calling get_random() for each value of a
+    multi-megabyte buffer costs a call (and with RAND48, a libc call) per
+    value; these crank out whole blocks at a time instead.
+
+    The generator is RANDOM_LANES (4) xoshiro256** streams run in lock
+    step.  xoshiro only needs shifts, xors, ors and adds (the * 5 and * 9
+    become shift-and-add), all of which SSE2 and AVX2 have for 64-bit
+    lanes, so:
+
+        AVX2:   all 4 lanes in one register
+        SSE2:   2 registers of 2 lanes
+        else:   a plain loop over the lanes, which gcc may vectorize anyway
+
+    The SIMD versions are compiled for their instruction set whatever the
+    Makefile's -march is (the library is built for athlon, which has
+    neither), and the first fill picks the best one the CPU it's running
+    on has, with __builtin_cpu_supports().  Off x86 it's always the plain
+    loop.  All three give exactly the same numbers.
+
+    Everything is generated into a small stack buffer of raw 64-bit words
+    and then converted into the caller's type.
+*/
+
+namespace
+{
+    enum
+    {
+        BLOCK_WORDS = 256   // 64-bit words generated per trip (multiple of lanes)
+    };
+
+    const double TWO_TO_MINUS_53 = 1.0 / 9007199254740992.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The lanes
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // random_engine::lanes_, word-major
+    typedef uint64_t lane_state_t[random_utilities::RANDOM_LANES];
+
+    // 'n' must be a multiple of RANDOM_LANES.  Output is lane-interleaved:
+    // out[0..3] is step 0 of lanes 0..3, and so on.
+    typedef void (*lanes_function_t)(lane_state_t *lanes, uint64_t *out,
+                                     size_t n);
+
+    inline uint64_t
+    rotl64(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    void
+    lanes_plain(lane_state_t *lanes, uint64_t *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i += random_utilities::RANDOM_LANES)
+        {
+            for (unsigned int lane = 0; lane < random_utilities::RANDOM_LANES;
+                 ++lane)
+            {
+                uint64_t s0 = lanes[0][lane];
+                uint64_t s1 = lanes[1][lane];
+                uint64_t s2 = lanes[2][lane];
+                uint64_t s3 = lanes[3][lane];
+
+                out[i + lane] = rotl64(s1 * 5, 7) * 9;
+
+                uint64_t t = s1 << 17;
+                s2 ^= s0;
+                s3 ^= s1;
+                s1 ^= s2;
+                s0 ^= s3;
+                s2 ^= t;
+                s3 = rotl64(s3, 45);
+
+                lanes[0][lane] = s0;
+                lanes[1][lane] = s1;
+                lanes[2][lane] = s2;
+                lanes[3][lane] = s3;
+            }
+        }
+    }
+
+#ifdef RANDOM_BULK_X86
+
+    __attribute__((target("avx2"))) inline __m256i
+    rotl256(__m256i x, int k)
+    {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k),
+                               _mm256_srli_epi64(x, 64 - k));
+    }
+
+    __attribute__((target("avx2"))) void
+    lanes_avx2(lane_state_t *lanes, uint64_t *out, size_t n)
+    {
+        __m256i s0 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes[0]));
+        __m256i s1 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes[1]));
+        __m256i s2 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes[2]));
+        __m256i s3 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes[3]));
+
+        for (size_t i = 0; i < n; i += random_utilities::RANDOM_LANES)
+        {
+            __m256i x = _mm256_add_epi64(s1, _mm256_slli_epi64(s1, 2)); // * 5
+            x = rotl256(x, 7);
+            x = _mm256_add_epi64(x, _mm256_slli_epi64(x, 3));          // * 9
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), x);
+
+            __m256i t = _mm256_slli_epi64(s1, 17);
+            s2 = _mm256_xor_si256(s2, s0);
+            s3 = _mm256_xor_si256(s3, s1);
+            s1 = _mm256_xor_si256(s1, s2);
+            s0 = _mm256_xor_si256(s0, s3);
+            s2 = _mm256_xor_si256(s2, t);
+            s3 = rotl256(s3, 45);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[0]), s0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[1]), s1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[2]), s2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[3]), s3);
+    }
+
+    __attribute__((target("sse2"))) inline __m128i
+    rotl128(__m128i x, int k)
+    {
+        return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k));
+    }
+
+    // One xoshiro256** step for two lanes.
+    __attribute__((target("sse2"))) inline __m128i
+    step128(__m128i &s0, __m128i &s1, __m128i &s2, __m128i &s3)
+    {
+        __m128i x = _mm_add_epi64(s1, _mm_slli_epi64(s1, 2));      // * 5
+        x = rotl128(x, 7);
+        x = _mm_add_epi64(x, _mm_slli_epi64(x, 3));                 // * 9
+
+        __m128i t = _mm_slli_epi64(s1, 17);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = rotl128(s3, 45);
+
+        return x;
+    }
+
+    __attribute__((target("sse2"))) void
+    lanes_sse2(lane_state_t *lanes, uint64_t *out, size_t n)
+    {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[0]));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[1]));
+        __m128i a2 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[2]));
+        __m128i a3 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[3]));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[0] + 2));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[1] + 2));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[2] + 2));
+        __m128i b3 = _mm_loadu_si128(reinterpret_cast<__m128i *>(lanes[3] + 2));
+
+        for (size_t i = 0; i < n; i += random_utilities::RANDOM_LANES)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                             step128(a0, a1, a2, a3));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 2),
+                             step128(b0, b1, b2, b3));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[0]), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[1]), a1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[2]), a2);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[3]), a3);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[0] + 2), b0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[1] + 2), b1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[2] + 2), b2);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[3] + 2), b3);
+    }
+
+#endif  // RANDOM_BULK_X86
+
+    lanes_function_t
+    pick_lanes(void)
+    {
+#ifdef RANDOM_BULK_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return lanes_avx2;
+        if (__builtin_cpu_supports("sse2"))
+            return lanes_sse2;
+#endif
+        return lanes_plain;
+    }
+}
+
+/**
+    Picked on the first call rather than at load time, so engines made by
+    other modules' static constructors still get a working one.
+*/
+
+void
+random_utilities::random_engine::generate_lanes(uint64_t *out, size_t n)
+{
+    static const lanes_function_t run_lanes = pick_lanes();
+    run_lanes(lanes_, out, n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fills
+//
+// When the tail of a request isn't a whole number of blocks we still
+// generate a whole number of lane steps and throw the leftovers away.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    inline size_t
+    round_up_to_lanes(size_t n)
+    {
+        return (n + random_utilities::RANDOM_LANES - 1)
+               & ~static_cast<size_t>(random_utilities::RANDOM_LANES - 1);
+    }
+}
+
+/**
+    Raw words for the fills: off the lanes, or with PHILOX, off the
+    counter (which then moves past them).
+*/
+
+void
+random_utilities::random_engine::generate(uint64_t *out, size_t n)
+{
+    if (generator_ != GENERATOR_PHILOX)
+    {
+        generate_lanes(out, n);
+        return;
+    }
+
+    philox_fill(philox_key_, philox_counter_, out, n);
+    seek(philox_counter_ + n);
+}
+
+/**
+    Top 53 bits of each word, scaled: [0.0, 1.0) with full double
+    resolution.
+*/
+
+void
+random_utilities::random_engine::fill(double *out, size_t n)
+{
+    uint64_t block[BLOCK_WORDS];
+
+    while (n)
+    {
+        size_t count = n < BLOCK_WORDS ? n : BLOCK_WORDS;
+        generate(block, round_up_to_lanes(count));
+
+        for (size_t i = 0; i < count; ++i)
+            out[i] = (block[i] >> 11) * TWO_TO_MINUS_53;
+
+        out += count;
+        n -= count;
+    }
+}
+
+/**
+    Each 64-bit word makes two 32-bit values.
+*/
+
+void
+random_utilities::random_engine::fill(uint32_t *out, size_t n)
+{
+    uint64_t block[BLOCK_WORDS];
+
+    while (n)
+    {
+        size_t count = n < 2 * BLOCK_WORDS ? n : 2 * BLOCK_WORDS;
+        generate(block, round_up_to_lanes((count + 1) / 2));
+        memcpy(out, block, count * sizeof(uint32_t));
+
+        out += count;
+        n -= count;
+    }
+}
+
+/**
+    Values in [0, bound), the same multiply-shift-and-reject way as
+    bounded32(): vectorizable multiply over the whole block, and the odd
+    reject gets redrawn from a few spare lane words.  A 'bound' of 0 means
+    the whole 32-bit range.
+*/
+
+void
+random_utilities::random_engine::fill(uint32_t *out, size_t n, uint32_t bound)
+{
+    fill(out, n);
+    if (!bound)
+        return;
+
+    const uint32_t threshold = -bound % bound;
+    uint64_t spare[RANDOM_LANES];
+    unsigned int spares = 0;        // 32-bit halves left in 'spare'
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t m = static_cast<uint64_t>(out[i]) * bound;
+        while (static_cast<uint32_t>(m) < threshold)
+        {
+            if (!spares)
+            {
+                generate(spare, RANDOM_LANES);
+                spares = 2 * RANDOM_LANES;
+            }
+            --spares;
+            uint32_t x = static_cast<uint32_t>(spare[spares / 2]
+                                               >> (32 * (spares & 1)));
+            m = static_cast<uint64_t>(x) * bound;
+        }
+        out[i] = static_cast<uint32_t>(m >> 32);
+    }
+}
+
+void
+random_utilities::random_engine::fill(byte_vector_t &bytes)
+{
+    uint64_t block[BLOCK_WORDS];
+    size_t n = bytes.size();
+    uint8_t *out = n ? &bytes[0] : 0;
+
+    while (n)
+    {
+        size_t count = n < sizeof(block) ? n : sizeof(block);
+        size_t words = (count + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        generate(block, round_up_to_lanes(words));
+        memcpy(out, block, count);
+
+        out += count;
+        n -= count;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Off the default engine
+////////////////////////////////////////////////////////////////////////////////
+
+void
+random_utilities::fill(double *out, size_t n)
+{
+    default_engine().fill(out, n);
+}
+
+void
+random_utilities::fill(uint32_t *out, size_t n)
+{
+    default_engine().fill(out, n);
+}
+
+void
+random_utilities::fill(uint32_t *out, size_t n, uint32_t bound)
+{
+    default_engine().fill(out, n, bound);
+}
+
+void
+random_utilities::fill(byte_vector_t &bytes)
+{
+    default_engine().fill(bytes);
+}
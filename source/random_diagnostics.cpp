@@ -0,0 +1,566 @@
+#include "random_diagnostics.h"
+
+#include <cmath>
+#include <ostream>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "event_group.h"
+#include "program_IO.h"
+#include "utility.h"            // cpu_relax()
+
+namespace random_diagnostics_name
+{
+    const std::string NAME("random_diagnostics");
+    log_module MODULE(NAME);
+}
+
+#define RDG_NAME random_diagnostics_name::NAME
+#define RDG_MODULE random_diagnostics_name::MODULE
+#define RDG_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(RDG_MODULE, RDG_NAME, fmt, ## args)
+#define RDG_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(RDG_MODULE, RDG_NAME, fmt, ## args)
+#define RDG_WARNING(fmt, args...) WARNING_WITH_NAME(RDG_NAME, fmt, ## args)
+#define RDG_ERROR(fmt, args...) ERROR_WITH_NAME(RDG_NAME, fmt, ## args)
+#define RDG_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(RDG_NAME, fmt, ## args)
+#define RDG_REPORT(fmt, args...) REPORT_WITH_NAME(RDG_NAME, fmt, ## args)
+#define RDG_DP(level, fmt, args...) DP_WITH_MODULE(RDG_MODULE, level, RDG_NAME, fmt, ## args)
+
+using random_utilities::random_engine;
+using random_utilities::quality_report_t;
+using random_utilities::throughput_report_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const double UPPER_001_Z = 3.0902;  // N(0, 1) has 0.1% above this
+
+    enum
+    {
+        BUCKETS = 256,
+        COVERAGE_BITS = 12      // wide types must get within 2^-12 of the ends
+    };
+
+    typedef std::vector<quality_report_t> reports_t;
+
+    /**
+        Upper 0.1% point of chi-square with 'df' degrees of freedom, by
+        Wilson and Hilferty's cube root approximation, which is plenty
+        close enough for df >= 3 or so.
+    */
+
+    double
+    chi_square_limit(unsigned int df)
+    {
+        double a = 2.0 / (9.0 * df);
+        double c = 1.0 - a + UPPER_001_Z * sqrt(a);
+        return df * c * c * c;
+    }
+
+    double
+    chi_square(const std::vector<unsigned long> &counts, unsigned long samples)
+    {
+        double expected = static_cast<double>(samples) / counts.size();
+        double sum = 0.0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            double d = counts[i] - expected;
+            sum += d * d / expected;
+        }
+        return sum;
+    }
+
+    void
+    add(reports_t &reports, const std::string &subject, const char *check,
+        double statistic, double limit, bool passed)
+    {
+        quality_report_t r;
+        r.subject = subject;
+        r.check = check;
+        r.statistic = statistic;
+        r.limit = limit;
+        r.passed = passed;
+        reports.push_back(r);
+    }
+
+    void
+    add_chi_square(reports_t &reports, const std::string &subject,
+                   const std::vector<unsigned long> &counts,
+                   unsigned long samples)
+    {
+        double statistic = chi_square(counts, samples);
+        double limit = chi_square_limit(counts.size() - 1);
+        add(reports, subject, "chi-square", statistic, limit,
+            statistic <= limit);
+    }
+
+    /**
+        get_random<T> is supposed to be flat over [lo, lo + 2^bits).  Work
+        in offsets from 'lo' as uint64_t, which wraps the same way for
+        every T.  Chi-square on the top 8 bits of the offset, then check
+        nothing fell outside the range and that both ends got close.
+    */
+
+    template <typename T>
+    void
+    check_type(random_engine &e, const char *subject, long long lo,
+               unsigned int bits, unsigned long samples, reports_t &reports)
+    {
+        const uint64_t top = (bits == 64) ? ~0ULL : (1ULL << bits) - 1;
+        std::vector<unsigned long> counts(BUCKETS);
+        unsigned long outside = 0;
+        uint64_t smallest = ~0ULL;
+        uint64_t biggest = 0;
+
+        for (unsigned long i = 0; i < samples; ++i)
+        {
+            uint64_t offset = static_cast<uint64_t>(random_utilities::get_random<T>(e))
+                              - static_cast<uint64_t>(lo);
+            if (offset > top)
+            {
+                ++outside;
+                continue;
+            }
+            ++counts[offset >> (bits - 8)];
+            if (offset < smallest)
+                smallest = offset;
+            if (offset > biggest)
+                biggest = offset;
+        }
+
+        add_chi_square(reports, subject, counts, samples - outside);
+        add(reports, subject, "in range", outside, 0, !outside);
+
+        // Small types have to hit both ends exactly.
+        uint64_t slack = (bits <= 16) ? 0 : (top >> COVERAGE_BITS);
+        double covered = (smallest <= biggest)
+                         ? static_cast<double>(biggest - smallest) / top
+                         : 0.0;
+        add(reports, subject, "coverage", covered,
+            1.0 - static_cast<double>(slack) / top,
+            (smallest <= slack) && (biggest >= top - slack));
+    }
+
+    /**
+        Knuth's serial correlation coefficient, TAOCP 3.3.2 K, with the
+        sequence wrapped around.  For independent values it should be
+        within a couple of 1 / sqrt(n) of 0; we allow 4.
+    */
+
+    void
+    check_correlation(random_engine &e, unsigned long samples,
+                      reports_t &reports)
+    {
+        double first = e.erand();
+        double previous = first;
+        double sum = first;
+        double sum_squares = first * first;
+        double sum_products = 0.0;
+
+        for (unsigned long i = 1; i < samples; ++i)
+        {
+            double u = e.erand();
+            sum += u;
+            sum_squares += u * u;
+            sum_products += previous * u;
+            previous = u;
+        }
+        sum_products += previous * first;
+
+        double n = samples;
+        double c = (n * sum_products - sum * sum)
+                   / (n * sum_squares - sum * sum);
+        double limit = 4.0 / sqrt(n);
+        add(reports, "erand()", "correlation", c, limit, fabs(c) <= limit);
+    }
+
+    void
+    check_raw(random_engine &e, unsigned long samples, reports_t &reports)
+    {
+        std::vector<unsigned long> counts(BUCKETS);
+        for (unsigned long i = 0; i < samples; ++i)
+            ++counts[static_cast<unsigned int>(e.erand() * BUCKETS)];
+        add_chi_square(reports, "erand()", counts, samples);
+
+        std::vector<unsigned long> high(BUCKETS);
+        std::vector<unsigned long> low(BUCKETS);
+        for (unsigned long i = 0; i < samples; ++i)
+        {
+            uint64_t x = e.next64();
+            ++high[x >> 56];
+            ++low[x & (BUCKETS - 1)];
+        }
+        add_chi_square(reports, "next64() top bits", high, samples);
+        add_chi_square(reports, "next64() bottom bits", low, samples);
+    }
+
+    /**
+        A small bound, and one near 2^32 where a biased reduction would
+        favour the bottom part of the range by a lot.
+    */
+
+    void
+    check_bounded(random_engine &e, unsigned long samples, reports_t &reports)
+    {
+        std::vector<unsigned long> tens(10);
+        for (unsigned long i = 0; i < samples; ++i)
+            ++tens[e.bounded32(10)];
+        add_chi_square(reports, "bounded32(10)", tens, samples);
+
+        const uint32_t big = 3000000000U;
+        std::vector<unsigned long> thirds(3);
+        for (unsigned long i = 0; i < samples; ++i)
+            ++thirds[e.bounded32(big) / (big / 3)];
+        add_chi_square(reports, "bounded32(3e9)", thirds, samples);
+
+        std::vector<unsigned long> sevens(7);
+        for (unsigned long i = 0; i < samples; ++i)
+            ++sevens[e.bounded64(7)];
+        add_chi_square(reports, "bounded64(7)", sevens, samples);
+    }
+
+    void
+    check_fills(random_engine &e, unsigned long samples, reports_t &reports)
+    {
+        std::vector<double> doubles(samples);
+        e.fill(&doubles[0], samples);
+        std::vector<unsigned long> counts(BUCKETS);
+        for (unsigned long i = 0; i < samples; ++i)
+            ++counts[static_cast<unsigned int>(doubles[i] * BUCKETS)];
+        add_chi_square(reports, "fill(double)", counts, samples);
+
+        std::vector<uint32_t> words(samples);
+        e.fill(&words[0], samples, 10);
+        std::vector<unsigned long> tens(10);
+        unsigned long outside = 0;
+        for (unsigned long i = 0; i < samples; ++i)
+        {
+            if (words[i] < 10)
+                ++tens[words[i]];
+            else
+                ++outside;
+        }
+        add_chi_square(reports, "fill(uint32_t, 10)", tens, samples - outside);
+        add(reports, "fill(uint32_t, 10)", "in range", outside, 0, !outside);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Quality
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<quality_report_t>
+random_utilities::check_quality(generator_t g, unsigned long samples,
+                                uint64_t seed)
+{
+    if (samples < 2)
+        RDG_RUNTIME("need at least 2 samples, not %lu", samples);
+
+    random_engine e(g);
+    e.split(seed, 0, 1);
+
+    reports_t reports;
+
+    check_raw(e, samples, reports);
+    check_correlation(e, samples, reports);
+    check_bounded(e, samples, reports);
+    check_fills(e, samples, reports);
+
+    check_type<signed char>(e, "get_random<signed char>", SCHAR_MIN, 8,
+                            samples, reports);
+    check_type<unsigned char>(e, "get_random<unsigned char>", 0, 8,
+                              samples, reports);
+    check_type<short>(e, "get_random<short>", SHRT_MIN, 16, samples, reports);
+    check_type<unsigned short>(e, "get_random<unsigned short>", 0, 16,
+                               samples, reports);
+    check_type<int>(e, "get_random<int>", INT_MIN, 32, samples, reports);
+    check_type<long>(e, "get_random<long>", LONG_MIN, random_bits<long>::value,
+                     samples, reports);
+    check_type<unsigned int>(e, "get_random<unsigned int>", 0, 32,
+                             samples, reports);
+    check_type<unsigned long>(e, "get_random<unsigned long>", 0,
+                              random_bits<unsigned long>::value,
+                              samples, reports);
+    check_type<long long>(e, "get_random<long long>", LLONG_MIN, 64,
+                          samples, reports);
+    check_type<unsigned long long>(e, "get_random<unsigned long long>", 0, 64,
+                                   samples, reports);
+    check_type<int64_t>(e, "get_random<int64_t>", LLONG_MIN, 64,
+                        samples, reports);
+    check_type<uint64_t>(e, "get_random<uint64_t>", 0, 64, samples, reports);
+
+    return reports;
+}
+
+bool
+random_utilities::all_passed(const std::vector<quality_report_t> &reports)
+{
+    for (size_t i = 0; i < reports.size(); ++i)
+        if (!reports[i].passed)
+            return false;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Throughput
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    enum
+    {
+        FILL_CHUNK = 4096
+    };
+
+    // Runs 'n' draws and folds them into something the compiler can't
+    // throw away.
+    typedef uint64_t (*draw_function_t)(random_engine &e, unsigned long n);
+
+    template <typename T>
+    uint64_t
+    draw_type(random_engine &e, unsigned long n)
+    {
+        uint64_t sink = 0;
+        for (unsigned long i = 0; i < n; ++i)
+            sink ^= static_cast<uint64_t>(random_utilities::get_random<T>(e));
+        return sink;
+    }
+
+    uint64_t
+    draw_erand(random_engine &e, unsigned long n)
+    {
+        double sink = 0.0;
+        for (unsigned long i = 0; i < n; ++i)
+            sink += e.erand();
+        return static_cast<uint64_t>(sink);
+    }
+
+    uint64_t
+    draw_next64(random_engine &e, unsigned long n)
+    {
+        uint64_t sink = 0;
+        for (unsigned long i = 0; i < n; ++i)
+            sink ^= e.next64();
+        return sink;
+    }
+
+    uint64_t
+    draw_bounded(random_engine &e, unsigned long n)
+    {
+        uint64_t sink = 0;
+        for (unsigned long i = 0; i < n; ++i)
+            sink += e.bounded32(1000);
+        return sink;
+    }
+
+    uint64_t
+    draw_fill_double(random_engine &e, unsigned long n)
+    {
+        double buffer[FILL_CHUNK];
+        double sink = 0.0;
+        for (unsigned long done = 0; done < n; done += FILL_CHUNK)
+        {
+            unsigned long count = (n - done < FILL_CHUNK) ? n - done : FILL_CHUNK;
+            e.fill(buffer, count);
+            sink += buffer[count - 1];
+        }
+        return static_cast<uint64_t>(sink);
+    }
+
+    uint64_t
+    draw_fill_uint32(random_engine &e, unsigned long n)
+    {
+        uint32_t buffer[FILL_CHUNK];
+        uint64_t sink = 0;
+        for (unsigned long done = 0; done < n; done += FILL_CHUNK)
+        {
+            unsigned long count = (n - done < FILL_CHUNK) ? n - done : FILL_CHUNK;
+            e.fill(buffer, count);
+            sink ^= buffer[count - 1];
+        }
+        return sink;
+    }
+
+    struct subject_t
+    {
+        const char *name;
+        draw_function_t draw;
+    };
+
+    const subject_t SUBJECTS[] =
+    {
+        {"erand()", draw_erand},
+        {"next64()", draw_next64},
+        {"bounded32(1000)", draw_bounded},
+        {"get_random<signed char>", draw_type<signed char>},
+        {"get_random<unsigned char>", draw_type<unsigned char>},
+        {"get_random<short>", draw_type<short>},
+        {"get_random<unsigned short>", draw_type<unsigned short>},
+        {"get_random<int>", draw_type<int>},
+        {"get_random<long>", draw_type<long>},
+        {"get_random<unsigned int>", draw_type<unsigned int>},
+        {"get_random<unsigned long>", draw_type<unsigned long>},
+        {"get_random<long long>", draw_type<long long>},
+        {"get_random<unsigned long long>", draw_type<unsigned long long>},
+        {"get_random<int64_t>", draw_type<int64_t>},
+        {"get_random<uint64_t>", draw_type<uint64_t>},
+        {"fill(double)", draw_fill_double},
+        {"fill(uint32_t)", draw_fill_uint32}
+    };
+
+    /**
+        Everybody checks in and then sleeps on 'go', so the clock only
+        starts once every thread is up and waiting.
+    */
+
+    struct throughput_job
+    {
+        random_engine engine;
+        draw_function_t draw;
+        unsigned long draws;
+        volatile int *ready;
+        event_group *go;
+        uint64_t sink;
+        pthread_t thread;
+    };
+
+    void *
+    throughput_main(void *arg)
+    {
+        throughput_job *job = static_cast<throughput_job *>(arg);
+
+        int seen = job->go->generation();
+        __sync_fetch_and_add(job->ready, 1);
+        job->go->wait(seen);
+
+        job->sink = job->draw(job->engine, job->draws);
+        return 0;
+    }
+
+    double
+    now(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+    }
+}
+
+std::vector<throughput_report_t>
+random_utilities::measure_throughput(generator_t g, unsigned int threads,
+                                     unsigned long draws)
+{
+    if (!threads)
+        RDG_RUNTIME("need at least one thread");
+
+    std::vector<throughput_job> jobs(threads);
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        jobs[i].engine = random_engine(g);
+        jobs[i].engine.split(1, i, threads);
+    }
+
+    std::vector<throughput_report_t> reports;
+    const unsigned int subjects = sizeof(SUBJECTS) / sizeof(SUBJECTS[0]);
+
+    for (unsigned int s = 0; s < subjects; ++s)
+    {
+        volatile int ready = 0;
+        event_group go("random_diagnostics go");
+
+        unsigned int started = 0;
+        for ( ; started < threads; ++started)
+        {
+            throughput_job &job = jobs[started];
+            job.draw = SUBJECTS[s].draw;
+            job.draws = draws;
+            job.ready = &ready;
+            job.go = &go;
+
+            int ret = pthread_create(&job.thread, 0, throughput_main, &job);
+            if (ret)
+            {
+                errno = ret;
+                RDG_REPORT("couldn't start thread %u of %u: measuring with %u",
+                           started + 1, threads, started);
+                break;
+            }
+        }
+
+        while (ready != static_cast<int>(started))
+            utility::cpu_relax();
+
+        double start = now();
+        go.broadcast();
+
+        for (unsigned int i = 0; i < started; ++i)
+        {
+            int ret = pthread_join(jobs[i].thread, 0);
+            if (ret)
+            {
+                errno = ret;
+                RDG_REPORT("couldn't join thread %u", i);
+            }
+        }
+        double elapsed = now() - start;
+
+        throughput_report_t r;
+        r.subject = SUBJECTS[s].name;
+        r.threads = started;
+        r.values_per_second = (elapsed > 0.0)
+                              ? static_cast<double>(draws) * started / elapsed
+                              : 0.0;
+        reports.push_back(r);
+    }
+
+    return reports;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Printing
+////////////////////////////////////////////////////////////////////////////////
+
+const char *
+random_utilities::generator_name(generator_t g)
+{
+    switch (g)
+    {
+        case GENERATOR_RAND48:      return "rand48";
+        case GENERATOR_XOSHIRO256:  return "xoshiro256**";
+        case GENERATOR_PHILOX:      return "philox4x32-10";
+    }
+    return "unknown";
+}
+
+std::ostream &
+random_utilities::operator <<(std::ostream &o, const quality_report_t &r)
+{
+    o << (r.passed ? "pass " : "FAIL ")
+      << r.subject << ": " << r.check
+      << " = " << r.statistic << " (limit " << r.limit << ")";
+    return o;
+}
+
+std::ostream &
+random_utilities::operator <<(std::ostream &o, const throughput_report_t &r)
+{
+    o << r.subject << ": " << r.values_per_second / 1e6
+      << " M values/s on " << r.threads << " thread"
+      << (r.threads == 1 ? "" : "s");
+    return o;
+}
+
+#undef RDG_NAME
+#undef RDG_MODULE
+#undef RDG_CPRINT
+#undef RDG_VPRINT
+#undef RDG_WARNING
+#undef RDG_ERROR
+#undef RDG_RUNTIME
+#undef RDG_REPORT
+#undef RDG_DP
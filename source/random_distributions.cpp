@@ -0,0 +1,574 @@
+#include "random_distributions.h"
+
+#include <cmath>
+
+#include <pthread.h>
+
+#include "program_IO.h"
+
+namespace random_distributions_name
+{
+    const std::string NAME("random_distributions");
+    log_module MODULE(NAME);
+}
+
+#define RD_NAME random_distributions_name::NAME
+#define RD_MODULE random_distributions_name::MODULE
+#define RD_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(RD_MODULE, RD_NAME, fmt, ## args)
+#define RD_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(RD_MODULE, RD_NAME, fmt, ## args)
+#define RD_WARNING(fmt, args...) WARNING_WITH_NAME(RD_NAME, fmt, ## args)
+#define RD_ERROR(fmt, args...) ERROR_WITH_NAME(RD_NAME, fmt, ## args)
+#define RD_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(RD_NAME, fmt, ## args)
+#define RD_REPORT(fmt, args...) REPORT_WITH_NAME(RD_NAME, fmt, ## args)
+#define RD_DP(level, fmt, args...) DP_WITH_MODULE(RD_MODULE, level, RD_NAME, fmt, ## args)
+
+using random_utilities::random_engine;
+
+////////////////////////////////////////////////////////////////////////////////
+// Ziggurat tables
+//
+// Marsaglia and Tsang, "The Ziggurat Method for Generating Random
+// Variables", 2000.  The density is covered by equal-area layers; layer
+// i's rectangle is x in [0, w[i] * 2^32) and, if the scaled draw is under
+// k[i], it's inside the next layer's rectangle too and can go straight
+// out.  Otherwise it's in a wedge (or the tail, layer 0) and we do the
+// real test.
+//
+// One 64-bit draw per try: the low bits pick the layer and the high 32
+// bits are the value, so the two aren't correlated the way they are in
+// the original, which used the same 32 bits for both.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    enum
+    {
+        NORMAL_LAYERS = 128,
+        EXPONENTIAL_LAYERS = 256
+    };
+
+    const double NORMAL_R = 3.442619855899;          // where the tail starts
+    const double NORMAL_V = 9.91256303526217e-3;     // area of each layer
+    const double EXPONENTIAL_R = 7.697117470131487;
+    const double EXPONENTIAL_V = 3.949659822581572e-3;
+
+    const double TWO_TO_31 = 2147483648.0;
+    const double TWO_TO_32 = 4294967296.0;
+
+    uint32_t normal_k[NORMAL_LAYERS];
+    double normal_w[NORMAL_LAYERS];
+    double normal_f[NORMAL_LAYERS];
+
+    uint32_t exponential_k[EXPONENTIAL_LAYERS];
+    double exponential_w[EXPONENTIAL_LAYERS];
+    double exponential_f[EXPONENTIAL_LAYERS];
+
+    pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+    void
+    build_tables(void)
+    {
+        double d = NORMAL_R;
+        double t = d;
+        double q = NORMAL_V / exp(-0.5 * d * d);
+
+        normal_k[0] = static_cast<uint32_t>((d / q) * TWO_TO_31);
+        normal_k[1] = 0;
+        normal_w[0] = q / TWO_TO_31;
+        normal_w[NORMAL_LAYERS - 1] = d / TWO_TO_31;
+        normal_f[0] = 1.0;
+        normal_f[NORMAL_LAYERS - 1] = exp(-0.5 * d * d);
+
+        for (int i = NORMAL_LAYERS - 2; i >= 1; --i)
+        {
+            d = sqrt(-2.0 * log(NORMAL_V / d + exp(-0.5 * d * d)));
+            normal_k[i + 1] = static_cast<uint32_t>((d / t) * TWO_TO_31);
+            t = d;
+            normal_f[i] = exp(-0.5 * d * d);
+            normal_w[i] = d / TWO_TO_31;
+        }
+
+        d = EXPONENTIAL_R;
+        t = d;
+        q = EXPONENTIAL_V / exp(-d);
+
+        exponential_k[0] = static_cast<uint32_t>((d / q) * TWO_TO_32);
+        exponential_k[1] = 0;
+        exponential_w[0] = q / TWO_TO_32;
+        exponential_w[EXPONENTIAL_LAYERS - 1] = d / TWO_TO_32;
+        exponential_f[0] = 1.0;
+        exponential_f[EXPONENTIAL_LAYERS - 1] = exp(-d);
+
+        for (int i = EXPONENTIAL_LAYERS - 2; i >= 1; --i)
+        {
+            d = -log(EXPONENTIAL_V / d + exp(-d));
+            exponential_k[i + 1] = static_cast<uint32_t>((d / t) * TWO_TO_32);
+            t = d;
+            exponential_f[i] = exp(-d);
+            exponential_w[i] = d / TWO_TO_32;
+        }
+    }
+
+    inline void
+    need_tables(void)
+    {
+        pthread_once(&tables_once, build_tables);
+    }
+
+    // (0, 1): never exactly 0, so it's safe to take the log of.
+    inline double
+    open_uniform(random_engine &e)
+    {
+        return (e.next32() + 0.5) / TWO_TO_32;
+    }
+
+    double
+    normal_slow(random_engine &e, int32_t value, unsigned int layer)
+    {
+        for ( ; ; )
+        {
+            double x = value * normal_w[layer];
+
+            if (layer == 0)
+            {
+                // The tail, past R: Marsaglia's exponential trick.
+                double y;
+                do
+                {
+                    x = -log(open_uniform(e)) / NORMAL_R;
+                    y = -log(open_uniform(e));
+                } while (y + y < x * x);
+                return (value > 0) ? NORMAL_R + x : -NORMAL_R - x;
+            }
+
+            double f = normal_f[layer]
+                       + e.erand() * (normal_f[layer - 1] - normal_f[layer]);
+            if (f < exp(-0.5 * x * x))
+                return x;
+
+            uint64_t u = e.next64();
+            layer = u & (NORMAL_LAYERS - 1);
+            value = static_cast<int32_t>(u >> 32);
+            int64_t magnitude = value;
+            if (magnitude < 0)
+                magnitude = -magnitude;
+            if (magnitude < normal_k[layer])
+                return value * normal_w[layer];
+        }
+    }
+
+    inline double
+    normal_fast(random_engine &e)
+    {
+        uint64_t u = e.next64();
+        unsigned int layer = u & (NORMAL_LAYERS - 1);
+        int32_t value = static_cast<int32_t>(u >> 32);
+        int64_t magnitude = value;
+        if (magnitude < 0)
+            magnitude = -magnitude;
+        if (magnitude < normal_k[layer])
+            return value * normal_w[layer];
+        return normal_slow(e, value, layer);
+    }
+
+    double
+    exponential_slow(random_engine &e, uint32_t value, unsigned int layer)
+    {
+        for ( ; ; )
+        {
+            if (layer == 0)
+                return EXPONENTIAL_R - log(open_uniform(e));
+
+            double x = value * exponential_w[layer];
+            double f = exponential_f[layer]
+                       + e.erand() * (exponential_f[layer - 1]
+                                      - exponential_f[layer]);
+            if (f < exp(-x))
+                return x;
+
+            uint64_t u = e.next64();
+            layer = u & (EXPONENTIAL_LAYERS - 1);
+            value = static_cast<uint32_t>(u >> 32);
+            if (value < exponential_k[layer])
+                return value * exponential_w[layer];
+        }
+    }
+
+    inline double
+    exponential_fast(random_engine &e)
+    {
+        uint64_t u = e.next64();
+        unsigned int layer = u & (EXPONENTIAL_LAYERS - 1);
+        uint32_t value = static_cast<uint32_t>(u >> 32);
+        if (value < exponential_k[layer])
+            return value * exponential_w[layer];
+        return exponential_slow(e, value, layer);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Continuous
+////////////////////////////////////////////////////////////////////////////////
+
+double
+random_utilities::random_normal(random_engine &e)
+{
+    need_tables();
+    return normal_fast(e);
+}
+
+double
+random_utilities::random_normal(random_engine &e, double mean, double stddev)
+{
+    need_tables();
+    return mean + stddev * normal_fast(e);
+}
+
+double
+random_utilities::random_exponential(random_engine &e)
+{
+    need_tables();
+    return exponential_fast(e);
+}
+
+/**
+    'rate' is events per unit time, so the mean is 1 / rate.
+*/
+
+double
+random_utilities::random_exponential(random_engine &e, double rate)
+{
+    need_tables();
+    return exponential_fast(e) / rate;
+}
+
+/**
+    exp() of N(mu, sigma): mu and sigma are of the log, not of the result.
+*/
+
+double
+random_utilities::random_lognormal(random_engine &e, double mu, double sigma)
+{
+    need_tables();
+    return exp(mu + sigma * normal_fast(e));
+}
+
+double
+random_utilities::random_normal(double mean, double stddev)
+{
+    return random_normal(default_engine(), mean, stddev);
+}
+
+double
+random_utilities::random_exponential(double rate)
+{
+    return random_exponential(default_engine(), rate);
+}
+
+double
+random_utilities::random_lognormal(double mu, double sigma)
+{
+    return random_lognormal(default_engine(), mu, sigma);
+}
+
+void
+random_utilities::fill_normal(random_engine &e, double *out, size_t n,
+                              double mean, double stddev)
+{
+    need_tables();
+    for (size_t i = 0; i < n; ++i)
+        out[i] = mean + stddev * normal_fast(e);
+}
+
+void
+random_utilities::fill_exponential(random_engine &e, double *out, size_t n,
+                                   double rate)
+{
+    need_tables();
+    const double scale = 1.0 / rate;
+    for (size_t i = 0; i < n; ++i)
+        out[i] = exponential_fast(e) * scale;
+}
+
+void
+random_utilities::fill_lognormal(random_engine &e, double *out, size_t n,
+                                 double mu, double sigma)
+{
+    need_tables();
+    for (size_t i = 0; i < n; ++i)
+        out[i] = exp(mu + sigma * normal_fast(e));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Alias table
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Vose's version of Walker's method.  Scale the weights so they average
+    1, then repeatedly pair a column that's short of 1 with one that's over,
+    topping the short one up from the tall one.  Every column ends up
+    exactly 1 high and made of at most two outcomes: itself, up to
+    'threshold', and its alias above that.
+
+    The threshold is kept as a 32-bit fraction so a sample is a bounded
+    draw, a 32-bit draw and one compare.
+*/
+
+random_utilities::alias_table::alias_table(const std::vector<double> &weights):
+    threshold_(weights.size()),
+    alias_(weights.size())
+{
+    const size_t n = weights.size();
+    if (!n || (n > 0xFFFFFFFFUL))
+        RD_RUNTIME("alias table needs between 1 and 2^32 - 1 weights, not %lu",
+                   static_cast<unsigned long>(n));
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!(weights[i] >= 0.0))
+            RD_RUNTIME("weight %lu is %g: must be >= 0",
+                       static_cast<unsigned long>(i), weights[i]);
+        sum += weights[i];
+    }
+    if (!(sum > 0.0))
+        RD_RUNTIME("all %lu weights are 0", static_cast<unsigned long>(n));
+
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    small.reserve(n);
+    large.reserve(n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        scaled[i] = weights[i] * n / sum;
+        if (scaled[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back();
+        uint32_t l = large.back();
+        small.pop_back();
+
+        threshold_[s] = static_cast<uint32_t>(scaled[s] * TWO_TO_32);
+        alias_[s] = l;
+
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Whatever's left is 1 give or take rounding error: always keep it.
+    // (A threshold can't reach 2^32, so those columns alias to themselves.)
+    for (size_t i = 0; i < large.size(); ++i)
+    {
+        threshold_[large[i]] = 0xFFFFFFFFU;
+        alias_[large[i]] = large[i];
+    }
+    for (size_t i = 0; i < small.size(); ++i)
+    {
+        threshold_[small[i]] = 0xFFFFFFFFU;
+        alias_[small[i]] = small[i];
+    }
+}
+
+/**
+    Pull the column picks and the coins out of the bulk generators a block
+    at a time, then it's just table lookups.
+*/
+
+void
+random_utilities::alias_table::fill(random_engine &e, uint32_t *out,
+                                    size_t n) const
+{
+    enum { BLOCK = 512 };
+    uint32_t coins[BLOCK];
+
+    while (n)
+    {
+        size_t count = n < BLOCK ? n : BLOCK;
+        e.fill(out, count, size());
+        e.fill(coins, count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t column = out[i];
+            out[i] = (coins[i] < threshold_[column]) ? column : alias_[column];
+        }
+
+        out += count;
+        n -= count;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Zipf
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<double>
+random_utilities::zipf_sampler::weights(uint32_t n, double s)
+{
+    if (!n)
+        RD_RUNTIME("zipf needs at least one rank");
+
+    std::vector<double> w(n);
+    for (uint32_t k = 0; k < n; ++k)
+        w[k] = pow(k + 1.0, -s);
+    return w;
+}
+
+random_utilities::zipf_sampler::zipf_sampler(uint32_t n, double s):
+    table_(weights(n, s))
+{
+}
+
+void
+random_utilities::zipf_sampler::fill(random_engine &e, uint32_t *out,
+                                     size_t n) const
+{
+    table_.fill(e, out, n);
+    for (size_t i = 0; i < n; ++i)
+        ++out[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Poisson
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // Below this we invert a table, above it we use PTRS, which needs
+    // mean >= 10 to be valid.
+    const double POISSON_TABLE_LIMIT = 12.0;
+}
+
+/**
+    Small means: the CDF out to where the tail is below double resolution,
+    and a sample is a uniform plus a scan, which on average stops after
+    about 'mean' steps.
+
+    Big means: Hoermann, "The transformed rejection method for generating
+    Poisson random variables", 1993.  Constant time, and one or two
+    uniforms per sample almost always.
+*/
+
+random_utilities::poisson_sampler::poisson_sampler(double mean):
+    mean_(mean),
+    cdf_(),
+    sqrt_mean_(0.0),
+    log_mean_(0.0),
+    a_(0.0),
+    b_(0.0),
+    inv_alpha_(0.0),
+    v_r_(0.0)
+{
+    if (!(mean >= 0.0))
+        RD_RUNTIME("poisson mean is %g: must be >= 0", mean);
+
+    if (mean < POISSON_TABLE_LIMIT)
+    {
+        double p = exp(-mean);
+        double sum = p;
+        cdf_.push_back(sum);
+        for (unsigned int k = 1; (1.0 - sum > 1e-16) && (k < 200); ++k)
+        {
+            p *= mean / k;
+            sum += p;
+            cdf_.push_back(sum);
+        }
+        cdf_.back() = 1.0;
+        return;
+    }
+
+    sqrt_mean_ = sqrt(mean);
+    log_mean_ = log(mean);
+    b_ = 0.931 + 2.53 * sqrt_mean_;
+    a_ = -0.059 + 0.02483 * b_;
+    inv_alpha_ = 1.1239 + 1.1328 / (b_ - 3.4);
+    v_r_ = 0.9277 - 3.6224 / (b_ - 2);
+}
+
+unsigned int
+random_utilities::poisson_sampler::sample(random_engine &e) const
+{
+    if (!cdf_.empty())
+    {
+        double u = e.erand();
+        unsigned int k = 0;
+        while (u >= cdf_[k])
+            ++k;
+        return k;
+    }
+
+    for ( ; ; )
+    {
+        double u = e.erand() - 0.5;
+        double v = e.erand();
+        double us = 0.5 - fabs(u);
+        double k = floor((2.0 * a_ / us + b_) * u + mean_ + 0.43);
+
+        if ((us >= 0.07) && (v <= v_r_))
+            return static_cast<unsigned int>(k);
+
+        if ((k < 0) || ((us < 0.013) && (v > us)))
+            continue;
+
+        // lgamma() sets the global 'signgam', so it isn't thread safe:
+        // lgamma_r() hands the sign back instead.
+        int sign;
+        if (log(v) + log(inv_alpha_) - log(a_ / (us * us) + b_)
+            <= -mean_ + k * log_mean_ - lgamma_r(k + 1, &sign))
+            return static_cast<unsigned int>(k);
+    }
+}
+
+void
+random_utilities::poisson_sampler::fill(random_engine &e, unsigned int *out,
+                                        size_t n) const
+{
+    if (cdf_.empty())
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = sample(e);
+        return;
+    }
+
+    enum { BLOCK = 512 };
+    double u[BLOCK];
+    const double *cdf = &cdf_[0];
+
+    while (n)
+    {
+        size_t count = n < BLOCK ? n : BLOCK;
+        e.fill(u, count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned int k = 0;
+            while (u[i] >= cdf[k])
+                ++k;
+            out[i] = k;
+        }
+
+        out += count;
+        n -= count;
+    }
+}
+
+#undef RD_NAME
+#undef RD_MODULE
+#undef RD_CPRINT
+#undef RD_VPRINT
+#undef RD_WARNING
+#undef RD_ERROR
+#undef RD_RUNTIME
+#undef RD_REPORT
+#undef RD_DP
@@ -0,0 +1,327 @@
+#include "random_utilities.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+/**
+    Philox4x32-10 (Salmon, Moraes, Dror and Shaw, "Parallel Random
+    Numbers: As Easy as 1, 2, 3", SC11).
+
+    A block is 128 bits of counter pushed through 10 rounds keyed by 64
+    bits.  Each round is two 32 x 32 -> 64 multiplies and some xors, so
+    there's no state to carry from one block to the next: block b only
+    depends on (key, b).  That's what lets an engine seek() anywhere, and
+    what makes the bulk version trivially parallel:
+
+        AVX2:   8 blocks at a time
+        SSE2:   4 blocks at a time
+        else:   one at a time
+
+    picked at compile time, same as the xoshiro lanes in random_bulk.cpp,
+    and all giving the same numbers.
+
+    SSE2 and AVX2 only multiply the even 32-bit lanes (pmuludq), so each
+    multiply is done twice, once on the odd lanes shifted down, and the
+    halves get shuffled back together.
+
+    The counter is (block low 32, block high 32, 0, 0) and the key is
+    (key low 32, key high 32).  Block b gives stream words 2b and 2b + 1,
+    word 2b being out[0] | out[1] << 32.  With a 0 key and 0 counter that
+    matches Random123's known answer: 6627e8d5 e169c58d bc57ac4c 9b00dbd8.
+*/
+
+namespace
+{
+    const uint32_t PHILOX_M0 = 0xD2511F53;
+    const uint32_t PHILOX_M1 = 0xCD9E8D57;
+    const uint32_t PHILOX_W0 = 0x9E3779B9;     // key bumps between rounds
+    const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+    enum
+    {
+        PHILOX_ROUNDS = 10
+    };
+
+    void
+    philox_scalar(uint64_t key, uint64_t block, uint32_t out[4])
+    {
+        uint32_t x0 = static_cast<uint32_t>(block);
+        uint32_t x1 = static_cast<uint32_t>(block >> 32);
+        uint32_t x2 = 0;
+        uint32_t x3 = 0;
+        uint32_t k0 = static_cast<uint32_t>(key);
+        uint32_t k1 = static_cast<uint32_t>(key >> 32);
+
+        for (unsigned int round = 0; round < PHILOX_ROUNDS; ++round)
+        {
+            uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * x0;
+            uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * x2;
+
+            x0 = static_cast<uint32_t>(p1 >> 32) ^ x1 ^ k0;
+            x1 = static_cast<uint32_t>(p1);
+            x2 = static_cast<uint32_t>(p0 >> 32) ^ x3 ^ k1;
+            x3 = static_cast<uint32_t>(p0);
+
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+
+        out[0] = x0;
+        out[1] = x1;
+        out[2] = x2;
+        out[3] = x3;
+    }
+
+    // Block 'block' as its two stream words.
+    inline void
+    philox_pair(uint64_t key, uint64_t block, uint64_t *out)
+    {
+        uint32_t x[4];
+        philox_scalar(key, block, x);
+        out[0] = x[0] | (static_cast<uint64_t>(x[1]) << 32);
+        out[1] = x[2] | (static_cast<uint64_t>(x[3]) << 32);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Many blocks
+//
+// philox_blocks() writes blocks first .. first + count - 1 to 'out' as
+// 2 * count words.
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__AVX2__)
+
+namespace
+{
+    inline void
+    mulhilo256(__m256i x, __m256i m, __m256i &lo, __m256i &hi)
+    {
+        __m256i even = _mm256_mul_epu32(x, m);
+        __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m);
+
+        // [lo0 lo2 hi0 hi2] and [lo1 lo3 hi1 hi3] in each half
+        even = _mm256_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0));
+        odd = _mm256_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0));
+
+        lo = _mm256_unpacklo_epi32(even, odd);
+        hi = _mm256_unpackhi_epi32(even, odd);
+    }
+
+    void
+    philox_blocks(uint64_t key, uint64_t first, uint64_t *out, size_t count)
+    {
+        const __m256i m0 = _mm256_set1_epi32(PHILOX_M0);
+        const __m256i m1 = _mm256_set1_epi32(PHILOX_M1);
+
+        for ( ; count >= 8; count -= 8, first += 8, out += 16)
+        {
+            uint32_t low[8];
+            uint32_t high[8];
+            for (unsigned int i = 0; i < 8; ++i)
+            {
+                low[i] = static_cast<uint32_t>(first + i);
+                high[i] = static_cast<uint32_t>((first + i) >> 32);
+            }
+
+            __m256i x0 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(low));
+            __m256i x1 = _mm256_loadu_si256(reinterpret_cast<__m256i *>(high));
+            __m256i x2 = _mm256_setzero_si256();
+            __m256i x3 = _mm256_setzero_si256();
+            uint32_t k0 = static_cast<uint32_t>(key);
+            uint32_t k1 = static_cast<uint32_t>(key >> 32);
+
+            for (unsigned int round = 0; round < PHILOX_ROUNDS; ++round)
+            {
+                __m256i lo0, hi0, lo1, hi1;
+                mulhilo256(x0, m0, lo0, hi0);
+                mulhilo256(x2, m1, lo1, hi1);
+
+                x0 = _mm256_xor_si256(_mm256_xor_si256(hi1, x1),
+                                      _mm256_set1_epi32(k0));
+                x1 = lo1;
+                x2 = _mm256_xor_si256(_mm256_xor_si256(hi0, x3),
+                                      _mm256_set1_epi32(k1));
+                x3 = lo0;
+
+                k0 += PHILOX_W0;
+                k1 += PHILOX_W1;
+            }
+
+            // Lane i of x0..x3 is block i: transpose to block-major.  The
+            // unpacks work inside each 128-bit half, so r0 ends up as
+            // [block 0 | block 4] and so on.
+            __m256i t0 = _mm256_unpacklo_epi32(x0, x1);
+            __m256i t1 = _mm256_unpacklo_epi32(x2, x3);
+            __m256i t2 = _mm256_unpackhi_epi32(x0, x1);
+            __m256i t3 = _mm256_unpackhi_epi32(x2, x3);
+            __m256i r0 = _mm256_unpacklo_epi64(t0, t1);
+            __m256i r1 = _mm256_unpackhi_epi64(t0, t1);
+            __m256i r2 = _mm256_unpacklo_epi64(t2, t3);
+            __m256i r3 = _mm256_unpackhi_epi64(t2, t3);
+
+            __m256i *o = reinterpret_cast<__m256i *>(out);
+            _mm256_storeu_si256(o + 0, _mm256_permute2x128_si256(r0, r1, 0x20));
+            _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(r2, r3, 0x20));
+            _mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(r0, r1, 0x31));
+            _mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(r2, r3, 0x31));
+        }
+
+        for ( ; count; --count, ++first, out += 2)
+            philox_pair(key, first, out);
+    }
+}
+
+#elif defined(__SSE2__)
+
+namespace
+{
+    inline void
+    mulhilo128(__m128i x, __m128i m, __m128i &lo, __m128i &hi)
+    {
+        __m128i even = _mm_mul_epu32(x, m);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), m);
+
+        // [lo0 lo2 hi0 hi2] and [lo1 lo3 hi1 hi3]
+        even = _mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0));
+        odd = _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0));
+
+        lo = _mm_unpacklo_epi32(even, odd);
+        hi = _mm_unpackhi_epi32(even, odd);
+    }
+
+    void
+    philox_blocks(uint64_t key, uint64_t first, uint64_t *out, size_t count)
+    {
+        const __m128i m0 = _mm_set1_epi32(PHILOX_M0);
+        const __m128i m1 = _mm_set1_epi32(PHILOX_M1);
+
+        for ( ; count >= 4; count -= 4, first += 4, out += 8)
+        {
+            uint32_t low[4];
+            uint32_t high[4];
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                low[i] = static_cast<uint32_t>(first + i);
+                high[i] = static_cast<uint32_t>((first + i) >> 32);
+            }
+
+            __m128i x0 = _mm_loadu_si128(reinterpret_cast<__m128i *>(low));
+            __m128i x1 = _mm_loadu_si128(reinterpret_cast<__m128i *>(high));
+            __m128i x2 = _mm_setzero_si128();
+            __m128i x3 = _mm_setzero_si128();
+            uint32_t k0 = static_cast<uint32_t>(key);
+            uint32_t k1 = static_cast<uint32_t>(key >> 32);
+
+            for (unsigned int round = 0; round < PHILOX_ROUNDS; ++round)
+            {
+                __m128i lo0, hi0, lo1, hi1;
+                mulhilo128(x0, m0, lo0, hi0);
+                mulhilo128(x2, m1, lo1, hi1);
+
+                x0 = _mm_xor_si128(_mm_xor_si128(hi1, x1), _mm_set1_epi32(k0));
+                x1 = lo1;
+                x2 = _mm_xor_si128(_mm_xor_si128(hi0, x3), _mm_set1_epi32(k1));
+                x3 = lo0;
+
+                k0 += PHILOX_W0;
+                k1 += PHILOX_W1;
+            }
+
+            // Lane i of x0..x3 is block i: transpose to block-major.
+            __m128i t0 = _mm_unpacklo_epi32(x0, x1);
+            __m128i t1 = _mm_unpacklo_epi32(x2, x3);
+            __m128i t2 = _mm_unpackhi_epi32(x0, x1);
+            __m128i t3 = _mm_unpackhi_epi32(x2, x3);
+
+            __m128i *o = reinterpret_cast<__m128i *>(out);
+            _mm_storeu_si128(o + 0, _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128(o + 1, _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128(o + 2, _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128(o + 3, _mm_unpackhi_epi64(t2, t3));
+        }
+
+        for ( ; count; --count, ++first, out += 2)
+            philox_pair(key, first, out);
+    }
+}
+
+#else
+
+namespace
+{
+    void
+    philox_blocks(uint64_t key, uint64_t first, uint64_t *out, size_t count)
+    {
+        for ( ; count; --count, ++first, out += 2)
+            philox_pair(key, first, out);
+    }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Without an engine
+////////////////////////////////////////////////////////////////////////////////
+
+void
+random_utilities::philox_block(uint64_t key, uint64_t block, uint32_t out[4])
+{
+    philox_scalar(key, block, out);
+}
+
+uint64_t
+random_utilities::philox_at(uint64_t key, uint64_t n)
+{
+    uint64_t words[2];
+    philox_pair(key, n >> 1, words);
+    return words[n & 1];
+}
+
+/**
+    An odd 'first' or 'n' means half a block at the start or end, which we
+    do one at a time; everything in between goes through philox_blocks().
+*/
+
+void
+random_utilities::philox_fill(uint64_t key, uint64_t first, uint64_t *out,
+                              size_t n)
+{
+    if (n && (first & 1))
+    {
+        *out++ = philox_at(key, first++);
+        --n;
+    }
+
+    philox_blocks(key, first >> 1, out, n >> 1);
+
+    if (n & 1)
+        out[n - 1] = philox_at(key, first + n - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Engine
+////////////////////////////////////////////////////////////////////////////////
+
+void
+random_utilities::random_engine::seed_philox(uint64_t key, uint64_t counter)
+{
+    philox_key_ = key;
+    seek(counter);
+}
+
+/**
+    Next draw is word 'counter'.  If that's the second half of a block,
+    work out the block now so philox_next() can just hand the half out.
+*/
+
+void
+random_utilities::random_engine::seek(uint64_t counter)
+{
+    philox_counter_ = counter;
+    if (counter & 1)
+        philox_spare_ = philox_at(philox_key_, counter);
+}
@@ -0,0 +1,381 @@
+#include "random_utilities.h"
+
+#include "program_IO.h"
+
+/**
+    Stream splitting, for parallel runs that have to be reproducible.
+
+    Handing each worker its own ad hoc seed risks two workers' sequences
+    running into each other, and seed_all() puts the same 48 bits into all
+    three rand48 streams besides.  Instead split() cuts one master seed
+    into substreams that provably can't overlap:
+
+        XOSHIRO256:  the master seeds a base state.  Substream i is the
+                     base jumped i * 2^128 steps, so every substream gets
+                     2^128 values to itself.  Bulk lane l is the base
+                     long-jumped (l + 1) * 2^192 steps and then jumped
+                     i * 2^128, out of reach of the one-at-a-time streams
+                     and of every other lane.
+
+        RAND48:      the period is only 2^48, so it gets carved into
+                     'count' equal pieces and substream i starts at piece
+                     i.  Each of the three streams gets its own seed out
+                     of the master.
+
+        PHILOX:      every substream shares one key out of the master, and
+                     the 2^64 counter is carved into 'count' pieces the
+                     same way.
+
+    Jumps are the xoshiro authors' polynomials; a rand48 advance is the
+    LCG composed with itself by squaring, so it's O(log steps) however far
+    we go.  Splitting costs about 256 steps per jump per stream, times the
+    index, which is nothing next to starting up a worker thread.
+
+    save_state() / restore_state() dump and reload everything in a fixed
+    little-endian layout, so a run can be checkpointed and replayed bit for
+    bit, on this machine or another.
+*/
+
+namespace random_streams_name
+{
+    const std::string NAME("random_streams");
+    log_module MODULE(NAME);
+}
+
+#define RS_NAME random_streams_name::NAME
+#define RS_MODULE random_streams_name::MODULE
+#define RS_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(RS_MODULE, RS_NAME, fmt, ## args)
+#define RS_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(RS_MODULE, RS_NAME, fmt, ## args)
+#define RS_WARNING(fmt, args...) WARNING_WITH_NAME(RS_NAME, fmt, ## args)
+#define RS_ERROR(fmt, args...) ERROR_WITH_NAME(RS_NAME, fmt, ## args)
+#define RS_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(RS_NAME, fmt, ## args)
+#define RS_REPORT(fmt, args...) REPORT_WITH_NAME(RS_NAME, fmt, ## args)
+#define RS_DP(level, fmt, args...) DP_WITH_MODULE(RS_MODULE, level, RS_NAME, fmt, ## args)
+
+uint64_t splitmix64(uint64_t *x);   // random_utilities.cpp
+
+namespace
+{
+    const uint64_t JUMP[4] =
+    {
+        0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+        0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL
+    };
+
+    const uint64_t LONG_JUMP[4] =
+    {
+        0x76E15D3EFEFDCBBFULL, 0xC5004E441C522FB3ULL,
+        0x77710069854EE241ULL, 0x39109BB02ACBE635ULL
+    };
+
+    const uint64_t RAND48_A = 0x5DEECE66DULL;   // SUSv3's multiplier
+    const uint64_t RAND48_C = 0xB;
+    const uint64_t RAND48_MASK = (1ULL << 48) - 1;
+
+    enum
+    {
+        STATE_VERSION = 2,
+        STATE_BYTES_V1 = 2                                  // version, generator
+                         + 3 * random_utilities::RANDOM_STATE_ARRAY_SIZE * 2
+                         + 4 * 8                            // xoshiro
+                         + 4 * random_utilities::RANDOM_LANES * 8,
+        STATE_BYTES = STATE_BYTES_V1 + 2 * 8                // philox
+    };
+
+    inline uint64_t
+    rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    // Same state transition as random_engine::xoshiro_next().
+    inline void
+    xoshiro_step(uint64_t *s)
+    {
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+    }
+
+    void
+    xoshiro_jump(uint64_t *s, const uint64_t *polynomial)
+    {
+        uint64_t t[4] = {0, 0, 0, 0};
+
+        for (unsigned int i = 0; i < 4; ++i)
+            for (unsigned int b = 0; b < 64; ++b)
+            {
+                if (polynomial[i] & (1ULL << b))
+                    for (unsigned int j = 0; j < 4; ++j)
+                        t[j] ^= s[j];
+                xoshiro_step(s);
+            }
+
+        for (unsigned int j = 0; j < 4; ++j)
+            s[j] = t[j];
+    }
+
+    uint64_t
+    seed_to_48(const random_utilities::seed_t &p)
+    {
+        return static_cast<uint64_t>(p[0])
+               | (static_cast<uint64_t>(p[1]) << 16)
+               | (static_cast<uint64_t>(p[2]) << 32);
+    }
+
+    random_utilities::seed_t
+    seed_from_48(uint64_t x)
+    {
+        return random_utilities::seed_t(x & 0xFFFF, (x >> 16) & 0xFFFF,
+                                        (x >> 32) & 0xFFFF);
+    }
+
+    void
+    put(byte_vector_t &bytes, uint64_t value, unsigned int size)
+    {
+        for (unsigned int i = 0; i < size; ++i)
+            bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    uint64_t
+    get(const uint8_t *&p, unsigned int size)
+    {
+        uint64_t value = 0;
+        for (unsigned int i = 0; i < size; ++i)
+            value |= static_cast<uint64_t>(*p++) << (8 * i);
+        return value;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Jumping
+////////////////////////////////////////////////////////////////////////////////
+
+void
+random_utilities::random_engine::jump(void)
+{
+    xoshiro_jump(xoshiro_, JUMP);
+}
+
+void
+random_utilities::random_engine::long_jump(void)
+{
+    xoshiro_jump(xoshiro_, LONG_JUMP);
+}
+
+void
+random_utilities::random_engine::thread_jump(void)
+{
+    jump();
+    jump_lanes(JUMP);
+    advance_rand48(RAND48_THREAD_STRIDE);
+    seek(tell() + PHILOX_THREAD_STRIDE);
+}
+
+/**
+    Jump every bulk lane by the same polynomial.  The lanes are stored
+    word-major, so each one gets pulled out into a plain state first.
+*/
+
+void
+random_utilities::random_engine::jump_lanes(const uint64_t *polynomial)
+{
+    for (unsigned int lane = 0; lane < RANDOM_LANES; ++lane)
+    {
+        uint64_t s[4];
+        for (unsigned int i = 0; i < 4; ++i)
+            s[i] = lanes_[i][lane];
+
+        xoshiro_jump(s, polynomial);
+
+        for (unsigned int i = 0; i < 4; ++i)
+            lanes_[i][lane] = s[i];
+    }
+}
+
+/**
+    k steps of x' = a * x + c is x' = A * x + C for
+
+        A = a^k,  C = c * (a^(k-1) + ... + a + 1)
+
+    which we build up by squaring, one bit of 'steps' at a time.  Working
+    mod 2^64 and masking at the end is the same as working mod 2^48.
+
+    This assumes nobody has called lcong48() to change a and c.
+*/
+
+void
+random_utilities::random_engine::advance_rand48(uint64_t steps)
+{
+    uint64_t a = RAND48_A;
+    uint64_t c = RAND48_C;
+    uint64_t total_a = 1;
+    uint64_t total_c = 0;
+
+    for ( ; steps; steps >>= 1)
+    {
+        if (steps & 1)
+        {
+            total_a *= a;
+            total_c = total_c * a + c;
+        }
+        c *= a + 1;
+        a *= a;
+    }
+
+    erand_state_ = seed_from_48((total_a * seed_to_48(erand_state_) + total_c)
+                                & RAND48_MASK);
+    nrand_state_ = seed_from_48((total_a * seed_to_48(nrand_state_) + total_c)
+                                & RAND48_MASK);
+    jrand_state_ = seed_from_48((total_a * seed_to_48(jrand_state_) + total_c)
+                                & RAND48_MASK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Splitting
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Every generator's state gets set up, whichever this engine is running,
+    so changing generator later doesn't undo the split.
+*/
+
+void
+random_utilities::random_engine::split(uint64_t master, unsigned int index,
+                                       unsigned int count)
+{
+    if (index >= count)
+        RS_RUNTIME("can't have substream %u of %u", index, count);
+
+    uint64_t x = master;
+
+    erand_state_ = seed_from_48(splitmix64(&x));
+    nrand_state_ = seed_from_48(splitmix64(&x));
+    jrand_state_ = seed_from_48(splitmix64(&x));
+    advance_rand48(static_cast<uint64_t>(index) * ((1ULL << 48) / count));
+
+    for (unsigned int i = 0; i < 4; ++i)
+        xoshiro_[i] = splitmix64(&x);
+
+    uint64_t base[4];
+    for (unsigned int i = 0; i < 4; ++i)
+        base[i] = xoshiro_[i];
+
+    for (unsigned int lane = 0; lane < RANDOM_LANES; ++lane)
+    {
+        xoshiro_jump(base, LONG_JUMP);
+        for (unsigned int i = 0; i < 4; ++i)
+            lanes_[i][lane] = base[i];
+    }
+
+    for (unsigned int i = 0; i < index; ++i)
+    {
+        jump();
+        jump_lanes(JUMP);
+    }
+
+    uint64_t piece = (count == 1) ? 0 : (~0ULL / count) + 1;
+    seed_philox(splitmix64(&x), index * piece);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Save && Restore
+//
+// Layout, all little-endian:
+//
+//     version             1 byte
+//     generator           1 byte
+//     erand, nrand, jrand 3 x 3 x uint16_t
+//     xoshiro             4 x uint64_t
+//     lanes               4 x RANDOM_LANES x uint64_t, word-major
+//     philox key, counter 2 x uint64_t (version 2 on)
+////////////////////////////////////////////////////////////////////////////////
+
+void
+random_utilities::random_engine::save_state(byte_vector_t &bytes) const
+{
+    bytes.clear();
+    bytes.reserve(STATE_BYTES);
+
+    put(bytes, STATE_VERSION, 1);
+    put(bytes, generator_, 1);
+
+    const seed_t *streams[3] = {&erand_state_, &nrand_state_, &jrand_state_};
+    for (unsigned int i = 0; i < 3; ++i)
+        for (unsigned int j = 0; j < RANDOM_STATE_ARRAY_SIZE; ++j)
+            put(bytes, (*streams[i])[j], 2);
+
+    for (unsigned int i = 0; i < 4; ++i)
+        put(bytes, xoshiro_[i], 8);
+
+    for (unsigned int i = 0; i < 4; ++i)
+        for (unsigned int lane = 0; lane < RANDOM_LANES; ++lane)
+            put(bytes, lanes_[i][lane], 8);
+
+    put(bytes, philox_key_, 8);
+    put(bytes, philox_counter_, 8);
+}
+
+/**
+    Everything gets checked before anything is touched, so on an exception
+    the engine is just as it was.  Version 1 states, from before PHILOX,
+    leave the Philox key and counter alone.
+*/
+
+void
+random_utilities::random_engine::restore_state(const byte_vector_t &bytes)
+{
+    if (bytes.size() < STATE_BYTES_V1)
+        RS_RUNTIME("engine state is only %lu bytes",
+                   static_cast<unsigned long>(bytes.size()));
+
+    const uint8_t *p = &bytes[0];
+    unsigned int version = get(p, 1);
+    if ((version < 1) || (version > STATE_VERSION))
+        RS_RUNTIME("engine state version %u, expected 1 to %d",
+                   version, STATE_VERSION);
+
+    const size_t expected = (version == 1) ? STATE_BYTES_V1 : STATE_BYTES;
+    if (bytes.size() != expected)
+        RS_RUNTIME("version %u engine state is %lu bytes, expected %lu",
+                   version, static_cast<unsigned long>(bytes.size()),
+                   static_cast<unsigned long>(expected));
+
+    unsigned int g = get(p, 1);
+    if ((g != GENERATOR_RAND48) && (g != GENERATOR_XOSHIRO256)
+        && ((version < 2) || (g != GENERATOR_PHILOX)))
+        RS_RUNTIME("engine state has unknown generator %u", g);
+    generator_ = static_cast<generator_t>(g);
+
+    seed_t *streams[3] = {&erand_state_, &nrand_state_, &jrand_state_};
+    for (unsigned int i = 0; i < 3; ++i)
+        for (unsigned int j = 0; j < RANDOM_STATE_ARRAY_SIZE; ++j)
+            streams[i]->s[j] = get(p, 2);
+
+    for (unsigned int i = 0; i < 4; ++i)
+        xoshiro_[i] = get(p, 8);
+
+    for (unsigned int i = 0; i < 4; ++i)
+        for (unsigned int lane = 0; lane < RANDOM_LANES; ++lane)
+            lanes_[i][lane] = get(p, 8);
+
+    if (version >= 2)
+    {
+        uint64_t key = get(p, 8);
+        seed_philox(key, get(p, 8));
+    }
+}
+
+#undef RS_NAME
+#undef RS_MODULE
+#undef RS_CPRINT
+#undef RS_VPRINT
+#undef RS_WARNING
+#undef RS_ERROR
+#undef RS_RUNTIME
+#undef RS_REPORT
+#undef RS_DP
@@ -4,8 +4,10 @@
 #include <ostream>
 
 #include <limits.h>
+#include <pthread.h>
 
 #include "program_IO.h"
+#include "utility.h"
 
 #include <iomanip>
 using std::hex;
@@ -19,63 +21,278 @@ using std::setfill;
 
 namespace random_utilities
 {
-    // global variables for maintaining random number state
-    seed_t erand_state;
-    seed_t nrand_state;
-    seed_t jrand_state;
+    // What a thread's default engine gets seeded with when it's created.
+    // Only touched when seeding or making an engine, never per number.
+    seed_t erand_seed;
+    seed_t nrand_seed;
+    seed_t jrand_seed;
+    generator_t default_generator = GENERATOR_RAND48;
+    pthread_mutex_t seed_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    // The next thread's default engine: copied for it, then thread_jump()ed
+    // for the one after.  Made from the seeds above when they change.
+    random_engine *next_engine = 0;
+
+    // Each thread's default engine.  Deleted by the key's destructor when
+    // the thread exits.
+    __thread random_engine *thread_engine = 0;
+    pthread_key_t engine_key;
+    pthread_once_t engine_key_once = PTHREAD_ONCE_INIT;
 }
 
 namespace random_name
 {
     const std::string NAME("random");
+    log_module MODULE(NAME);
 }
 
 #define RAND_NAME random_name::NAME
-#define RAND_CPRINT(fmt, args...)  CPRINT_WITH_NAME(RAND_NAME, fmt, ##args)
-#define RAND_VPRINT(fmt, args...)  VPRINT_WITH_NAME(RAND_NAME, fmt, ##args)
+#define RAND_MODULE random_name::MODULE
+#define RAND_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(RAND_MODULE, RAND_NAME, fmt, ##args)
+#define RAND_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(RAND_MODULE, RAND_NAME, fmt, ##args)
 #define RAND_WARNING(fmt, args...) WARNING_WITH_NAME(RAND_NAME, fmt, ##args)
 #define RAND_ERROR(fmt, args...)   ERROR_WITH_NAME(RAND_NAME, fmt, ##args)
 #define RAND_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(RAND_NAME, fmt, ##args)
-#define RAND_DP(level, fmt, args...) DP(level, RAND_NAME, fmt, ##args)
+#define RAND_DP(level, fmt, args...) DP_WITH_MODULE(RAND_MODULE, level, RAND_NAME, fmt, ##args)
+
+#define RAND_LOCK(mutex) LOCK(mutex,RAND_ERROR)
+#define RAND_UNLOCK(mutex) UNLOCK(mutex,RAND_ERROR)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Internal, not in namespace
 ////////////////////////////////////////////////////////////////////////////////
 
 double spread_random(void);
+uint64_t splitmix64(uint64_t *x);
+uint64_t multiply_64x64(uint64_t a, uint64_t b, uint64_t *low);
+void delete_thread_engine(void *engine);
+void make_engine_key(void);
+void restart_streams(bool caller_first);
+
+////////////////////////////////////////////////////////////////////////////////
+// Engine
+////////////////////////////////////////////////////////////////////////////////
+
+random_utilities::random_engine::random_engine(generator_t g):
+    generator_(g),
+    erand_state_(),
+    nrand_state_(),
+    jrand_state_()
+{
+    stretch_seed(seed_t());
+}
+
+random_utilities::random_engine::random_engine(const seed_t &p, generator_t g):
+    generator_(g),
+    erand_state_(p),
+    nrand_state_(p),
+    jrand_state_(p)
+{
+    stretch_seed(p);
+}
+
+/*!
+    All seeded with same variable.
+*/
+
+void
+random_utilities::random_engine::seed_all(const seed_t &p)
+{
+    seed_erand48(p);    // double [0.0, 1.0) -- uniform distribution
+    seed_nrand48(p);    // unsigned long between 0 and 2^31 -- uniform
+    seed_jrand48(p);    // signed long between -2^31 and 2^31 -- uniform
+    stretch_seed(p);
+}
+
+/**
+    xoshiro wants 256 bits of state that aren't all zero, and we've only
+    got 48.  Stretch them with splitmix64, which is what the xoshiro
+    authors recommend for exactly this, and which never hands back four
+    zeros in a row.  The bulk lanes and the Philox key just keep pulling
+    from the same splitmix64 sequence.
+*/
+
+void
+random_utilities::random_engine::stretch_seed(const seed_t &p)
+{
+    uint64_t x = static_cast<uint64_t>(p[0])
+                 | (static_cast<uint64_t>(p[1]) << 16)
+                 | (static_cast<uint64_t>(p[2]) << 32);
+
+    for (unsigned int i = 0; i < 4; ++i)
+        xoshiro_[i] = splitmix64(&x);
+
+    for (unsigned int lane = 0; lane < RANDOM_LANES; ++lane)
+        for (unsigned int i = 0; i < 4; ++i)
+            lanes_[i][lane] = splitmix64(&x);
+
+    seed_philox(splitmix64(&x));
+}
+
+/**
+    Steps '*x' and returns the next splitmix64 output (Steele, Lea and
+    Flood).  Only used to stretch seeds.
+*/
+
+uint64_t
+splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+    The thread is exiting.  A later key's destructor that wants a number
+    gets a new engine (registered again, so it's freed too) instead of
+    this one.
+*/
+
+void
+delete_thread_engine(void *engine)
+{
+    using random_utilities::thread_engine;
+
+    if (thread_engine == engine)
+        thread_engine = 0;
+    delete static_cast<random_utilities::random_engine *>(engine);
+}
+
+void
+make_engine_key(void)
+{
+    int ret = pthread_key_create(&random_utilities::engine_key,
+                                 delete_thread_engine);
+    if (ret)
+    {
+        errno = ret;
+        RAND_ERROR("creating per-thread engine key");
+    }
+}
+
+/**
+    Start handing out streams from the current seeds again.  Stream 0 is
+    the seeds themselves; if the caller's own engine was just reseeded to
+    that, the next thread starts at stream 1.  seed_mutex must be held.
+*/
+
+void
+restart_streams(bool caller_first)
+{
+    using namespace random_utilities;
+
+    delete next_engine;
+    next_engine = new random_engine(jrand_seed, default_generator);
+    next_engine->seed_erand48(erand_seed);
+    next_engine->seed_nrand48(nrand_seed);
+    if (caller_first)
+        next_engine->thread_jump();
+}
+
+/**
+    The calling thread's engine, made on first use: the next stream off
+    the current default seeds (see the header).  After that it's one
+    thread-local load.
+*/
+
+random_utilities::random_engine &
+random_utilities::default_engine(void)
+{
+    if (thread_engine)
+        return *thread_engine;
+
+    pthread_once(&engine_key_once, make_engine_key);
+
+    RAND_LOCK(&seed_mutex);
+    if (!next_engine)
+        restart_streams(false);
+    random_engine *e = new random_engine(*next_engine);
+    next_engine->thread_jump();
+    RAND_UNLOCK(&seed_mutex);
+
+    pthread_setspecific(engine_key, e);
+    thread_engine = e;
+    return *e;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Seeding
+//
+// These reseed the calling thread's engine right away, and become the
+// starting point for any thread that makes its engine later: the caller
+// is stream 0, the next new thread stream 1, and so on.  Threads that
+// already have one are left alone.
 ////////////////////////////////////////////////////////////////////////////////
 
 void
 random_utilities::seed_erand48(const seed_t &p)
 {
-    erand_state =  p;
+    random_engine &e = default_engine();
+
+    RAND_LOCK(&seed_mutex);
+    erand_seed = p;
+    restart_streams(true);
+    RAND_UNLOCK(&seed_mutex);
+    e.seed_erand48(p);
 }
 
 void
 random_utilities::seed_nrand48(const seed_t &p)
 {
-    nrand_state =  p;
+    random_engine &e = default_engine();
+
+    RAND_LOCK(&seed_mutex);
+    nrand_seed = p;
+    restart_streams(true);
+    RAND_UNLOCK(&seed_mutex);
+    e.seed_nrand48(p);
 }
 
 void
 random_utilities::seed_jrand48(const seed_t &p)
 {
-    jrand_state = p;
+    random_engine &e = default_engine();
+
+    RAND_LOCK(&seed_mutex);
+    jrand_seed = p;
+    restart_streams(true);
+    RAND_UNLOCK(&seed_mutex);
+    e.seed_jrand48(p);
 }
 
-/*!
-    All seeded with same variable.
+void
+random_utilities::seed_all(const seed_t &p)
+{
+    random_engine &e = default_engine();
+
+    RAND_LOCK(&seed_mutex);
+    erand_seed = p;
+    nrand_seed = p;
+    jrand_seed = p;
+    restart_streams(true);
+    RAND_UNLOCK(&seed_mutex);
+    e.seed_all(p);
+}
+
+/**
+    Pick the generator for default engines: the calling thread's right now
+    (restarted from the current seeds), and every thread that makes its
+    engine after this.
 */
 
 void
-random_utilities::seed_all(const seed_t &p)
+random_utilities::set_default_generator(generator_t g)
 {
-    seed_erand48(p);    // double [0.0, 1.0) -- uniform distribution
-    seed_nrand48(p);    // unsigned long between 0 and 2^31 -- uniform
-    seed_jrand48(p);    // signed long between -2^31 and 2^31 -- uniform
+    random_engine &e = default_engine();
+
+    RAND_LOCK(&seed_mutex);
+    default_generator = g;
+    e = random_engine(jrand_seed, g);
+    e.seed_erand48(erand_seed);
+    e.seed_nrand48(nrand_seed);
+    restart_streams(true);
+    RAND_UNLOCK(&seed_mutex);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -104,18 +321,23 @@ namespace random_utilities
 
 template <typename T>
 T
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<T>(erand48(erand_state.s) * static_cast<T>(~0));
+    return static_cast<T>(e.erand() * static_cast<T>(~0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // char && uchar: 8 bits
+//
+// The 8 and 16 bit ones take the top bits of a 32-bit draw.  They used to
+// scale erand48() by UCHAR_MAX or USHRT_MAX, which can never come up with
+// the biggest value, and the short one added SHRT_MAX where it meant
+// SHRT_MIN, so it wrapped and came out in [SHRT_MAX, ...) mod 2^16.
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
-    X = get_random() * UCHAR_MAX: [0, 255)
-    Y = X + SCHAR_MIN: [0,255) + (-128): [-128,127).
+    X = top 8 bits: [0, 255]
+    Y = X + SCHAR_MIN: [0, 255] + (-128): [-128, 127].
 
     Therefore covers all valid values that fit in a signed byte.
 
@@ -126,20 +348,21 @@ get_random(void)
 
 template<>
 signed char
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<signed char>(get_random() * UCHAR_MAX + SCHAR_MIN);
+    return static_cast<signed char>(static_cast<int>(e.next32() >> 24)
+                                    + SCHAR_MIN);
 }
 
 /**
-    [0.0, 1.0) * 255 = [0, 255): everything that fits in an unsigned byte.
+    Top 8 bits: [0, 255], everything that fits in an unsigned byte.
 */
 
 template<>
 unsigned char
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<unsigned char>(get_random() * UCHAR_MAX);
+    return static_cast<unsigned char>(e.next32() >> 24);
 }
 
 
@@ -148,87 +371,320 @@ get_random(void)
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
-    Signed 16 bits.
+    Signed 16 bits: [SHRT_MIN, SHRT_MAX].
 */
 
 template<>
 short
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<short>(get_random() * USHRT_MAX + SHRT_MAX);
+    return static_cast<short>(static_cast<int>(e.next32() >> 16) + SHRT_MIN);
 }
 
 /**
-    Unsigned 16 bits.
+    Unsigned 16 bits: [0, USHRT_MAX].
 */
 
 template<>
 unsigned short
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<unsigned short>(get_random() * USHRT_MAX);
+    return static_cast<unsigned short>(e.next32() >> 16);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// int && uint: 32 bits
+// int && uint: 32 bits, long && ulong: 32 or 64
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
-    get_random<int>: -2^31 to 2^31
+    get_random<int>: -2^31 to 2^31 - 1
 */
 
 template<>
 int
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<int>(jrand48(jrand_state.s));
+    return static_cast<int>(e.jrand());
 }
 
 /**
-    get_random<long>: -2^31 to 2^31.
+    get_random<long>: the whole of long, LONG_MIN to LONG_MAX.  It used to
+    be jrand48(), and so 32 bits, even where long is 64.
 */
 
 template<>
 long
-get_random(void)
+get_random(random_engine &e)
 {
-    return jrand48(jrand_state.s);
+    if (random_bits<long>::value == 64)
+        return static_cast<long>(e.next64());
+    return static_cast<long>(e.jrand());
 }
 
 /**
-    get_random<unsigned int>: 0 to 2^31.
+    get_random<unsigned int>: 0 to 2^32 - 1.  jrand48() hands back 32
+    uniform bits as a signed value, so the cast covers the whole unsigned
+    range (not 0 to 2^31, as this used to claim).
 */
 
 template<>
 unsigned int
-get_random(void)
+get_random(random_engine &e)
 {
-    return static_cast<unsigned int>(jrand48(jrand_state.s));
+    return static_cast<unsigned int>(e.jrand());
 }
 
 /**
-    get_random<unsigned long>: 0 to 2^31.
+    get_random<unsigned long>: the whole of unsigned long, 0 to ULONG_MAX.
+    This was nrand48(), 0 to 2^31 - 1 no matter how wide long is.
 */
 
 template<>
 unsigned long
-get_random(void)
+get_random(random_engine &e)
+{
+    if (random_bits<unsigned long>::value == 64)
+        return static_cast<unsigned long>(e.next64());
+    return static_cast<unsigned long>(e.next32());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// long long && ulong long: 64 bits
+//
+// int64_t and uint64_t are these or long and unsigned long, depending on
+// the box, so they don't get specializations of their own: they'd clash.
+// Whichever they are has to be full width.  (No static_assert in C++98:
+// a false check makes an array of size -1.)
+////////////////////////////////////////////////////////////////////////////////
+
+typedef char int64_t_is_full_width[(random_bits<int64_t>::value == 64) ? 1 : -1];
+typedef char uint64_t_is_full_width[(random_bits<uint64_t>::value == 64) ? 1 : -1];
+
+/**
+    get_random<long long>: -2^63 to 2^63 - 1.
+*/
+
+template<>
+long long
+get_random(random_engine &e)
+{
+    return static_cast<long long>(e.next64());
+}
+
+/**
+    get_random<unsigned long long>: all 64 bits, 0 to 2^64 - 1.
+*/
+
+template<>
+unsigned long long
+get_random(random_engine &e)
 {
-    return static_cast<unsigned long>(nrand48(nrand_state.s));
+    return e.next64();
 }
 
 /**
-    Value in the range [0, max)
+    Value in the range [0, max).  Unbiased: see bounded32().  A 'max' of
+    0 gives back 0.
 */
 
+unsigned int
+get_random(random_engine &e, unsigned int max)
+{
+    if (!max)
+        return 0;
+    return e.bounded32(max);
+}
+
 unsigned int
 get_random(unsigned int max)
 {
-    return static_cast<int>(max * get_random());
+    return get_random(default_engine(), max);
 }
 
 }   // end "random_utilities" namespace
 
+////////////////////////////////////////////////////////////////////////////////
+// Bounded && ranges
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Lemire's "nearly divisionless" method.  Multiply a random 32-bit x by
+    'bound': the top half of the 64-bit product is in [0, bound).  Some
+    results would come up once more often than others, and those are
+    exactly the ones whose low half is below 2^32 mod bound, so throw
+    those away and draw again.  That mod is only worked out when the low
+    half is below 'bound', which is rare unless 'bound' is huge.
+
+    Scaling erand48() by max, the old way, is biased and tops out at 48
+    bits of resolution.
+*/
+
+uint32_t
+random_utilities::random_engine::bounded32(uint32_t bound)
+{
+    if (!bound)
+        return next32();
+
+    uint64_t m = static_cast<uint64_t>(next32()) * bound;
+    uint32_t low = static_cast<uint32_t>(m);
+    if (low < bound)
+    {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold)
+        {
+            m = static_cast<uint64_t>(next32()) * bound;
+            low = static_cast<uint32_t>(m);
+        }
+    }
+    return static_cast<uint32_t>(m >> 32);
+}
+
+/**
+    a * b as 128 bits: returns the high half, and the low half in '*low'.
+*/
+
+uint64_t
+multiply_64x64(uint64_t a, uint64_t b, uint64_t *low)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    *low = static_cast<uint64_t>(product);
+    return static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t a_lo = a & 0xFFFFFFFFULL, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFFULL, b_hi = b >> 32;
+
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+    *low = (cross << 32) | (lo_lo & 0xFFFFFFFFULL);
+    return (hi_lo >> 32) + (cross >> 32) + hi_hi;
+#endif
+}
+
+/**
+    Same as bounded32(), 64 bits wide.
+*/
+
+uint64_t
+random_utilities::random_engine::bounded64(uint64_t bound)
+{
+    if (!bound)
+        return next64();
+
+    uint64_t low;
+    uint64_t high = multiply_64x64(next64(), bound, &low);
+    if (low < bound)
+    {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold)
+            high = multiply_64x64(next64(), bound, &low);
+    }
+    return high;
+}
+
+/**
+    [lo, hi] is hi - lo + 1 values.  Work that out unsigned so it can't
+    overflow; if it wraps to 0 then the range is the whole type and any
+    value will do.  The offset is added unsigned too, and only cast back
+    at the end.
+*/
+
+int
+random_utilities::random_engine::uniform(int lo, int hi)
+{
+    if (hi < lo)
+        RAND_RUNTIME("uniform(): empty range [%d, %d]", lo, hi);
+
+    uint32_t span = static_cast<uint32_t>(hi) - static_cast<uint32_t>(lo) + 1;
+    return static_cast<int>(static_cast<uint32_t>(lo) + bounded32(span));
+}
+
+unsigned int
+random_utilities::random_engine::uniform(unsigned int lo, unsigned int hi)
+{
+    if (hi < lo)
+        RAND_RUNTIME("uniform(): empty range [%u, %u]", lo, hi);
+
+    return lo + bounded32(hi - lo + 1);
+}
+
+long
+random_utilities::random_engine::uniform(long lo, long hi)
+{
+    return static_cast<long>(uniform(static_cast<long long>(lo),
+                                     static_cast<long long>(hi)));
+}
+
+unsigned long
+random_utilities::random_engine::uniform(unsigned long lo, unsigned long hi)
+{
+    return static_cast<unsigned long>(
+               uniform(static_cast<unsigned long long>(lo),
+                       static_cast<unsigned long long>(hi)));
+}
+
+long long
+random_utilities::random_engine::uniform(long long lo, long long hi)
+{
+    if (hi < lo)
+        RAND_RUNTIME("uniform(): empty range [%lld, %lld]", lo, hi);
+
+    uint64_t span = static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo) + 1;
+    return static_cast<long long>(static_cast<uint64_t>(lo) + bounded64(span));
+}
+
+unsigned long long
+random_utilities::random_engine::uniform
+(
+    unsigned long long lo,
+    unsigned long long hi
+)
+{
+    if (hi < lo)
+        RAND_RUNTIME("uniform(): empty range [%llu, %llu]", lo, hi);
+
+    return lo + bounded64(hi - lo + 1);
+}
+
+int
+random_utilities::uniform(int lo, int hi)
+{
+    return default_engine().uniform(lo, hi);
+}
+
+unsigned int
+random_utilities::uniform(unsigned int lo, unsigned int hi)
+{
+    return default_engine().uniform(lo, hi);
+}
+
+long
+random_utilities::uniform(long lo, long hi)
+{
+    return default_engine().uniform(lo, hi);
+}
+
+unsigned long
+random_utilities::uniform(unsigned long lo, unsigned long hi)
+{
+    return default_engine().uniform(lo, hi);
+}
+
+long long
+random_utilities::uniform(long long lo, long long hi)
+{
+    return default_engine().uniform(lo, hi);
+}
+
+unsigned long long
+random_utilities::uniform(unsigned long long lo, unsigned long long hi)
+{
+    return default_engine().uniform(lo, hi);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -254,10 +710,16 @@ random_utilities::operator <<(std::ostream &o, const seed_t &t)
     Both numbers must be in the range [0,1)
 */
 
+bool
+random_utilities::random_gt(random_engine &e, const double odds)
+{
+    return e.erand() > odds;
+}
+
 bool
 random_utilities::random_gt(const double odds)
 {
-    return erand48(erand_state.s) > odds;
+    return random_gt(default_engine(), odds);
 }
 
 /*!
@@ -267,10 +729,16 @@ random_utilities::random_gt(const double odds)
     Both numbers must be in the range [0,1)
 */
 
+bool
+random_utilities::random_gte(random_engine &e, const double odds)
+{
+    return e.erand() >= odds;
+}
+
 bool
 random_utilities::random_gte(const double odds)
 {
-    return erand48(erand_state.s) >= odds;
+    return random_gte(default_engine(), odds);
 }
 
 /*!
@@ -279,10 +747,16 @@ random_utilities::random_gte(const double odds)
     Both numbers must be in the range [0,1)
 */
 
+bool
+random_utilities::random_lt(random_engine &e, const double odds)
+{
+    return e.erand() < odds;
+}
+
 bool
 random_utilities::random_lt(const double odds)
 {
-    return erand48(erand_state.s) < odds;
+    return random_lt(default_engine(), odds);
 }
 
 /*!
@@ -292,10 +766,16 @@ random_utilities::random_lt(const double odds)
     Both numbers must be in the range [0,1)
 */
 
+bool
+random_utilities::random_lte(random_engine &e, const double odds)
+{
+    return e.erand() <= odds;
+}
+
 bool
 random_utilities::random_lte(const double odds)
 {
-    return  erand48(erand_state.s) <= odds;
+    return random_lte(default_engine(), odds);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -322,17 +802,26 @@ spread_random(void)
     Range of double is [0.0, 1.0)
 */
 
+double
+random_utilities::get_random(random_engine &e)
+{
+    return e.erand();
+}
+
 double
 random_utilities::get_random(void)
 {
-    return erand48(erand_state.s);
+    return default_engine().erand();
 }
 
 #undef RAND_NAME
+#undef RAND_MODULE
 #undef RAND_CPRINT
 #undef RAND_VPRINT
 #undef RAND_WARNING
 #undef RAND_ERROR
 #undef RAND_RUNTIME
 #undef RAND_DP
+#undef RAND_LOCK
+#undef RAND_UNLOCK
 
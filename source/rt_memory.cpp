@@ -0,0 +1,319 @@
+#include "rt_memory.h"
+
+#include <ostream>
+
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>                 // mallopt()
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>               // mlockall(), mmap(), madvise()
+#include <sys/resource.h>           // getrusage()
+#include <unistd.h>                 // sysconf()
+
+#include "program_IO.h"
+
+namespace rt_memory_name
+{
+    const std::string NAME("rt_memory");
+    log_module MODULE(NAME);
+}
+
+#define RTM_NAME rt_memory_name::NAME
+#define RTM_MODULE rt_memory_name::MODULE
+#define RTM_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(RTM_MODULE, RTM_NAME, fmt, ## args)
+#define RTM_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(RTM_MODULE, RTM_NAME, fmt, ## args)
+#define RTM_WARNING(fmt, args...) WARNING_WITH_NAME(RTM_NAME, fmt, ## args)
+#define RTM_ERROR(fmt, args...) ERROR_WITH_NAME(RTM_NAME, fmt, ## args)
+#define RTM_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(RTM_NAME, fmt, ## args)
+#define RTM_REPORT(fmt, args...) REPORT_WITH_NAME(RTM_NAME, fmt, ## args)
+#define RTM_DP(level, fmt, args...) DP_WITH_MODULE(RTM_MODULE, level, RTM_NAME, fmt, ## args)
+
+// Older headers
+#ifndef MADV_HUGEPAGE
+    #define MADV_HUGEPAGE 14
+#endif
+#ifndef MAP_HUGETLB
+    #define MAP_HUGETLB 0x40000
+#endif
+#ifndef RUSAGE_THREAD
+    #define RUSAGE_THREAD 1
+#endif
+
+using rt_memory::fault_count_t;
+using rt_memory::memory_report_t;
+
+namespace
+{
+    size_t
+    page_size(void)
+    {
+        static size_t size = sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    size_t
+    round_up(size_t bytes, size_t unit)
+    {
+        return (bytes + unit - 1) / unit * unit;
+    }
+
+    void
+    touch(volatile char *p, size_t bytes)
+    {
+        size_t page = page_size();
+        for (size_t i = 0; i < bytes; i += page)
+            p[i] = 0;
+    }
+
+    /**
+        How much stack the calling thread has left below us, less a margin
+        for the frames we're standing in and the guard page.  Zero if we
+        can't tell, which keeps prefault_stack() from guessing.
+    */
+
+    size_t
+    stack_left(void)
+    {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr))
+            return 0;
+
+        void *base;
+        size_t size;
+        int ret = pthread_attr_getstack(&attr, &base, &size);
+        pthread_attr_destroy(&attr);
+        if (ret)
+            return 0;
+
+        char here;
+        size_t used = static_cast<char *>(base) + size - &here;
+        if (used + RMC::STACK_MARGIN >= size)
+            return 0;
+
+        return size - used - RMC::STACK_MARGIN;
+    }
+
+    /**
+        Stack allocation in a frame of its own, so it goes away when we
+        return; noinline so it's really a frame of its own.
+    */
+
+    void __attribute__ ((noinline))
+    touch_stack(size_t bytes)
+    {
+        volatile char *p = static_cast<volatile char *>(alloca(bytes));
+        touch(p, bytes);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Preparation
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Not being able to lock memory (no CAP_IPC_LOCK, RLIMIT_MEMLOCK too
+    small) is worth a warning but not worth stopping for: the prefaulting
+    still helps, it just isn't guaranteed to stay put.
+*/
+
+memory_report_t
+rt_memory::prepare_realtime_memory(size_t stack_bytes, size_t heap_bytes)
+{
+    memory_report_t report;
+    fault_count_t start = fault_count();
+
+    report.locked = !mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (!report.locked)
+        RTM_REPORT("mlockall() failed: pages can still be paged out");
+
+    if (!mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0))
+        RTM_WARNING("mallopt() refused: freed memory may go back to the "
+                    "system\n");
+
+    report.heap_bytes = 0;
+    if (heap_bytes)
+    {
+        char *heap = static_cast<char *>(malloc(heap_bytes));
+        if (!heap)
+            RTM_ERROR("couldn't allocate %lu bytes to pretouch",
+                      (unsigned long)heap_bytes);
+        touch(heap, heap_bytes);
+        free(heap);
+        report.heap_bytes = heap_bytes;
+    }
+
+    report.stack_bytes = prefault_stack(stack_bytes);
+    report.faults = faults_since(start);
+
+    RTM_CPRINT("%s, heap %lu, stack %lu: %ld minor / %ld major faults\n",
+               report.locked ? "locked" : "NOT locked",
+               (unsigned long)report.heap_bytes,
+               (unsigned long)report.stack_bytes,
+               report.faults.minor, report.faults.major);
+
+    return report;
+}
+
+size_t
+rt_memory::prefault_stack(size_t bytes)
+{
+    size_t left = stack_left();
+    if (bytes > left)
+    {
+        RTM_DP(DEBUG_1, "stack prefault cut from %lu to %lu bytes\n",
+               (unsigned long)bytes, (unsigned long)left);
+        bytes = left;
+    }
+
+    if (bytes)
+        touch_stack(bytes);
+    return bytes;
+}
+
+fault_count_t
+rt_memory::fault_count(bool this_thread_only)
+{
+    struct rusage usage;
+    if (getrusage(this_thread_only ? RUSAGE_THREAD : RUSAGE_SELF, &usage))
+        RTM_ERROR("getrusage() failed");
+
+    fault_count_t f = { usage.ru_minflt, usage.ru_majflt };
+    return f;
+}
+
+fault_count_t
+rt_memory::faults_since(const fault_count_t &start, bool this_thread_only)
+{
+    fault_count_t now = fault_count(this_thread_only);
+    now.minor -= start.minor;
+    now.major -= start.major;
+    return now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rt_buffer
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    For transparent huge pages the mapping is made a huge page bigger than
+    needed and trimmed to a 2M boundary, since THP only backs aligned 2M
+    pieces.  It's made PROT_NONE and only opened up after the madvise():
+    after mlockall(MCL_FUTURE) a readable mapping is filled in the moment
+    it's made, with small pages, before MADV_HUGEPAGE could say otherwise.
+    Touching every small page afterwards is harmless when it did get huge
+    pages, and needed when it didn't.
+*/
+
+rt_buffer::rt_buffer(size_t bytes, rt_memory::huge_pages_t huge):
+    data_(0),
+    size_(0),
+    huge_(huge)
+{
+    if (!bytes)
+        RTM_RUNTIME("zero length buffer\n");
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    switch (huge)
+    {
+        case rt_memory::HUGE_PAGES_EXPLICIT:
+        {
+            size_ = round_up(bytes, RMC::HUGE_PAGE_BYTES);
+            data_ = mmap(0, size_, PROT_READ | PROT_WRITE,
+                         flags | MAP_HUGETLB, -1, 0);
+            if (data_ == MAP_FAILED)
+            {
+                data_ = 0;
+                RTM_ERROR("no explicit huge pages for %lu bytes: is "
+                          "/proc/sys/vm/nr_hugepages big enough?",
+                          (unsigned long)size_);
+            }
+            break;
+        }
+
+        case rt_memory::HUGE_PAGES_TRANSPARENT:
+        {
+            size_ = round_up(bytes, RMC::HUGE_PAGE_BYTES);
+            size_t mapped = size_ + RMC::HUGE_PAGE_BYTES;
+            char *p = static_cast<char *>(mmap(0, mapped, PROT_NONE,
+                                               flags, -1, 0));
+            if (p == MAP_FAILED)
+                RTM_ERROR("couldn't map %lu bytes", (unsigned long)mapped);
+
+            char *aligned = reinterpret_cast<char *>(
+                    round_up(reinterpret_cast<uintptr_t>(p),
+                             RMC::HUGE_PAGE_BYTES));
+            if (aligned > p)
+                munmap(p, aligned - p);
+            size_t tail = (p + mapped) - (aligned + size_);
+            if (tail)
+                munmap(aligned + size_, tail);
+
+            data_ = aligned;
+            if (madvise(data_, size_, MADV_HUGEPAGE))
+                RTM_DP(DEBUG_1, "madvise(MADV_HUGEPAGE) failed: small pages\n");
+
+            if (mprotect(data_, size_, PROT_READ | PROT_WRITE))
+            {
+                int err = errno;
+                munmap(data_, size_);
+                data_ = 0;
+                errno = err;
+                RTM_ERROR("couldn't open up %lu bytes", (unsigned long)size_);
+            }
+            break;
+        }
+
+        default:
+        {
+            size_ = round_up(bytes, page_size());
+            data_ = mmap(0, size_, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (data_ == MAP_FAILED)
+            {
+                data_ = 0;
+                RTM_ERROR("couldn't map %lu bytes", (unsigned long)size_);
+            }
+            break;
+        }
+    }
+
+    touch(static_cast<volatile char *>(data_), size_);
+}
+
+rt_buffer::~rt_buffer(void)
+{
+    if (data_ && munmap(data_, size_))
+        RTM_REPORT("munmap() of %lu byte buffer failed", (unsigned long)size_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+////////////////////////////////////////////////////////////////////////////////
+
+std::ostream &
+rt_memory::operator <<(std::ostream &o, const fault_count_t &f)
+{
+    o << f.minor << " minor / " << f.major << " major faults";
+    return o;
+}
+
+std::ostream &
+rt_memory::operator <<(std::ostream &o, const memory_report_t &r)
+{
+    o << (r.locked ? "memory locked" : "memory NOT locked")
+      << ", heap " << r.heap_bytes << " bytes, stack " << r.stack_bytes
+      << " bytes prefaulted: " << r.faults;
+    return o;
+}
+
+#undef RTM_NAME
+#undef RTM_MODULE
+#undef RTM_CPRINT
+#undef RTM_VPRINT
+#undef RTM_WARNING
+#undef RTM_ERROR
+#undef RTM_RUNTIME
+#undef RTM_REPORT
+#undef RTM_DP
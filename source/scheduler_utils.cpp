@@ -2,13 +2,18 @@
 
 #include <string>
 
+#include <errno.h>
+#include <string.h>         // memset()
 #include <sys/resource.h>   // setrlimit(), getrlimit()
+#include <sys/syscall.h>    // SYS_sched_setattr
 
 #include "program_IO.h"
+#include "utility.h"
 
 namespace scheduler_name
 {
     const std::string NAME("scheduler utils"); // this name is magic
+    log_module MODULE(NAME);
 }
 
 namespace
@@ -20,8 +25,9 @@ namespace
 }
 
 #define SU_NAME scheduler_name::NAME
-#define SU_CPRINT(fmt, args...) CPRINT_WITH_NAME(SU_NAME, fmt, ## args)
-#define SU_VPRINT(fmt, args...) VPRINT_WITH_NAME(SU_NAME, fmt, ## args)
+#define SU_MODULE scheduler_name::MODULE
+#define SU_CPRINT(fmt, args...) CPRINT_WITH_MODULE(SU_MODULE, SU_NAME, fmt, ## args)
+#define SU_VPRINT(fmt, args...) VPRINT_WITH_MODULE(SU_MODULE, SU_NAME, fmt, ## args)
 #define SU_WARNING(fmt, args...) WARNING_WITH_NAME(SU_NAME, fmt, ## args)
 #define SU_ERROR(fmt, args...) ERROR_WITH_NAME(SU_NAME, fmt, ## args)
 #define SU_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(SU_NAME, fmt, ## args)
@@ -29,6 +35,69 @@ namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Older headers don't know about SCHED_DEADLINE.
+#ifndef SCHED_DEADLINE
+    #define SCHED_DEADLINE 6
+#endif
+
+#ifndef SCHED_RESET_ON_FORK
+    #define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+#ifndef SYS_sched_setattr
+    #if defined(__x86_64__)
+        #define SYS_sched_setattr 314
+    #elif defined(__i386__)
+        #define SYS_sched_setattr 351
+    #endif
+#endif
+
+namespace
+{
+    /**
+        The kernel's struct sched_attr, which glibc doesn't give us: this
+        is the original 48 byte version, which every kernel since 3.14
+        takes.
+    */
+
+    struct deadline_attr
+    {
+        uint32_t size;
+        uint32_t sched_policy;
+        uint64_t sched_flags;
+        int32_t sched_nice;
+        uint32_t sched_priority;
+        uint64_t sched_runtime;
+        uint64_t sched_deadline;
+        uint64_t sched_period;
+    };
+
+    /**
+        'priority' brought within what 'policy' allows.  STATUS_INVALID
+        for a policy other than FIFO or RR.
+    */
+
+    status_t
+    clamp_priority(int &priority, unsigned policy)
+    {
+        if ((policy != SCHED_FIFO) && (policy != SCHED_RR))
+            return make_status(STATUS_INVALID);
+
+        int max_priority = sched_get_priority_max(policy);
+        int min_priority = sched_get_priority_min(policy);
+
+        if ((max_priority == -1) || (min_priority == -1))
+            return make_status(STATUS_SYSTEM, errno);
+
+        if (priority > max_priority)
+            priority = max_priority;
+        else if (priority < min_priority)
+            priority = min_priority;
+
+        return status_ok();
+    }
+}
+
 /**
     The default policy is SCHED_RR (round robin), but FIFO may be supplied
     via 'sched_to_use'.  I'm not allowing NORMAL or BATCH here because I
@@ -36,48 +105,307 @@ namespace
     anyway.  The sched_setscheduler() manpage is illuminating.
 */
 
-void
-set_realtime_priority
+status_t
+try_set_realtime_priority
 (
     int desired_priority,
     pid_t pid,
-    unsigned sched_to_use
+    unsigned sched_to_use,
+    bool reset_on_fork
 )
 {
     int priority = desired_priority;
-    int ret;
 
-    if ((sched_to_use != SCHED_FIFO) && (sched_to_use != SCHED_RR))
-        SU_RUNTIME("Illegal scheduler type %u not FIFO or round robin",
-                   sched_to_use);
+    status_t s = clamp_priority(priority, sched_to_use);
+    if (!s.ok())
+        return s;
 
-    int max_priority = sched_get_priority_max(sched_to_use);
-    int min_priority = sched_get_priority_min(sched_to_use);
+    struct sched_param priority_params;
+    priority_params.sched_priority = priority;
 
-    if ((max_priority == -1) || (min_priority == -1))
-        SU_ERROR("Bad priorities returned by sched_get_priority_*.");
+    int policy = sched_to_use | (reset_on_fork ? SCHED_RESET_ON_FORK : 0);
+    if (sched_setscheduler(pid, policy, &priority_params) == -1)
+        return make_status((errno == EPERM) ? STATUS_NOT_ALLOWED
+                                            : STATUS_SYSTEM, errno);
+
+    return status_ok();
+}
 
-    // Do we have to adjust 'priority' from desired_priority based on limits?
-    if ((max_priority < priority) && (min_priority < priority))
+namespace
+{
+    /**
+        The checks and notes the throwing versions share: the priority
+        that'll actually be used.
+    */
+
+    int
+    checked_priority(int desired_priority, unsigned sched_to_use)
     {
-        SU_CPRINT("Priority cap at %d, using instead of %d\n",
-               max_priority, desired_priority);
-        priority = max_priority;
-    } else if ((min_priority > priority) && (max_priority > priority))
+        int priority = desired_priority;
+
+        status_t s = clamp_priority(priority, sched_to_use);
+        if (s.code == STATUS_INVALID)
+            SU_RUNTIME("Illegal scheduler type %u not FIFO or round robin",
+                       sched_to_use);
+        if (!s.ok())
+        {
+            errno = s.error;
+            SU_ERROR("Bad priorities returned by sched_get_priority_*.");
+        }
+
+        if (priority < desired_priority)
+            SU_CPRINT("Priority cap at %d, using instead of %d\n",
+                      priority, desired_priority);
+        else if (priority > desired_priority)
+            SU_CPRINT("Priority raised from %d to minimum priority of %d\n",
+                      desired_priority, priority);
+
+        return priority;
+    }
+
+    struct priority_request
+    {
+        int priority;
+        unsigned sched_to_use;
+        bool reset_on_fork;
+    };
+
+    status_t
+    priority_action(pid_t tid, void *arg)
+    {
+        const priority_request *r = static_cast<priority_request *>(arg);
+        return try_set_realtime_priority(r->priority, tid, r->sched_to_use,
+                                         r->reset_on_fork);
+    }
+}
+
+void
+set_realtime_priority
+(
+    int desired_priority,
+    pid_t pid,
+    unsigned sched_to_use,
+    bool reset_on_fork
+)
+{
+    int priority = checked_priority(desired_priority, sched_to_use);
+
+    status_t s = try_set_realtime_priority(priority, pid, sched_to_use,
+                                           reset_on_fork);
+    if (!s.ok())
     {
-        // pretty unlikely, but who knows?
-        SU_CPRINT("Priority raised from %d to minimum priority of %d\n",
-               desired_priority, min_priority);
-        priority = min_priority;
+        errno = s.error;
+        SU_ERROR("sched_setscheduler failed for pid %d prio %d",
+                 pid, priority);
     }
+}
+
+/**
+    pthread_setschedparam() rather than sched_setscheduler() on the
+    thread's id, so glibc's idea of the thread's policy stays right.
+*/
+
+status_t
+try_set_thread_realtime_priority
+(
+    pthread_t thread,
+    int desired_priority,
+    unsigned sched_to_use,
+    bool reset_on_fork
+)
+{
+    int priority = desired_priority;
+
+    status_t s = clamp_priority(priority, sched_to_use);
+    if (!s.ok())
+        return s;
 
     struct sched_param priority_params;
     priority_params.sched_priority = priority;
 
-    ret = sched_setscheduler (pid, sched_to_use, &priority_params);
-    if (ret == -1)
-        SU_ERROR("sched_setscheduler failed for pid %d prio %d",
-                    pid, priority);
+    int policy = sched_to_use | (reset_on_fork ? SCHED_RESET_ON_FORK : 0);
+    int ret = pthread_setschedparam(thread, policy, &priority_params);
+    if (ret)
+        return make_status((ret == EPERM) ? STATUS_NOT_ALLOWED
+                                          : STATUS_SYSTEM, ret);
+
+    return status_ok();
+}
+
+void
+set_thread_realtime_priority
+(
+    pthread_t thread,
+    int desired_priority,
+    unsigned sched_to_use,
+    bool reset_on_fork
+)
+{
+    int priority = checked_priority(desired_priority, sched_to_use);
+
+    status_t s = try_set_thread_realtime_priority(thread, priority,
+                                                  sched_to_use, reset_on_fork);
+    if (!s.ok())
+    {
+        errno = s.error;
+        SU_ERROR("pthread_setschedparam failed: prio %d", priority);
+    }
+}
+
+/**
+    for_each_thread() relies on new threads inheriting the change from the
+    thread that started them, and with SCHED_RESET_ON_FORK they don't.  So
+    with 'reset_on_fork' the first walk leaves it off, which gets every
+    thread, and a second walk ORs it in.
+*/
+
+unsigned int
+set_process_realtime_priority
+(
+    int desired_priority,
+    pid_t pid,
+    unsigned sched_to_use,
+    bool reset_on_fork
+)
+{
+    priority_request r;
+    r.priority = checked_priority(desired_priority, sched_to_use);
+    r.sched_to_use = sched_to_use;
+    r.reset_on_fork = false;
+
+    unsigned int count = 0;
+    status_t s = utility::for_each_thread(pid, priority_action, &r, &count);
+    if (s.ok() && reset_on_fork)
+    {
+        r.reset_on_fork = true;
+        count = 0;
+        s = utility::for_each_thread(pid, priority_action, &r, &count);
+    }
+    if (!s.ok())
+    {
+        errno = s.error;
+        SU_ERROR("setting prio %d for the threads of process %d failed "
+                 "(%u done)", r.priority, pid, count);
+    }
+
+    SU_CPRINT("Priority %d set for %u threads of process %d\n",
+              r.priority, count, pid);
+    return count;
+}
+
+/**
+    Checks the parameters first so STATUS_INVALID means we didn't even ask;
+    the kernel checks the same things (and more) itself.  What comes back
+    from sched_setattr():
+
+        EBUSY   admission control: not enough bandwidth left
+        EPERM   no CAP_SYS_NICE, or affinity narrower than the root domain
+        EINVAL  parameters it doesn't like (or flags it doesn't know)
+        ENOSYS  a kernel without SCHED_DEADLINE
+*/
+
+status_t
+try_set_deadline_scheduling
+(
+    uint64_t runtime,
+    uint64_t deadline,
+    uint64_t period,
+    pid_t tid,
+    unsigned int flags
+)
+{
+    if ((runtime < SCC::MIN_DEADLINE_RUNTIME) || (runtime > deadline)
+        || (period && (deadline > period)))
+    {
+        return make_status(STATUS_INVALID);
+    }
+
+#ifdef SYS_sched_setattr
+    deadline_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    attr.sched_flags = flags;
+    attr.sched_runtime = runtime;
+    attr.sched_deadline = deadline;
+    attr.sched_period = period;
+
+    if (!syscall(SYS_sched_setattr, tid, &attr, 0))
+        return status_ok();
+
+    switch (errno)
+    {
+        case EBUSY:
+            return make_status(STATUS_NO_CAPACITY, errno);
+        case EPERM:
+            return make_status(STATUS_NOT_ALLOWED, errno);
+        case EINVAL:
+            return make_status(STATUS_INVALID, errno);
+        default:
+            return make_status(STATUS_SYSTEM, errno);
+    }
+#else
+    return make_status(STATUS_SYSTEM, ENOSYS);
+#endif
+}
+
+void
+set_deadline_scheduling
+(
+    uint64_t runtime,
+    uint64_t deadline,
+    uint64_t period,
+    pid_t tid,
+    unsigned int flags
+)
+{
+    status_t s = try_set_deadline_scheduling(runtime, deadline, period, tid,
+                                             flags);
+    if (s.ok())
+    {
+        SU_CPRINT("SCHED_DEADLINE: %llu ns every %llu ns, deadline %llu ns\n",
+                  (unsigned long long)runtime,
+                  (unsigned long long)(period ? period : deadline),
+                  (unsigned long long)deadline);
+        return;
+    }
+
+    errno = s.error;
+    switch (s.code)
+    {
+        case STATUS_INVALID:
+            if (!s.error)
+                SU_RUNTIME("bad SCHED_DEADLINE parameters: need %d <= runtime "
+                           "(%llu) <= deadline (%llu) <= period (%llu)",
+                           SCC::MIN_DEADLINE_RUNTIME,
+                           (unsigned long long)runtime,
+                           (unsigned long long)deadline,
+                           (unsigned long long)period);
+            SU_ERROR("kernel refused SCHED_DEADLINE parameters or flags 0x%x",
+                     flags);
+        case STATUS_NO_CAPACITY:
+            SU_ERROR("SCHED_DEADLINE admission control refused %llu ns every "
+                     "%llu ns: not enough bandwidth left on this root domain",
+                     (unsigned long long)runtime,
+                     (unsigned long long)(period ? period : deadline));
+        case STATUS_NOT_ALLOWED:
+            SU_ERROR("not allowed to use SCHED_DEADLINE for tid %d: needs "
+                     "CAP_SYS_NICE, and affinity for the whole root domain",
+                     tid);
+        default:
+            SU_ERROR("sched_setattr(SCHED_DEADLINE) failed for tid %d", tid);
+    }
+}
+
+/**
+    Under SCHED_DEADLINE, sched_yield() means "this job's finished": the
+    thread is throttled until its next period, with a full runtime then.
+*/
+
+void
+deadline_yield(void)
+{
+    sched_yield();
 }
 
 /**
@@ -86,6 +414,10 @@ set_realtime_priority
     it does, and I am just confused.
 
     Now uses exceptions for errors, rather than boolean values.
+
+    Linux accepts RLIMIT_RSS and then ignores it: nothing is ever limited.
+    Left here for old callers; memory_budget (or cpuset_manager's
+    set_memory_budget()) is the one that works.
 */
 
 void
@@ -125,6 +457,7 @@ set_core_limit(uint64_t megabytes)
 }
 
 #undef SU_NAME
+#undef SU_MODULE
 #undef SU_CPRINT
 #undef SU_VPRINT
 #undef SU_WARNING
@@ -0,0 +1,199 @@
+#include "shared_nap.h"
+#include "program_IO.h"
+#include "utility.h"
+
+#include <sys/mman.h>               // shm_open(), mmap()
+#include <sys/stat.h>
+#include <fcntl.h>                  // O_* constants
+#include <unistd.h>                 // ftruncate(), close()
+#include <errno.h>
+
+namespace shared_nap_name
+{
+    const std::string NAME("shared_nap");
+    log_module MODULE(NAME);
+}
+
+#define SN_NAME shared_nap_name::NAME
+#define SN_MODULE shared_nap_name::MODULE
+#define SN_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(SN_MODULE, SN_NAME, fmt, ## args)
+#define SN_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(SN_MODULE, SN_NAME, fmt, ## args)
+#define SN_WARNING(fmt, args...) WARNING_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_ERROR(fmt, args...) ERROR_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_REPORT(fmt, args...) REPORT_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_WARNING_LIMITED(fmt, args...) WARNING_LIMITED_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_REPORT_LIMITED(fmt, args...) REPORT_LIMITED_WITH_NAME(SN_NAME, fmt, ## args)
+#define SN_DP(level, fmt, args...) DP_WITH_MODULE(SN_MODULE, level, SN_NAME, fmt, ## args)
+
+namespace
+{
+    enum
+    {
+        IDLE = 0,           // values of the futex word
+        WAKE_PENDING = 1,
+
+        SIZE_TRIES = 100,   // attaching while the creator is mid-setup
+        SIZE_RETRY_US = 100
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructors and Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Create (or attach to) a POSIX shared memory object holding just the
+    futex word.  The creator sets it up and unlinks it on destruction.
+    Attaching before the creator has made the object fails with ENOENT.
+
+    The object exists, zero length, between the creator's shm_open() and
+    its ftruncate(), and touching a mapping of it then is a SIGBUS.  So an
+    attacher checks the size first, and gives the creator a few ms to
+    finish before giving up.  ftruncate() zero fills, so the word is
+    already IDLE the moment it's big enough.
+*/
+
+shared_nap::shared_nap
+(
+    const std::string &shm_name,
+    bool create,
+    const std::string &name
+):
+    name_(name),
+    shm_name_(shm_name),
+    owner_(create),
+    word_(0)
+{
+    int flags = create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR;
+    int fd = shm_open(C(shm_name_), flags, 0600);
+    if (fd == -1)
+        SN_ERROR("'%s': shm_open of '%s'", C(name_), C(shm_name_));
+
+    if (create && ftruncate(fd, sizeof(int)))
+    {
+        close(fd);
+        shm_unlink(C(shm_name_));
+        SN_ERROR("'%s': sizing '%s'", C(name_), C(shm_name_));
+    }
+
+    for (unsigned tries = 0; !create; ++tries)
+    {
+        struct stat status;
+        if (fstat(fd, &status))
+        {
+            close(fd);
+            SN_ERROR("'%s': fstat of '%s'", C(name_), C(shm_name_));
+        }
+
+        if (status.st_size >= static_cast<off_t>(sizeof(int)))
+            break;
+
+        if (tries == SIZE_TRIES)
+        {
+            close(fd);
+            SN_RUNTIME("'%s': '%s' is still empty: its creator never "
+                       "finished setting it up", C(name_), C(shm_name_));
+        }
+        usleep(SIZE_RETRY_US);
+    }
+
+    void *where = mmap(0, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+    close(fd);
+    if (where == MAP_FAILED)
+    {
+        if (create)
+            shm_unlink(C(shm_name_));
+        SN_ERROR("'%s': mmap of '%s'", C(name_), C(shm_name_));
+    }
+
+    // Not set to IDLE here: it already is, and an attacher that got in
+    // after the ftruncate() may have posted a wake-up since.
+    word_ = static_cast<volatile int *>(where);
+}
+
+/**
+    Use an int the caller has already placed in shared memory (a
+    MAP_SHARED mapping, a SysV segment, whatever).  Exactly one party
+    should pass 'initialize' == true, before anybody uses it.
+*/
+
+shared_nap::shared_nap
+(
+    volatile int *word,
+    bool initialize,
+    const std::string &name
+):
+    name_(name),
+    shm_name_(),
+    owner_(false),
+    word_(word)
+{
+    if (!word_)
+        SN_RUNTIME("'%s': null futex word", C(name_));
+
+    if (initialize)
+        *word_ = IDLE;
+}
+
+shared_nap::~shared_nap(void)
+{
+    if (shm_name_.empty())
+        return;
+
+    if (munmap(const_cast<int *>(word_), sizeof(int)))
+        SN_REPORT_LIMITED("Cannot unmap '%s' for '%s'", C(shm_name_), C(name_));
+
+    if (owner_ && shm_unlink(C(shm_name_)))
+        SN_REPORT_LIMITED("Cannot unlink '%s' for '%s'", C(shm_name_),
+                          C(name_));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    Consume a pending wakeup, or sleep until there is one.  Only sleeps in
+    the kernel while the word reads IDLE, so a wake_up() that lands
+    between the check and the futex call isn't lost.
+*/
+
+void
+shared_nap::block(void)
+{
+    while (!__sync_bool_compare_and_swap(word_, WAKE_PENDING, IDLE))
+    {
+        int ret = utility::futex_wait(word_, IDLE, true);
+        if (ret && (errno != EAGAIN) && (errno != EINTR))
+            SN_ERROR("futex wait for '%s'", C(name_));
+    }
+}
+
+/**
+    Only bother the kernel if we're the one that flipped the word: if it
+    was already pending, the previous waker took care of it.
+*/
+
+void
+shared_nap::wake_up(void)
+{
+    if (__sync_lock_test_and_set(word_, WAKE_PENDING) == IDLE)
+    {
+        if (utility::futex_wake(word_, 1, true) == -1)
+            SN_ERROR("futex wake for '%s'", C(name_));
+    }
+}
+
+#undef SN_NAME
+#undef SN_MODULE
+#undef SN_CPRINT
+#undef SN_VPRINT
+#undef SN_WARNING
+#undef SN_ERROR
+#undef SN_RUNTIME
+#undef SN_REPORT
+#undef SN_WARNING_LIMITED
+#undef SN_REPORT_LIMITED
+#undef SN_DP
@@ -0,0 +1,36 @@
+#include "status.h"
+
+#include <ostream>
+
+#include <string.h>                 // strerror()
+
+const char *
+status_name(status_code_t code)
+{
+    switch (code)
+    {
+        case STATUS_OK:
+            return "ok";
+        case STATUS_INVALID:
+            return "invalid argument";
+        case STATUS_NOT_ALLOWED:
+            return "not allowed";
+        case STATUS_NOT_FOUND:
+            return "not found";
+        case STATUS_NO_CAPACITY:
+            return "no capacity";
+        case STATUS_SYSTEM:
+            return "system call failed";
+    }
+
+    return "unknown status";
+}
+
+std::ostream &
+operator <<(std::ostream &o, const status_t &s)
+{
+    o << status_name(s.code);
+    if (s.error)
+        o << ": " << strerror(s.error);
+    return o;
+}
@@ -0,0 +1,642 @@
+#include "thread_pool.h"
+#include "cpuset.h"
+#include "cpuset_manager.h"
+#include "ring_queue.h"
+#include "scheduler_utils.h"
+#include "program_IO.h"
+#include "utility.h"
+
+#include <algorithm>                // std::sort
+#include <exception>
+#include <limits.h>                 // INT_MAX
+#include <stdio.h>                  // fopen(), fscanf()
+#include <stdlib.h>                 // abs()
+#include <errno.h>
+
+namespace thread_pool_name
+{
+    const std::string NAME("thread_pool");
+    log_module MODULE(NAME);
+}
+
+#define TP_NAME thread_pool_name::NAME
+#define TP_MODULE thread_pool_name::MODULE
+#define TP_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(TP_MODULE, TP_NAME, fmt, ## args)
+#define TP_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(TP_MODULE, TP_NAME, fmt, ## args)
+#define TP_WARNING(fmt, args...) WARNING_WITH_NAME(TP_NAME, fmt, ## args)
+#define TP_ERROR(fmt, args...) ERROR_WITH_NAME(TP_NAME, fmt, ## args)
+#define TP_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(TP_NAME, fmt, ## args)
+#define TP_REPORT(fmt, args...) REPORT_WITH_NAME(TP_NAME, fmt, ## args)
+#define TP_DP(level, fmt, args...) DP_WITH_MODULE(TP_MODULE, level, TP_NAME, fmt, ## args)
+
+namespace
+{
+    enum
+    {
+        INBOX_BATCH = 32,       // max tasks moved from inbox per trip
+        MAX_PATH_LENGTH = 128
+    };
+
+    const std::string TOPOLOGY_PATH("/sys/devices/system/cpu/cpu");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Chase-Lev deque
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+/**
+    Fixed-size Chase-Lev work-stealing deque.  The owning worker pushes and
+    takes at the bottom without any atomic ops unless it's racing a thief
+    for the very last task; thieves take from the top with a
+    compare-and-swap.
+
+    Doesn't grow: push() fails when it's full and the caller has to cope.
+*/
+
+class work_deque
+{
+
+private:
+
+    volatile long top_;         // thieves' end
+    char pad0_[RQC::CACHE_LINE - sizeof(long)];
+    volatile long bottom_;      // owner's end
+    char pad1_[RQC::CACHE_LINE - sizeof(long)];
+
+    long mask_;
+    pool_task *tasks_;
+
+private:    // not possible
+
+    work_deque(const work_deque &d);
+    work_deque &operator =(const work_deque &d);
+
+public:
+
+    explicit work_deque(long size):
+        top_(0),
+        bottom_(0),
+        mask_(size - 1),
+        tasks_(new pool_task[size])
+    {
+    }
+
+    ~work_deque(void) { delete [] tasks_; }
+
+    // Owner only.  May underestimate, never over.
+    long room(void) const { return mask_ + 1 - (bottom_ - top_); }
+
+    // Owner only.
+    bool
+    push(const pool_task &task)
+    {
+        long b = bottom_;
+        if (b - top_ > mask_)
+            return false;
+
+        tasks_[b & mask_] = task;
+        utility::compiler_barrier();    // task before publishing it
+        bottom_ = b + 1;
+        return true;
+    }
+
+    // Owner only.
+    bool
+    take(pool_task *task)
+    {
+        long b = bottom_ - 1;
+        bottom_ = b;
+        __sync_synchronize();           // store bottom before reading top
+        long t = top_;
+
+        if (t > b)                      // empty
+        {
+            bottom_ = b + 1;
+            return false;
+        }
+
+        *task = tasks_[b & mask_];
+        if (t != b)                     // more than one left: no contest
+            return true;
+
+        // Last one: race any thieves for it.
+        bool won = __sync_bool_compare_and_swap(&top_, t, t + 1);
+        bottom_ = b + 1;
+        return won;
+    }
+
+    // Anybody.  A guess, as soon as it's made.
+    bool looks_empty(void) const { return bottom_ - top_ <= 0; }
+
+    // Anybody.
+    bool
+    steal(pool_task *task)
+    {
+        long t = top_;
+        utility::compiler_barrier();    // top before bottom
+        long b = bottom_;
+        if (t >= b)
+            return false;
+
+        *task = tasks_[t & mask_];
+        return __sync_bool_compare_and_swap(&top_, t, t + 1);
+    }
+};
+
+/**
+    Read an integer out of a CPU's sysfs topology directory.  -1 if we
+    can't: old kernels don't have it, and then everybody looks equally far
+    away.
+*/
+
+int
+read_topology(cpuid_t cpu, const char *field)
+{
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s%u/topology/%s",
+             C(TOPOLOGY_PATH), cpu, field);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    int value;
+    if (fscanf(f, "%d", &value) != 1)
+        value = -1;
+    fclose(f);
+    return value;
+}
+
+}   // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// Per-worker state
+////////////////////////////////////////////////////////////////////////////////
+
+struct pool_worker
+{
+    thread_pool *pool;
+    unsigned int index;
+    cpuid_t cpu;
+    int package;
+    int core;
+
+    pthread_t thread;
+    bool running;               //* pthread_create() worked
+    bool failed;                //* couldn't pin or set priority
+    volatile int *ready;        //* startup count, bumped once we're set
+
+    work_deque deque;
+    mpsc_ring<pool_task> inbox;
+    volatile int inbox_busy;            //* held by whoever is popping it
+    std::vector<unsigned int> victims;  //* other workers, nearest first
+
+    pool_worker(thread_pool *p, unsigned int i, cpuid_t c,
+                volatile int *r):
+        pool(p),
+        index(i),
+        cpu(c),
+        package(read_topology(c, "physical_package_id")),
+        core(read_topology(c, "core_id")),
+        thread(),
+        running(false),
+        failed(false),
+        ready(r),
+        deque(TPC::DEQUE_SIZE),
+        inbox(TPC::INBOX_SIZE),
+        inbox_busy(0),
+        victims()
+    {
+    }
+};
+
+namespace
+{
+
+// Which worker, if any, is the calling thread.
+__thread pool_worker *current_worker = 0;
+
+/**
+    0: hyperthread siblings, 1: same package, 2: different package.
+*/
+
+int
+distance(const pool_worker *a, const pool_worker *b)
+{
+    if ((a->package != b->package) || (a->package == -1))
+        return 2;
+    if ((a->core == b->core) && (a->core != -1))
+        return 0;
+    return 1;
+}
+
+/**
+    Sort victims by topology distance from 'from', and by CPU number after
+    that so neighbors in the numbering get tried first.
+*/
+
+struct victim_order
+{
+    const std::vector<pool_worker *> &workers;
+    const pool_worker *from;
+
+    victim_order(const std::vector<pool_worker *> &w, const pool_worker *f):
+        workers(w),
+        from(f)
+    {
+    }
+
+    bool operator ()(unsigned int a, unsigned int b) const
+    {
+        int da = distance(from, workers[a]);
+        int db = distance(from, workers[b]);
+        if (da != db)
+            return da < db;
+
+        int ca = static_cast<int>(workers[a]->cpu) - static_cast<int>(from->cpu);
+        int cb = static_cast<int>(workers[b]->cpu) - static_cast<int>(from->cpu);
+        return abs(ca) < abs(cb);
+    }
+};
+
+}   // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructors and Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    'rt_priority' of TPC::NO_RT_PRIORITY leaves the workers alone;
+    otherwise it and 'sched_to_use' get handed to set_realtime_priority()
+    from each worker.
+
+    Doesn't return until every worker is pinned and running.  If any of
+    them couldn't be pinned or prioritized, the whole pool is torn down
+    again and we throw.
+*/
+
+thread_pool::thread_pool
+(
+    const cpuset &set,
+    int rt_priority,
+    unsigned sched_to_use,
+    const std::string &name
+):
+    name_(name),
+    rt_priority_(rt_priority),
+    sched_(sched_to_use),
+    workers_(),
+    work_available_(name),
+    pending_(0),
+    idle_waiters_(0),
+    stopping_(0),
+    submit_cursor_(0)
+{
+    start(set);
+}
+
+thread_pool::thread_pool
+(
+    const cpuset_manager &manager,
+    const std::string &set_name,
+    int rt_priority,
+    unsigned sched_to_use,
+    const std::string &name
+):
+    name_(name),
+    rt_priority_(rt_priority),
+    sched_(sched_to_use),
+    workers_(),
+    work_available_(name),
+    pending_(0),
+    idle_waiters_(0),
+    stopping_(0),
+    submit_cursor_(0)
+{
+    start(manager.get_set(set_name));
+}
+
+/**
+    Workers finish whatever is still queued before they exit.
+*/
+
+thread_pool::~thread_pool(void)
+{
+    stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal
+////////////////////////////////////////////////////////////////////////////////
+
+void
+thread_pool::start(const cpuset &set)
+{
+    const cpu_vector_t &CPUs = set.CPUs();
+    if (CPUs.empty())
+        TP_RUNTIME("'%s': cpuset '%s' has no CPUs", C(name_), C(set.name()));
+
+    volatile int ready = 0;
+
+    workers_.reserve(CPUs.size());
+    for (unsigned int i = 0; i < CPUs.size(); ++i)
+        workers_.push_back(new pool_worker(this, i, CPUs[i], &ready));
+
+    for (unsigned int i = 0; i < workers_.size(); ++i)
+        order_victims(workers_[i]);
+
+    int started = 0;
+    for (unsigned int i = 0; i < workers_.size(); ++i, ++started)
+    {
+        pool_worker *w = workers_[i];
+        int ret = pthread_create(&w->thread, 0, worker_main, w);
+        if (ret)
+        {
+            errno = ret;
+            TP_REPORT("'%s': couldn't start worker for CPU %u",
+                      C(name_), w->cpu);
+            break;
+        }
+        w->running = true;
+    }
+
+    int r;
+    while ((r = ready) < started)
+        utility::futex_wait(&ready, r);
+
+    bool failed = (started < static_cast<int>(workers_.size()));
+    for (unsigned int i = 0; i < workers_.size(); ++i)
+        failed = failed || workers_[i]->failed;
+
+    if (failed)
+    {
+        stop();
+        TP_RUNTIME("'%s': couldn't set up all workers on cpuset '%s'",
+                   C(name_), C(set.name()));
+    }
+
+    TP_CPRINT("'%s': %u workers running on cpuset '%s'\n",
+              C(name_), size(), C(set.name()));
+}
+
+/**
+    Workers that never got started are still on the list, since the others
+    may have been looking at their (empty) deques.
+*/
+
+void
+thread_pool::stop(void)
+{
+    stopping_ = 1;
+    work_available_.broadcast();
+
+    for (unsigned int i = 0; i < workers_.size(); ++i)
+    {
+        if (!workers_[i]->running)
+            continue;
+
+        int ret = pthread_join(workers_[i]->thread, 0);
+        if (ret)
+        {
+            errno = ret;
+            TP_REPORT("'%s': couldn't join worker %u", C(name_), i);
+        }
+    }
+
+    for (unsigned int i = 0; i < workers_.size(); ++i)
+        delete workers_[i];
+    workers_.clear();
+}
+
+void
+thread_pool::order_victims(pool_worker *w)
+{
+    for (unsigned int i = 0; i < workers_.size(); ++i)
+        if (i != w->index)
+            w->victims.push_back(i);
+
+    std::sort(w->victims.begin(), w->victims.end(),
+              victim_order(workers_, w));
+}
+
+/**
+    pthread entry point.  Pin, maybe go realtime, check in with the
+    constructor, then get to work.  If something went wrong the
+    constructor will see 'failed' and shut everybody down again.
+*/
+
+void *
+thread_pool::worker_main(void *arg)
+{
+    pool_worker *w = static_cast<pool_worker *>(arg);
+    thread_pool *pool = w->pool;
+
+    try
+    {
+        utility::run_on_cpu(w->cpu, 0);
+        if (pool->rt_priority_ != TPC::NO_RT_PRIORITY)
+            set_realtime_priority(pool->rt_priority_, 0, pool->sched_);
+    } catch (std::exception &)
+    {
+        w->failed = true;
+    }
+
+    __sync_fetch_and_add(w->ready, 1);
+    utility::futex_wake(w->ready, 1);
+
+    pool->run_worker(w);
+    return 0;
+}
+
+void
+thread_pool::run_worker(pool_worker *w)
+{
+    current_worker = w;
+
+    pool_task task;
+    for ( ; ; )
+    {
+        if (find_work(w, &task))
+        {
+            run_task(w, task);
+            continue;
+        }
+
+        // Grab the generation before the last look, so a submit() that
+        // lands after the look still wakes us.
+        int generation = work_available_.generation();
+        if (find_work(w, &task))
+        {
+            run_task(w, task);
+            continue;
+        }
+
+        if (stopping_)
+            break;
+
+        work_available_.wait(generation);
+    }
+
+    current_worker = 0;
+}
+
+/**
+    Own deque first, then whatever has arrived in our inbox (moved onto the
+    deque so it can be stolen), then the neighbors, nearest first: their
+    deques, or their inboxes if the deques are empty.
+
+    Another sleeper is woken when we come away from somewhere that still
+    has work in it, so work spreads one worker at a time rather than
+    everybody being woken for every task.
+*/
+
+bool
+thread_pool::find_work(pool_worker *w, pool_task *task)
+{
+    if (w->deque.take(task))
+        return true;
+
+    if (drain_inbox(w, w, task))
+        return true;
+
+    for (unsigned int i = 0; i < w->victims.size(); ++i)
+    {
+        pool_worker *victim = workers_[w->victims[i]];
+        if (victim->deque.steal(task))
+        {
+            if (!victim->deque.looks_empty())
+                work_available_.signal();
+            return true;
+        }
+
+        if (victim->deque.looks_empty() && drain_inbox(victim, w, task))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+    Move a batch out of 'from's inbox onto 'to's deque, keeping the first
+    task for ourselves.  'to' has to be the calling worker: it's the only
+    one allowed to push on its deque.  The mpsc_ring only takes one
+    consumer at a time, so whoever gets 'inbox_busy' pops and everybody
+    else moves on.
+*/
+
+bool
+thread_pool::drain_inbox(pool_worker *from, pool_worker *to, pool_task *task)
+{
+    if (from->inbox_busy || __sync_lock_test_and_set(&from->inbox_busy, 1))
+        return false;
+
+    pool_task batch[INBOX_BATCH];
+    long room = to->deque.room() + 1;
+    unsigned long n = from->inbox.pop_batch(batch,
+                                            room < INBOX_BATCH ? room
+                                                               : INBOX_BATCH);
+    __sync_lock_release(&from->inbox_busy);
+
+    if (!n)
+        return false;
+
+    *task = batch[0];
+    for (unsigned long i = 1; i < n; ++i)
+        to->deque.push(batch[i]);
+    if (n > 1)
+        work_available_.signal();           // one more, to steal the rest
+    return true;
+}
+
+void
+thread_pool::run_task(pool_worker *w, const pool_task &task)
+{
+    try
+    {
+        task.function(task.arg);
+    } catch (std::exception &e)
+    {
+        TP_WARNING("'%s': task on CPU %u threw: %s\n",
+                   C(name_), w->cpu, e.what());
+    } catch (...)
+    {
+        TP_WARNING("'%s': task on CPU %u threw something odd\n",
+                   C(name_), w->cpu);
+    }
+
+    if ((__sync_sub_and_fetch(&pending_, 1) == 0) && idle_waiters_)
+        utility::futex_wake(&pending_, INT_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+    From one of our own workers the task goes on that worker's deque.  From
+    anywhere else it goes into the next worker's inbox, round robin.  If
+    every inbox is full we yield and try again, which is the only time
+    submit() waits.
+*/
+
+void
+thread_pool::submit(task_function_t function, void *arg)
+{
+    if (stopping_)
+        TP_RUNTIME("'%s': submit() on a pool that's shutting down", C(name_));
+
+    pool_task task(function, arg);
+    __sync_fetch_and_add(&pending_, 1);
+
+    if (current_worker && (current_worker->pool == this)
+        && current_worker->deque.push(task))
+    {
+        work_available_.signal();
+        return;
+    }
+
+    unsigned int start = __sync_fetch_and_add(&submit_cursor_, 1);
+    for ( ; ; )
+    {
+        for (unsigned int i = 0; i < workers_.size(); ++i)
+        {
+            pool_worker *w = workers_[(start + i) % workers_.size()];
+            if (w->inbox.push(task))
+            {
+                work_available_.signal();
+                return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/**
+    Block until everything submitted so far has finished.  Don't call this
+    from inside a task: the task itself counts as unfinished.
+*/
+
+void
+thread_pool::wait_idle(void)
+{
+    __sync_fetch_and_add(&idle_waiters_, 1);
+
+    int pending;
+    while ((pending = pending_) != 0)
+        utility::futex_wait(&pending_, pending);
+
+    __sync_fetch_and_sub(&idle_waiters_, 1);
+}
+
+#undef TP_NAME
+#undef TP_MODULE
+#undef TP_CPRINT
+#undef TP_VPRINT
+#undef TP_WARNING
+#undef TP_ERROR
+#undef TP_RUNTIME
+#undef TP_REPORT
+#undef TP_DP
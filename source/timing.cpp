@@ -14,16 +14,18 @@
 namespace timing_name
 {
     const std::string NAME("timing");
+    log_module MODULE(NAME);
 }
 
 #define TIME_NAME timing_name::NAME
-#define TIME_CPRINT(fmt, args...)  CPRINT_WITH_NAME(TIME_NAME, fmt, ## args)
-#define TIME_VPRINT(fmt, args...)  VPRINT_WITH_NAME(TIME_NAME, fmt, ## args)
+#define TIME_MODULE timing_name::MODULE
+#define TIME_CPRINT(fmt, args...)  CPRINT_WITH_MODULE(TIME_MODULE, TIME_NAME, fmt, ## args)
+#define TIME_VPRINT(fmt, args...)  VPRINT_WITH_MODULE(TIME_MODULE, TIME_NAME, fmt, ## args)
 #define TIME_WARNING(fmt, args...) WARNING_WITH_NAME(TIME_NAME, fmt, ## args)
 #define TIME_ERROR(fmt, args...) ERROR_WITH_NAME(TIME_NAME, fmt, ## args)
 #define TIME_RUNTIME(fmt, args...) RUNTIME_WITH_NAME(TIME_NAME, fmt, ## args)
 #define TIME_REPORT(fmt, args...) REPORT_WITH_NAME(TIME_NAME, fmt, ## args)
-#define TIME_DP(level, fmt, args...) DP(level, TIME_NAME, fmt, ## args)
+#define TIME_DP(level, fmt, args...) DP_WITH_MODULE(TIME_MODULE, level, TIME_NAME, fmt, ## args)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Globals
@@ -147,6 +149,7 @@ busy_delay(double seconds)
 }
 
 #undef TIME_NAME
+#undef TIME_MODULE
 #undef TIME_CPRINT
 #undef TIME_VPRINT
 #undef TIME_WARNING
@@ -1,22 +1,30 @@
 #include "utility.h"
 #include "program_IO.h"
-#include <unistd.h>                 // sysconf
+#include <unistd.h>                 // sysconf, syscall
+#include <sys/syscall.h>            // SYS_futex
+#include <linux/futex.h>            // FUTEX_WAIT, FUTEX_WAKE
+#include <errno.h>
+#include <dirent.h>                 // opendir(), readdir()
+#include <stdlib.h>                 // strtol()
 
+#include <set>
 #include <string>
 
-namespace cpuset_name
+namespace utility_name
 {
-    const std::string NAME("cpuset");
+    const std::string NAME("utility");
+    log_module MODULE(NAME);
 }
 
-#define UTIL_NAME cpuset_name::NAME
-#define UTIL_CPRINT(fmt, ...)  CPRINT_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__)
-#define UTIL_VPRINT(fmt, ...)  VPRINT_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__)
+#define UTIL_NAME utility_name::NAME
+#define UTIL_MODULE utility_name::MODULE
+#define UTIL_CPRINT(fmt, ...)  CPRINT_WITH_MODULE(UTIL_MODULE, UTIL_NAME, fmt, ##__VA_ARGS__)
+#define UTIL_VPRINT(fmt, ...)  VPRINT_WITH_MODULE(UTIL_MODULE, UTIL_NAME, fmt, ##__VA_ARGS__)
 #define UTIL_WARNING(fmt, ...) WARNING_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__)
 #define UTIL_ERROR(fmt, ...) ERROR_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__)
 #define UTIL_RUNTIME(fmt, ...) RUNTIME_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__)
 #define UTIL_REPORT(fmt, ...) REPORT_WITH_NAME(UTIL_NAME, fmt, ##__VA_ARGS__);
-#define UTIL_DP(level, fmt, ...) DP(level, UTIL_NAME, fmt, ##__VA_ARGS__)
+#define UTIL_DP(level, fmt, ...) DP_WITH_MODULE(UTIL_MODULE, level, UTIL_NAME, fmt, ##__VA_ARGS__)
 
 namespace utility
 {
@@ -52,40 +60,267 @@ how_many_cpus(void)
     return static_cast<unsigned>(count);
 }
 
-void
-run_on_cpu(unsigned cpu, pid_t pid)
+/**
+    Pin 'pid' to 'cpu', if its current affinity allows that CPU at all.
+    STATUS_INVALID for a CPU we don't have, STATUS_NOT_ALLOWED for one
+    outside the mask, STATUS_SYSTEM if the affinity calls fail.
+*/
+
+status_t
+try_run_on_cpu(unsigned cpu, pid_t pid)
 {
-    static unsigned CPUs = utility::how_many_cpus();
+    static long CPUs = sysconf(_SC_NPROCESSORS_ONLN);
     cpu_set_t CPU_mask;
-    int retcode;
 
-    if (cpu >= CPUs)
-        UTIL_RUNTIME("Illegal CPU value %d\n", cpu);
+    if ((CPUs < 1) || (cpu >= static_cast<unsigned long>(CPUs)))
+        return make_status(STATUS_INVALID);
 
-    UTIL_CPRINT("Using CPU %d as CPU to run on\n", cpu);
-
-    retcode = sched_getaffinity(pid, sizeof(CPU_mask), &CPU_mask);
-    if (retcode)
-        UTIL_ERROR("sched_getaffinity failed");
+    if (sched_getaffinity(pid, sizeof(CPU_mask), &CPU_mask))
+        return make_status(STATUS_SYSTEM, errno);
 
     if (!__CPU_ISSET(cpu, &CPU_mask))
-        UTIL_RUNTIME("not allowed to use CPU %u", cpu);
+        return make_status(STATUS_NOT_ALLOWED);
 
     __CPU_ZERO(&CPU_mask);
     __CPU_SET(cpu, &CPU_mask);
 
-    retcode = sched_setaffinity(pid, sizeof(CPU_mask), &CPU_mask);
-    if (retcode)
-        UTIL_ERROR("Failed to set processor affinity for CPU %u", cpu);
+    if (sched_setaffinity(pid, sizeof(CPU_mask), &CPU_mask))
+        return make_status(STATUS_SYSTEM, errno);
+
+    return status_ok();
+}
+
+void
+run_on_cpu(unsigned cpu, pid_t pid)
+{
+    UTIL_CPRINT("Using CPU %d as CPU to run on\n", cpu);
+
+    status_t s = try_run_on_cpu(cpu, pid);
+    switch (s.code)
+    {
+        case STATUS_OK:
+            break;
+        case STATUS_INVALID:
+            UTIL_RUNTIME("Illegal CPU value %d\n", cpu);
+        case STATUS_NOT_ALLOWED:
+            UTIL_RUNTIME("not allowed to use CPU %u", cpu);
+        default:
+            errno = s.error;
+            UTIL_ERROR("Failed to set processor affinity for CPU %u", cpu);
+    }
 
     UTIL_CPRINT("Okay: assigned to CPU %u\n", cpu);
 }
 
+status_t
+try_set_affinity(const cpu_set_t &mask, pid_t tid)
+{
+    if (sched_setaffinity(tid, sizeof(mask), &mask))
+        return make_status((errno == EINVAL) ? STATUS_NOT_ALLOWED
+                                             : STATUS_SYSTEM, errno);
+    return status_ok();
+}
+
+void
+set_affinity(const cpu_set_t &mask, pid_t tid)
+{
+    status_t s = try_set_affinity(mask, tid);
+    if (!s.ok())
+    {
+        errno = s.error;
+        UTIL_ERROR("Failed to set processor affinity for tid %d", tid);
+    }
+}
+
+status_t
+try_set_thread_affinity(pthread_t thread, const cpu_set_t &mask)
+{
+    int ret = pthread_setaffinity_np(thread, sizeof(mask), &mask);
+    if (ret)
+        return make_status((ret == EINVAL) ? STATUS_NOT_ALLOWED
+                                           : STATUS_SYSTEM, ret);
+    return status_ok();
+}
+
+void
+set_thread_affinity(pthread_t thread, const cpu_set_t &mask)
+{
+    status_t s = try_set_thread_affinity(thread, mask);
+    if (!s.ok())
+    {
+        errno = s.error;
+        UTIL_ERROR("Failed to set processor affinity for a thread");
+    }
+}
+
+namespace
+{
+    status_t
+    affinity_action(pid_t tid, void *arg)
+    {
+        return try_set_affinity(*static_cast<const cpu_set_t *>(arg), tid);
+    }
+}
+
+unsigned int
+set_process_affinity(const cpu_set_t &mask, pid_t pid)
+{
+    unsigned int count = 0;
+    status_t s = for_each_thread(pid, affinity_action,
+                                 const_cast<cpu_set_t *>(&mask), &count);
+    if (!s.ok())
+    {
+        errno = s.error;
+        UTIL_ERROR("Failed to set processor affinity for process %d "
+                   "(%u threads done)", pid, count);
+    }
+
+    UTIL_CPRINT("Affinity set for %u threads of process %d\n", count, pid);
+    return count;
+}
+
+/**
+    MAX_THREAD_PASSES keeps a process that never stops making threads from
+    keeping us here forever: EAGAIN if it's used up.
+*/
+
+status_t
+for_each_thread(pid_t pid, thread_action_t action, void *arg,
+                unsigned int *count)
+{
+    enum { MAX_THREAD_PASSES = 64 };
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+    std::set<pid_t> done;
+    unsigned int succeeded = 0;
+    status_t result = status_ok();
+
+    for (int pass = 0; ; ++pass)
+    {
+        if (pass == MAX_THREAD_PASSES)
+        {
+            result = make_status(STATUS_SYSTEM, EAGAIN);
+            break;
+        }
+
+        DIR *dir = opendir(path);
+        if (!dir)
+        {
+            result = make_status((errno == ENOENT) ? STATUS_NOT_FOUND
+                                                   : STATUS_SYSTEM, errno);
+            break;
+        }
+
+        bool found_new = false;
+        struct dirent *entry;
+        while ((entry = readdir(dir)))
+        {
+            char *end;
+            long tid = strtol(entry->d_name, &end, 10);
+            if (*end || (tid <= 0) || done.count(tid))
+                continue;
+
+            found_new = true;
+            done.insert(tid);
+
+            status_t s = action(tid, arg);
+            if (s.ok())
+                ++succeeded;
+            else if (s.error != ESRCH)
+            {
+                result = s;
+                break;
+            }
+        }
+        closedir(dir);
+
+        if (!result.ok() || !found_new)
+            break;
+    }
+
+    if (count)
+        *count = succeeded;
+    return result;
+}
+
+/**
+    pthread_mutex_init() with a priority protocol attached, for use with
+    the LOCK/UNLOCK macros.  'ceiling' only matters for MUTEX_PRIO_PROTECT
+    and should be at least the highest priority of any thread that will
+    take the lock.
+
+    Returns 0 or a pthread error code, just like pthread_mutex_init(), so
+    callers can report problems with their own naming.
+*/
+
+int
+init_mutex(pthread_mutex_t *mutex, mutex_protocol_t protocol, int ceiling)
+{
+    pthread_mutexattr_t attr;
+    int ret;
+
+    ret = pthread_mutexattr_init(&attr);
+    if (ret)
+        return ret;
+
+    switch (protocol)
+    {
+    case MUTEX_PRIO_INHERIT:
+        ret = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+        break;
+
+    case MUTEX_PRIO_PROTECT:
+        ret = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT);
+        if (!ret)
+            ret = pthread_mutexattr_setprioceiling(&attr, ceiling);
+        break;
+
+    case MUTEX_DEFAULT:     // fall-through
+    default:
+        break;
+    }
+
+    if (!ret)
+        ret = pthread_mutex_init(mutex, &attr);
+
+    pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+
+/**
+    Sleep in the kernel for as long as '*word' still equals 'expected'.
+    Returns 0 on a wakeup, and -1 with errno set otherwise: EAGAIN means
+    the word had already changed, EINTR a signal.  Both are normal, so the
+    caller is expected to re-check its condition and loop.
+*/
+
+int
+futex_wait(volatile int *word, int expected, bool shared)
+{
+    int op = shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE;
+    return syscall(SYS_futex, word, op, expected, 0, 0, 0);
+}
+
+/**
+    Wake up to 'how_many' sleepers on 'word'.  INT_MAX wakes them all.
+    Returns the number woken, or -1 on failure.
+*/
+
+int
+futex_wake(volatile int *word, int how_many, bool shared)
+{
+    int op = shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE;
+    return syscall(SYS_futex, word, op, how_many, 0, 0, 0);
+}
+
 }       // end utility namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 
 #undef UTIL_NAME
+#undef UTIL_MODULE
 #undef UTIL_CPRINT
 #undef UTIL_VPRINT
 #undef UTIL_ERROR
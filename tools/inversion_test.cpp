@@ -0,0 +1,236 @@
+/**
+    Shows what MUTEX_PRIO_INHERIT (pthread_nap, utility::init_mutex()) buys.
+
+        inversion_test [iterations]
+
+    The classic three: a SCHED_OTHER 'low' thread takes the lock and works
+    for HOLD_US; a SCHED_FIFO 'high' thread then wants it; and a SCHED_FIFO
+    'medium' thread, which has nothing to do with the lock, spins for
+    SPIN_US.  All on one CPU.  With an ordinary mutex, medium keeps low
+    from running, so high waits for medium too: SPIN_US and then some.
+    With priority inheritance low runs at high's priority while high waits
+    for it, and the wait is about HOLD_US.
+
+    Prints the worst and average time high spent blocked for each protocol.
+    Exits 1 if the inheriting mutex didn't keep it under SPIN_US / 2, and 2
+    if the priorities couldn't be set (needs root or CAP_SYS_NICE).
+*/
+
+#include <iostream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "program_IO.h"
+#include "scheduler_utils.h"
+#include "utility.h"
+
+int debug_level = 0;
+
+namespace
+{
+    enum
+    {
+        HOLD_US = 200,
+        SPIN_US = 10 * 1000,
+        DEFAULT_ITERATIONS = 50,
+        HIGH_PRIORITY = 30,
+        MEDIUM_PRIORITY = 20,
+        CPU = 0
+    };
+
+    pthread_mutex_t lock;
+
+    sem_t go_low, go_medium;        // start signals
+    sem_t held;                     // low has the lock
+    sem_t low_done, medium_done;
+
+    volatile bool stopping;
+    volatile bool setup_failed;
+
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    long long max_blocked_ns;
+    long long total_blocked_ns;
+
+    long long
+    now_ns(void)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
+
+    void
+    busy_for(long long ns)
+    {
+        long long until = now_ns() + ns;
+        while (now_ns() < until)
+            ;
+    }
+
+    // Everybody on CPU, high and medium at their FIFO priorities.
+    void
+    setup_thread(int priority)
+    {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(CPU, &mask);
+        if (!utility::try_set_affinity(mask).ok())
+            setup_failed = true;
+
+        if (priority && !try_set_thread_realtime_priority(pthread_self(),
+                                                          priority,
+                                                          SCHED_FIFO).ok())
+            setup_failed = true;
+    }
+
+    void *
+    low_main(void *)
+    {
+        setup_thread(0);
+        for (;;)
+        {
+            sem_wait(&go_low);
+            if (stopping)
+                return 0;
+
+            pthread_mutex_lock(&lock);
+            sem_post(&held);
+            busy_for(HOLD_US * 1000LL);
+            pthread_mutex_unlock(&lock);
+            sem_post(&low_done);
+        }
+    }
+
+    void *
+    medium_main(void *)
+    {
+        setup_thread(MEDIUM_PRIORITY);
+        for (;;)
+        {
+            sem_wait(&go_medium);
+            if (stopping)
+                return 0;
+
+            busy_for(SPIN_US * 1000LL);
+            sem_post(&medium_done);
+        }
+    }
+
+    /**
+        high drives it: once low has the lock, medium is let loose (it
+        can't run until high blocks) and high goes for the lock.
+    */
+
+    void *
+    high_main(void *)
+    {
+        setup_thread(HIGH_PRIORITY);
+        if (setup_failed)
+            return 0;
+
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            usleep(SPIN_US);        // room for everyone else: RT throttling
+
+            sem_post(&go_low);
+            sem_wait(&held);
+            sem_post(&go_medium);
+
+            long long start = now_ns();
+            pthread_mutex_lock(&lock);
+            long long blocked = now_ns() - start;
+            pthread_mutex_unlock(&lock);
+
+            if (blocked > max_blocked_ns)
+                max_blocked_ns = blocked;
+            total_blocked_ns += blocked;
+
+            sem_wait(&low_done);
+            sem_wait(&medium_done);
+        }
+
+        return 0;
+    }
+
+    // false if the threads couldn't be set up
+    bool
+    run(utility::mutex_protocol_t protocol, const char *name)
+    {
+        if (utility::init_mutex(&lock, protocol))
+        {
+            std::cerr << name << ": couldn't make the mutex\n";
+            return false;
+        }
+
+        sem_init(&go_low, 0, 0);
+        sem_init(&go_medium, 0, 0);
+        sem_init(&held, 0, 0);
+        sem_init(&low_done, 0, 0);
+        sem_init(&medium_done, 0, 0);
+        stopping = false;
+        setup_failed = false;
+        max_blocked_ns = 0;
+        total_blocked_ns = 0;
+
+        pthread_t low, medium, high;
+        pthread_create(&low, 0, low_main, 0);
+        pthread_create(&medium, 0, medium_main, 0);
+        pthread_create(&high, 0, high_main, 0);
+
+        pthread_join(high, 0);
+        stopping = true;
+        sem_post(&go_low);
+        sem_post(&go_medium);
+        pthread_join(low, 0);
+        pthread_join(medium, 0);
+        pthread_mutex_destroy(&lock);
+
+        if (setup_failed)
+            return false;
+
+        std::cout << name << ": blocked at worst "
+                  << max_blocked_ns / 1000 << " us, on average "
+                  << total_blocked_ns / iterations / 1000 << " us ("
+                  << iterations << " tries, lock held " << HOLD_US
+                  << " us, medium spins " << SPIN_US << " us)\n";
+        return true;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [iterations]\n";
+        return 2;
+    }
+    if (argc == 2)
+        iterations = strtoul(argv[1], 0, 10);
+    if (!iterations)
+        iterations = DEFAULT_ITERATIONS;
+
+    if (!run(utility::MUTEX_DEFAULT, "MUTEX_DEFAULT"))
+    {
+        std::cerr << argv[0] << ": couldn't set SCHED_FIFO and affinity: "
+                  << "run as root\n";
+        return 2;
+    }
+
+    if (!run(utility::MUTEX_PRIO_INHERIT, "MUTEX_PRIO_INHERIT"))
+        return 2;
+
+    if (max_blocked_ns > SPIN_US * 1000LL / 2)
+    {
+        std::cout << "priority inheritance did NOT bound the inversion\n";
+        return 1;
+    }
+
+    std::cout << "inversion bounded by priority inheritance\n";
+    return 0;
+}
@@ -0,0 +1,50 @@
+/**
+    Turn a binary log (binary_log.h) back into text.
+
+        log_decode [file]
+
+    reads 'file', or stdin if there isn't one, and writes the text to
+    stdout.
+*/
+
+#include <fstream>
+#include <iostream>
+
+#include "binary_log.h"
+#include "program_IO.h"
+
+int debug_level = 0;
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [binary log]\n";
+        return 1;
+    }
+
+    try
+    {
+        if (argc == 2)
+        {
+            std::ifstream in(argv[1], std::ios::binary);
+            if (!in)
+            {
+                std::cerr << argv[0] << ": couldn't open '" << argv[1]
+                          << "'\n";
+                return 1;
+            }
+            binary_log::decode(in, std::cout);
+        }
+        else
+            binary_log::decode(std::cin, std::cout);
+    }
+    catch (std::exception &)
+    {
+        // decode() has already said what was wrong
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/**
+    What random_engine's generators cost per value, next to the libc calls
+    random_utilities used to make directly.
+
+        random_bench [draws]
+
+    The old path is erand48() / nrand48() / jrand48() on one shared state,
+    which is what get_random() and friends were before random_engine: a
+    double, an unsigned long (31 bits of it), and 64 bits made of two
+    jrand48()s.  Then the same three through a random_engine, once for
+    every generator.  Prints ns per value and the bits each value carries,
+    single threaded.  Always exits 0: it's a measurement, not a test (see
+    random_check for that).
+*/
+
+#include <iomanip>
+#include <iostream>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "random_utilities.h"
+
+int debug_level = 0;
+
+using namespace random_utilities;
+
+namespace
+{
+    enum
+    {
+        DEFAULT_DRAWS = 1 << 24
+    };
+
+    unsigned short old_state[RANDOM_STATE_ARRAY_SIZE];
+    volatile uint64_t sink;
+
+    double
+    now(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+    }
+
+    void
+    print(const char *path, const char *what, unsigned int bits,
+          double seconds, unsigned long draws)
+    {
+        std::cout << std::setw(14) << path << "  "
+                  << std::setw(26) << what << "  "
+                  << std::setw(2) << bits << " bits  "
+                  << std::fixed << std::setprecision(2) << std::setw(7)
+                  << 1e9 * seconds / draws << " ns/value\n";
+    }
+
+    void
+    bench_old(unsigned long draws)
+    {
+        double d = 0.0;
+        double start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+            d += erand48(old_state);
+        print("libc", "erand48()", 48, now() - start, draws);
+        sink = static_cast<uint64_t>(d);
+
+        uint64_t x = 0;
+        start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+            x ^= static_cast<unsigned long>(nrand48(old_state));
+        print("libc", "nrand48() (unsigned long)", 31, now() - start, draws);
+
+        start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+        {
+            uint64_t high = static_cast<uint32_t>(jrand48(old_state));
+            x ^= (high << 32) | static_cast<uint32_t>(jrand48(old_state));
+        }
+        print("libc", "2 x jrand48()", 64, now() - start, draws);
+        sink = x;
+    }
+
+    void
+    bench_engine(generator_t g, const char *name, unsigned long draws)
+    {
+        random_engine e(g);
+        e.split(1, 0, 1);
+
+        double d = 0.0;
+        double start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+            d += e.erand();
+        print(name, "erand()", (g == GENERATOR_RAND48) ? 48 : 53,
+              now() - start, draws);
+        sink = static_cast<uint64_t>(d);
+
+        uint64_t x = 0;
+        start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+            x ^= get_random<unsigned long>(e);
+        print(name, "get_random<unsigned long>", 8 * sizeof(unsigned long),
+              now() - start, draws);
+
+        start = now();
+        for (unsigned long i = 0; i < draws; ++i)
+            x ^= e.next64();
+        print(name, "next64()", 64, now() - start, draws);
+        sink = x;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [draws]\n";
+        return 1;
+    }
+
+    unsigned long draws = DEFAULT_DRAWS;
+    if (argc == 2)
+        draws = strtoul(argv[1], 0, 10);
+    if (!draws)
+        draws = DEFAULT_DRAWS;
+
+    bench_old(draws);
+    bench_engine(GENERATOR_RAND48, "rand48", draws);
+    bench_engine(GENERATOR_XOSHIRO256, "xoshiro256**", draws);
+    bench_engine(GENERATOR_PHILOX, "philox4x32-10", draws);
+    return 0;
+}
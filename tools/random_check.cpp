@@ -0,0 +1,104 @@
+/**
+    Runs random_diagnostics over every generator.
+
+        random_check [threads]
+
+    For each generator: check_quality() (every draw, every get_random<T>,
+    the bounded draws and the bulk fills), then measure_throughput() on 1
+    thread and on 'threads' of them, by default one per online CPU but
+    never fewer than 2, so the multi-threaded path always gets run.
+
+    Prints every failed check and a pass count, then the throughputs.
+    Exits 1 if any check failed, 2 if something threw.
+*/
+
+#include <iostream>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>                 // sysconf()
+
+#include "program_IO.h"
+#include "random_diagnostics.h"
+
+int debug_level = 0;
+
+using namespace random_utilities;
+
+namespace
+{
+    const generator_t GENERATORS[] =
+    {
+        GENERATOR_RAND48,
+        GENERATOR_XOSHIRO256,
+        GENERATOR_PHILOX
+    };
+
+    // true if everything passed
+    bool
+    check(generator_t g)
+    {
+        std::vector<quality_report_t> quality(check_quality(g));
+
+        unsigned int passed = 0;
+        for (size_t i = 0; i < quality.size(); ++i)
+        {
+            if (quality[i].passed)
+                ++passed;
+            else
+                std::cout << "  " << quality[i] << "\n";
+        }
+        std::cout << "  " << passed << " of " << quality.size()
+                  << " checks passed\n";
+
+        return all_passed(quality);
+    }
+
+    void
+    measure(generator_t g, unsigned int threads)
+    {
+        std::vector<throughput_report_t> speed(measure_throughput(g, threads));
+        for (size_t i = 0; i < speed.size(); ++i)
+            std::cout << "  " << speed[i] << "\n";
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [threads]\n";
+        return 2;
+    }
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 2)
+        threads = strtol(argv[1], 0, 10);
+    if (threads < 2)
+        threads = 2;
+
+    bool ok = true;
+    try
+    {
+        const unsigned int count = sizeof(GENERATORS) / sizeof(GENERATORS[0]);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            generator_t g = GENERATORS[i];
+            std::cout << generator_name(g) << ":\n";
+
+            if (!check(g))
+                ok = false;
+            measure(g, 1);
+            measure(g, threads);
+        }
+    }
+    catch (std::exception &)
+    {
+        // the diagnostics have already said what was wrong
+        return 2;
+    }
+
+    std::cout << (ok ? "all generators passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}